@@ -1,299 +1,330 @@
 #include <Carrier.h>
+#include <Profiler.h>
 
 /*
- * Constructor for Carrier.cpp that sets and stores the values given in their respective places.
+ * Constructor of the species: sets the sign and the transport of the given carrier type
+ * in the detector (at the current temperature of the detector).
  *
  */
-Carrier::Carrier( char carrier_type, double q,  double x_init, double y_init , SMSDetector * detector, double gen_time = 1.e-9):
+CarrierSpecies::CarrierSpecies( char carrier_type, SMSDetector * detector):
   _carrier_type(carrier_type), // Charge carrier(CC)  type. Typically  electron/positron
-  _q(q), //Charge in electron units. Always positive.
-  _gen_time(gen_time), // Instant of CC generation
   _detector(detector), // Detector type and characteristics
-//	_electricField(_detector->get_d_f_grad(),
-//	_weightingField(_detector->get_w_f_grad(),
-  _myTemp(detector->get_temperature()), // Temperature of the diode
-  _drift(_carrier_type, _detector->get_d_f_grad(), _myTemp), // Carrier Transport object
-  _mu(_carrier_type, _myTemp) // Mobility of the CC
+  _drift(carrier_type, detector->get_d_f_grad(), detector->get_temperature(),
+      {{detector->get_x_min(), detector->get_x_max(), detector->get_y_min(), detector->get_y_max()}}), // Carrier Transport object
+  _mu(carrier_type, detector->get_temperature()) // Mobility of the CC
 {
-//	_electricField = _detector->get_d_f_grad();
-//	_weightingField = _detector->get_w_f_grad();
-  _x[0] = x_init; // Starting horizontal position
-  _x[1] = y_init; // Starting vertical position
-
-  if (_carrier_type == 'e') 
+  if (_carrier_type == 'e')
   { // If electron-like
-    _sign = -1; // Negative charge 
+    _sign = -1; // Negative charge
   }
-  else 
+  else
   { // it's hole-like
     _sign = 1; // Positive charge
   }
 }
 
+CarrierSpecies::CarrierSpecies() :
+  _carrier_type('\0'),
+  _sign(0),
+  _detector(NULL)
+{
+}
+
 /*
  ******************** CARRIER DRIF SIMULATION METHOD**************************
- * --Overloaded--
  *
- * Simulates how the CC drifts inside the detector in the 
- * desired number of steps
+ * Simulates how the CC drifts inside the detector, starting at (x_init, y_init),
+ * in the desired number of steps and adds the induced current to curr
+ *
+ * If use_w_potential is set the current in each bin is obtained from the
+ * weighting potential difference between the ends of the RK4 step instead
+ * of the instantaneous q*mu*(E.Ew). The induced charge is then exact for
+ * any dt and the weighting field is not needed.
+ *
+ * Trapping reduces the current by exp(-age/trapping_time), the age being
+ * counted from the step in which the carrier is generated (start_step).
+ * The factor is updated by one multiplication per step.
  *
  */
-std::valarray<double> Carrier::simulate_drift(double dt, double max_time)
+void CarrierSpecies::simulate_drift(const CarrierRecord &carrier, double x_init, double y_init, double dt, double max_time, std::valarray<double> &curr, bool use_w_potential, double trapping_time) const
 {
   // get number of steps from time
-  int max_steps = (int) std::floor(max_time / dt);
-
-  std::valarray<double>  i_n(max_steps); // valarray to save intensity
+  int max_steps = std::min((int) std::floor(max_time / dt), (int) curr.size());
 
   runge_kutta4<std::array< double,2>> stepper;
 
+  std::array< double,2> x = {{x_init, y_init}}; // carrier position
+  std::array< double,2> e_field; // electric field at the carrier position
+  std::array< double,2> w_field; // weighting field at the carrier position
+
   // wrapper for the arrays using dolphin array class
-  Array<double> wrap_x(2, _x.data());
-  Array<double> wrap_e_field(2, _e_field.data());
-  Array<double> wrap_w_field(2, _w_field.data());
+  Array<double> wrap_x(2, x.data());
+  Array<double> wrap_e_field(2, e_field.data());
+  Array<double> wrap_w_field(2, w_field.data());
 
-  double t=0.0;
+  double t=0.0; // Start at time = 0
+  int n_steps = 0; // drift steps (for the profiler)
+  bool exited = false;
 
-  for ( int i = 0 ; i < max_steps; i++) // Simulate for the desired number of steps
-  {
+  // Trapping effects due to radiation-induced defects (traps)
+  double trapping = 1.0;
+  double trapping_step = exp(-dt/trapping_time);
 
-    if (t < _gen_time)
+  for ( int i = 0 ; i < max_steps; i++)
+  {
+    if (t < carrier.gen_time) // If CC not yet generated
     {
-      i_n[i] = 0;
     }
-    else if (_detector->is_out(_x)) // if outside of the detector
+    else if (_detector->is_out(x)) // If CC outside detector
     {
-      i_n[i] = 0;
-      break;
+      exited = true;
+      break; // Finish (CC gone out)
+    }
+    else if (use_w_potential)
+    {
+      // i = q*v.Ew = -q*dPhi_w/dt integrated over the whole step
+      double w_pot_start = get_w_potential(x);
+      stepper.do_step(_drift, x, t, dt);
+      curr[i] += -carrier.q * trapping * (get_w_potential(x) - w_pot_start) / dt;
+      trapping *= trapping_step;
+      n_steps++;
     }
     else
     {
       _detector->get_d_f_grad()->eval(wrap_e_field, wrap_x);
       _detector->get_w_f_grad()->eval(wrap_w_field, wrap_x);
-			//_weightingField->eval(wrap_w_field, wrap_x);
-			//_electricField->eval(wrap_w_field, wrap_x); 
-      _e_field_mod = sqrt(_e_field[0]*_e_field[0] + _e_field[1]*_e_field[1]);
-      i_n[i] = _q *_sign*_mu.obtain_mobility(_e_field_mod) * (_e_field[0]*_w_field[0] + _e_field[1]*_w_field[1]);
-      // Trapping effects due to radiation-induced defects (traps) implemented in CarrierColleciton.cpp
-      stepper.do_step(_drift, _x, t, dt);
+      double e_field_mod = sqrt(e_field[0]*e_field[0] + e_field[1]*e_field[1]);
+      curr[i] += carrier.q * trapping *_sign* _mu.obtain_mobility(e_field_mod) * (e_field[0]*w_field[0] + e_field[1]*w_field[1]);
+      trapping *= trapping_step;
+      stepper.do_step(_drift, x, t, dt);
+      n_steps++;
     }
     t+=dt;
   }
-  return i_n;
+  // Two evaluations at the start of every step (fields or weighting potential) plus the 4 RK4 stages
+  Profiler::add(Profiler::FIELD_EVALS, 6*n_steps);
+  Profiler::add(exited ? Profiler::CARRIERS_EXITED : Profiler::CARRIERS_TIMED_OUT);
 }
 
 /*
- ******************** CARRIER DRIF SIMULATION METHOD**************************
- * --Overloaded--
- *
- * Simulates how the CC drifts inside the detector in the 
- * desired number of steps
+ * Same drift, with the derivatives of the induced current with respect to the
+ * parameters of the field sensitivities of the detector (see
+ * SMSDetector::solve_d_f_grad_sensitivities) added to d_curr, one valarray per
+ * parameter. The tangent-linear model of every RK4 step is integrated together
+ * with the position (DriftSensitivity), so one drift gives all the derivatives.
+ * If d_curr has one more valarray, the derivative with respect to trapping_time
+ * is added to it. The change of the instant a carrier leaves the detector is
+ * not included.
  *
  */
-std::valarray<double> Carrier::simulate_drift(double dt, double max_time, double x_init, double y_init )
+void CarrierSpecies::simulate_drift_sensitivity(const CarrierRecord &carrier, double x_init, double y_init, double dt, double max_time, std::valarray<double> &curr, std::vector< std::valarray<double> > &d_curr, bool use_w_potential, double trapping_time) const
 {
-  _x[0] = x_init;
-  _x[1] = y_init;
+  int max_steps = std::min((int) std::floor(max_time / dt), (int) curr.size());
+  int n_sens = _detector->get_n_sensitivities();
+  bool d_trapping = ((int) d_curr.size() > n_sens); // last one: derivative with respect to trapping_time
+  double h = 0.5*_detector->get_cell_size(); // step for the spatial derivatives of the fields
+
+  std::vector<Function *> d_f_grad_sens(n_sens);
+  for (int k = 0; k < n_sens; k++) d_f_grad_sens[k] = _detector->get_d_f_grad_sensitivity(k);
+  DriftSensitivity drift(_carrier_type, _detector->get_d_f_grad(), d_f_grad_sens, _detector->get_temperature(), h);
+  runge_kutta4< std::vector<double> > stepper;
+
+  std::vector<double> s(2 + 2*n_sens, 0.); // position and its derivatives (0 when generated)
+  s[0] = x_init;
+  s[1] = y_init;
+  std::vector<double> dsdt(s.size());
+  std::vector<double> d_i(n_sens); // derivatives of the current of one step
+  std::array< double,2> x;
 
-  // get number of steps from time
-  int max_steps = (int) std::floor(max_time / dt);
-
-  std::valarray<double>  i_n(max_steps); // valarray to save intensity
-
-  runge_kutta4<std::array< double,2>> stepper;
-
-  // wrapper for the arrays using dolphin array class
-  Array<double> wrap_x(2, _x.data());
-  Array<double> wrap_e_field(2, _e_field.data());
-  Array<double> wrap_w_field(2, _w_field.data());
-
-  double t=0.0; // Start at time = 0
+  double t=0.0;
+  int n_steps = 0;
+  bool exited = false;
+  double trapping = 1.0; // exp(-age/trapping_time), as in simulate_drift
+  double trapping_step = exp(-dt/trapping_time);
+  double age = 0.0;
 
   for ( int i = 0 ; i < max_steps; i++)
   {
-
-    if (t < _gen_time) // If CC not yet generated
+    x = {{s[0], s[1]}};
+    double curr_step = 0.;
+    if (t < carrier.gen_time) // If CC not yet generated
     {
-      i_n[i] = 0;
+      t+=dt;
+      continue;
     }
-    else if (_detector->is_out(_x)) // If CC outside detector
+    else if (_detector->is_out(x)) // If CC outside detector
     {
-      i_n[i] = 0;
-      break; // Finish (CC gone out)
+      exited = true;
+      break;
+    }
+    else if (use_w_potential)
+    {
+      // i = -q*dPhi_w/dt over the step  ->  di/dp = -q*[grad(Phi_w).dx/dp](start..end)/dt
+      double w_pot_start = get_w_potential(x);
+      std::array< double,2> grad_start = get_w_potential_gradient(x, h);
+      std::vector<double> s_start = s;
+      stepper.do_step(drift, s, t, dt);
+      x = {{s[0], s[1]}};
+      std::array< double,2> grad_end = get_w_potential_gradient(x, h);
+      curr_step = -carrier.q * (get_w_potential(x) - w_pot_start) / dt;
+      for (int k = 0; k < n_sens; k++)
+      {
+        double d_pot = grad_end[0]*s[2+2*k] + grad_end[1]*s[3+2*k] - grad_start[0]*s_start[2+2*k] - grad_start[1]*s_start[3+2*k];
+        d_i[k] = -carrier.q * d_pot / dt;
+      }
     }
     else
     {
-//std::lock_guard<std::mutex> lock(safeRead);
-			safeRead.lock();
-			//_detector->get_mesh()->bounding_box_tree();
-      _detector->get_d_f_grad()->eval(wrap_e_field, wrap_x);
-      _detector->get_w_f_grad()->eval(wrap_w_field, wrap_x);
-			//_weightingField->eval(wrap_w_field, wrap_x);
-			//_electricField->eval(wrap_w_field, wrap_x); 
-			safeRead.unlock();
-      _e_field_mod = sqrt(_e_field[0]*_e_field[0] + _e_field[1]*_e_field[1]);
-      i_n[i] = _q *_sign* _mu.obtain_mobility(_e_field_mod) * (_e_field[0]*_w_field[0] + _e_field[1]*_w_field[1]);
-      stepper.do_step(_drift, _x, t, dt);
-      // Trapping effects due to radiation-induced defects (traps) implemented in CarrierColleciton.cpp
+      // i = q*v.Ew  ->  di/dp = q*(dv/dp.Ew + v.J_Ew dx/dp)
+      double w_field[2];
+      double w_jacobian[2][2];
+      DriftSensitivity::eval_jacobian(_detector->get_w_f_grad(), x, h, w_field, w_jacobian);
+      drift(s, dsdt, t);
+      curr_step = carrier.q * (dsdt[0]*w_field[0] + dsdt[1]*w_field[1]);
+      for (int k = 0; k < n_sens; k++)
+      {
+        const double *dx_dp = &s[2+2*k];
+        const double *dv_dp = &dsdt[2+2*k];
+        double d_w_field[2];
+        for (int j = 0; j < 2; j++) d_w_field[j] = w_jacobian[j][0]*dx_dp[0] + w_jacobian[j][1]*dx_dp[1];
+        d_i[k] = carrier.q * (dv_dp[0]*w_field[0] + dv_dp[1]*w_field[1] + dsdt[0]*d_w_field[0] + dsdt[1]*d_w_field[1]);
+      }
+      stepper.do_step(drift, s, t, dt);
     }
+    // Trapping, and its derivative d/dtau exp(-age/tau) = exp(-age/tau)*age/tau^2
+    curr[i] += curr_step * trapping;
+    for (int k = 0; k < n_sens; k++) d_curr[k][i] += d_i[k] * trapping;
+    if (d_trapping) d_curr[n_sens][i] += curr_step * trapping * age/(trapping_time*trapping_time);
+    trapping *= trapping_step;
+    age += dt;
+    n_steps++;
     t+=dt;
   }
-	  return i_n;
+  // 4 RK4 stages with the field, its derivatives and the n_sens sensitivities, plus the current
+  int stage_evals = 5 + n_sens;
+  Profiler::add(Profiler::FIELD_EVALS, n_steps*(4*stage_evals + (use_w_potential ? 12 : stage_evals + 5)));
+  Profiler::add(exited ? Profiler::CARRIERS_EXITED : Profiler::CARRIERS_TIMED_OUT);
 }
 
-/************************************************************************
-*************************************************************************
-***                                                                   ***
-***                  BEHOLD!! BORING GETTERS AHEAD                    ***
-***                                                                   ***
-*************************************************************************
-*************************************************************************/
-
 /*
- * Getter for the type of the CC (electro / hole)
+ * Step in which a carrier starts to drift (same time stepping as simulate_drift),
+ * age 0 for trapping
  */
-
-char Carrier::Carrier::get_carrier_type()
+int CarrierSpecies::start_step(const CarrierRecord &carrier, double dt)
 {
-  return _carrier_type; // electron or hole
+  int i = 0;
+  for (double t = 0.0; t < carrier.gen_time; t += dt) i++;
+  return i;
 }
 
 /*
- * Getter for the position of the CC
+ * Weighting potential at a given position. The position is clamped to the
+ * detector volume so that a carrier that just left the detector sees the
+ * potential of the electrode it was collected by.
  */
-
-std::array< double,2> Carrier::get_x()
+double CarrierSpecies::get_w_potential(const std::array< double,2> &x) const
 {
-  return _x;
+  std::array< double,2> x_in;
+  x_in[0] = std::min(std::max(x[0], _detector->get_x_min()), _detector->get_x_max());
+  x_in[1] = std::min(std::max(x[1], _detector->get_y_min()), _detector->get_y_max());
+
+  double w_pot = 0.;
+  Array<double> wrap_x(2, x_in.data());
+  Array<double> wrap_w_pot(1, &w_pot);
+  _detector->get_w_u()->eval(wrap_w_pot, wrap_x);
+  return w_pot;
 }
 
 /*
- * Getter for the charge of the CC
+ * Gradient of the weighting potential (central differences with step h)
  */
-
-double Carrier::get_q()
+std::array< double,2> CarrierSpecies::get_w_potential_gradient(const std::array< double,2> &x, double h) const
 {
-  return _q;
+  std::array< double,2> gradient;
+  for (int j = 0; j < 2; j++)
+  {
+    std::array< double,2> plus = x;
+    std::array< double,2> minus = x;
+    plus[j] += h;
+    minus[j] -= h;
+    gradient[j] = (get_w_potential(plus) - get_w_potential(minus))/(2.*h);
+  }
+  return gradient;
 }
 
-
 /*
- ********************** DESTRUCTOR OF THE CLASS CARRIER	**************************
+ * Getter for the type of the CC (electro / hole)
  */
-Carrier::~Carrier()
+char CarrierSpecies::get_carrier_type() const
 {
-
+  return _carrier_type; // electron or hole
 }
 
 /*
- **************************** PARALLEL **********************************
+ * Constructor for Carrier.cpp that sets and stores the values given in their respective places.
+ *
  */
+Carrier::Carrier( char carrier_type, double q,  double x_init, double y_init , SMSDetector * detector, double gen_time):
+  _species(carrier_type, detector)
+{
+  _record.x = x_init; // Starting horizontal position
+  _record.y = y_init; // Starting vertical position
+  _record.q = q; //Charge in electron units. Always positive.
+  _record.gen_time = gen_time; // Instant of CC generation
+}
 
 /*
- * Copy initialization
+ ******************** CARRIER DRIF SIMULATION METHOD**************************
+ * --Overloaded--
+ *
+ * Simulates how the CC drifts inside the detector in the
+ * desired number of steps, from its initial position or from (x_init, y_init)
+ *
  */
-Carrier::Carrier(const Carrier& other)
+std::valarray<double> Carrier::simulate_drift(double dt, double max_time, bool use_w_potential)
+{
+  return simulate_drift(dt, max_time, _record.x, _record.y, use_w_potential);
+}
+
+std::valarray<double> Carrier::simulate_drift(double dt, double max_time, double x_init, double y_init, bool use_w_potential)
 {
-  _carrier_type = other._carrier_type;
-	_q = other._q;
-	_gen_time = other._gen_time;
-	_x = other._x; 
-	_e_field = other._e_field; 
-	_w_field = other._w_field;
-	_e_field_mod = other._e_field_mod;
-	_sign = other._sign; 
-	_detector = other._detector;
-	_myTemp = other._myTemp;
-	_drift = other._drift;
-	_mu = other._mu;
-	_trapping_time = other._trapping_time;
-	//_electricField = other.//_electricField;
-	//_weightingField = other._weightingField;
-	std::lock_guard<std::mutex> lock(other.safeRead);
+  std::valarray<double>  i_n((size_t) std::floor(max_time / dt)); // valarray to save intensity
+  _species.simulate_drift(_record, x_init, y_init, dt, max_time, i_n, use_w_potential);
+  return i_n;
 }
 
+/************************************************************************
+*************************************************************************
+***                                                                   ***
+***                  BEHOLD!! BORING GETTERS AHEAD                    ***
+***                                                                   ***
+*************************************************************************
+*************************************************************************/
+
 /*
- * Copy assignment
+ * Getter for the type of the CC (electro / hole)
  */
-Carrier& Carrier::operator = (const Carrier& other) 
+
+char Carrier::get_carrier_type()
 {
-	std::lock(safeRead, other.safeRead);
-	std::lock_guard<std::mutex> self_lock(safeRead, std::adopt_lock);
-	std::lock_guard<std::mutex> other_lock(other.safeRead, std::adopt_lock);
-  _carrier_type = other._carrier_type;
-	_q = other._q;
-	_gen_time = other._gen_time;
-	_x = other._x; 
-	_e_field = other._e_field; 
-	_w_field = other._w_field;
-	_e_field_mod = other._e_field_mod;
-	_sign = other._sign; 
-	_detector = other._detector;
-	_myTemp = other._myTemp;
-	_drift = other._drift;
-	_trapping_time = other._trapping_time;
-	//_electricField = other._electricField;
-	//_weightingField = other._weightingField;
-	return *this;
+  return _species.get_carrier_type(); // electron or hole
 }
 
-
 /*
- * Move initialization
+ * Getter for the position of the CC
  */
-Carrier::Carrier(Carrier&& other)
+
+std::array< double,2> Carrier::get_x()
 {
-  _carrier_type = std::move(other._carrier_type);
-	_q = std::move(other._q);
-	_gen_time = std::move(other._gen_time);
-	_x = std::move(other._x); 
-	_e_field = std::move(other._e_field); 
-	_w_field = std::move(other._w_field);
-	_e_field_mod = std::move(other._e_field_mod);
-	_sign = std::move(other._sign); 
-	_detector = std::move(other._detector);
-	_myTemp = std::move(other._myTemp);
-	_drift = std::move(other._drift);
-	_mu = std::move(other._mu);
-	_trapping_time = std::move(other._trapping_time);
-	//_electricField = std::move(_electricField);
-	//_weightingField = std::move(_weightingField);
-	std::lock_guard<std::mutex> lock(other.safeRead);
+  std::array< double,2> x = {{_record.x, _record.y}};
+  return x;
 }
 
 /*
- * Move assignment
+ * Getter for the charge of the CC
  */
-Carrier& Carrier::operator = ( Carrier&& other) 
+
+double Carrier::get_q()
 {
-	std::lock(safeRead, other.safeRead);
-	std::lock_guard<std::mutex> self_lock(safeRead, std::adopt_lock);
-	std::lock_guard<std::mutex> other_lock(other.safeRead, std::adopt_lock);
-  _carrier_type = std::move(other._carrier_type);
-	other._carrier_type = '\0';
-	_q = std::move(other._q);
-	other._q = 0;
-	_gen_time = std::move(other._gen_time);
-	other._gen_time = 0;
-	_x = std::move(other._x); 
-	other._x = {0,0};
-	_e_field = std::move(other._e_field); 
-	other._e_field = {0,0};
-	_w_field = std::move(other._w_field);
-	other._w_field = {0,0};
-	_e_field_mod = std::move(other._e_field_mod);
-	other._e_field_mod = 0;
-	_sign = std::move(other._sign); 
-	other._sign = 0;
-	_detector = std::move(other._detector);
-	other._detector = NULL;
-	_myTemp = std::move(other._myTemp);
-	other._myTemp = 0;
-	_drift = std::move(other._drift);
-	_mu = std::move(other._mu);
-	_trapping_time = std::move(other._trapping_time);
-	//_electricField = std::move(_electricField);
-	//_weightingField = std::move(_weightingField);
-	other._trapping_time = 1e300;
-	return *this;
+  return _record.q;
 }
@@ -2,7 +2,8 @@
 #define CARRIER_H
 
 #include  <valarray>
-#include  <mutex>
+#include  <algorithm>
+#include  <limits>
 
 #include <CarrierTransport.h>
 #include <SMSDetector.h>
@@ -15,62 +16,81 @@ using namespace boost::numeric::odeint;
 //using namespace dolfin;
 
 /*
- **************************CARRIER************************
- *
- *
- *  Detailed Description
+ **************************CARRIER RECORD************************
  *
+ * Plain data of one charge carrier (32 bytes). The type is not stored:
+ * carriers of each type are kept in their own list, that shares one
+ * CarrierSpecies for the drift.
  *
+ */
+
+struct CarrierRecord
+{
+  double x; // initial position
+  double y;
+  double q; // charge
+  double gen_time; // instant of generation of the carrier
+};
+
+/*
+ **************************CARRIER SPECIES************************
  *
+ * Everything that is common to all the carriers of one type in one
+ * detector: sign, mobility and drift transport. It is built once per
+ * collection and simulate_drift() does not modify it, so it can be used
+ * by any number of threads at the same time.
  *
  */
 
-class Carrier
+class CarrierSpecies
 {
   private:
     char _carrier_type;
-    double _q; // charge
-    double _gen_time; // instant of generation of the carrier
-    std::array< double,2> _x; // carrier position array
-    std::array< double,2> _e_field; // electric field at the carrier position
-    std::array< double,2> _w_field; // weighting field at the carrier positions
-    double _e_field_mod;
     int _sign; // sign to describe if carrier moves in e field direction or opposite
-		mutable std::mutex safeRead;
-
     SMSDetector * _detector;
-    double _myTemp; // Temperature of the detector
     DriftTransport _drift;
     JacoboniMobility _mu;
-    double _trapping_time;
-//		Function _electricField;
-//		Function _weightingField;
+
+    double get_w_potential(const std::array< double,2> &x) const;
+    std::array< double,2> get_w_potential_gradient(const std::array< double,2> &x, double h) const;
+
+  public:
+    CarrierSpecies();
+    CarrierSpecies(char carrier_type, SMSDetector * detector);
+
+    char get_carrier_type() const;
+
+    void simulate_drift(const CarrierRecord &carrier, double x_init, double y_init, double dt, double max_time, std::valarray<double> &curr, bool use_w_potential = false,
+        double trapping_time = std::numeric_limits<double>::max()) const;
+    void simulate_drift_sensitivity(const CarrierRecord &carrier, double x_init, double y_init, double dt, double max_time, std::valarray<double> &curr, std::vector< std::valarray<double> > &d_curr, bool use_w_potential = false,
+        double trapping_time = std::numeric_limits<double>::max()) const;
+
+    static int start_step(const CarrierRecord &carrier, double dt);
+};
+
+/*
+ **************************CARRIER************************
+ *
+ * A single carrier with its own species, for the places that simulate
+ * one carrier at a time (GUI). Collections use CarrierRecord lists.
+ *
+ */
+
+class Carrier
+{
+  private:
+    CarrierRecord _record;
+    CarrierSpecies _species;
 
   public:
-    Carrier( char carrier_type, double q, double x_init, double y_init, SMSDetector * detector, double gen_time);
-		Carrier(Carrier&& other); // Move declaration
-		Carrier& operator = (Carrier&& other); // Move assignment
-		Carrier(const Carrier& other); // Copy declaration
-		Carrier& operator = (const Carrier& other); // Copy Assignment
-		~Carrier();
+    Carrier( char carrier_type, double q, double x_init, double y_init, SMSDetector * detector, double gen_time = 1.e-9);
 
     char get_carrier_type();
-//		double get_gen_time();
-//    std::array< double,2> get_e_field;
-//    std::array< double,2> get_w_field;
-//		double get_e_field_mod;
-//    int get_sign;
-//    SMSDetector *get_detector;
-//    double get_myTemp; 
-//    DriftTransport get_drift;
-//    JacoboniMobility get_mu;
-//    double get_trapping_time;
-//
     std::array< double,2> get_x();
     double get_q();
 
-    std::valarray<double> simulate_drift( double dt, double max_time);
-    std::valarray<double> simulate_drift(double dt, double max_time, double x_init, double y_init );
+    std::valarray<double> simulate_drift( double dt, double max_time, bool use_w_potential = false);
+    std::valarray<double> simulate_drift(double dt, double max_time, double x_init, double y_init, bool use_w_potential = false);
 };
 
 #endif // CARRIER_H
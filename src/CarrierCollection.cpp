@@ -9,75 +9,75 @@
  */
 
 CarrierCollection::CarrierCollection(SMSDetector * detector) :
-	_detector(detector)
+	_detector(detector),
+	_use_w_potential(false)
 {
 
 }
 
+/*
+ * Selects how the induced current is computed for every carrier. If true the
+ * charge induced in each time bin is obtained from the weighting potential
+ * at both ends of the step (charge conserving, no weighting field needed),
+ * otherwise from q*mu*(E.Ew) at the beginning of the step.
+ */
+void CarrierCollection::set_use_w_potential(bool use_w_potential)
+{
+	_use_w_potential = use_w_potential;
+}
+
+/*
+ * Species of the carriers, built once with the detector as it is when the carriers are read
+ * (temperature), like every carrier used to build its own
+ */
+void CarrierCollection::set_species()
+{
+	_electron = CarrierSpecies('e', _detector);
+	_hole = CarrierSpecies('h', _detector);
+}
+
 /*
  * Parallel overload of the method that reads an arbitrary carrier distribution from a file
- * This bit of the code is not parallel and parallelizing it would not yield significant performance
- * improvements as it's only run once per simulation.
+ * The file (text or binary, see CarrierFile.h) is parsed in parallel into packed arrays and
+ * the carriers are stored as 32 byte records, split by type.
  *
  * The parallelization difference with the standard method is done by storing the carriers in an N-dimensional
  * array of Carriers for N threads simulaiton. This way each thread to have their own carrier list and 
- * completetly avoid race conditions.
+ * completetly avoid race conditions. N may also be larger than the number of threads (carrier chunks 
+ * run as tasks of a ThreadPool).
  */
 void CarrierCollection::add_carriers_from_file(QString filename, int nThreads) // should get N_thr=1 as input
 {
+	_carrier_list.resize(nThreads);
 
-	// get char representation and make ifstream
-	char * char_fn = filename.toLocal8Bit().data();
-	std::ifstream infile(char_fn);
-	// define temporal 1-D vector
-	std::vector<Carrier> allCarriers;
+	CarrierData carriers;
+	if (!CarrierFile::read(std::string(filename.toLocal8Bit().data()), carriers)) return;
+	set_species();
 
-	if (!infile.good()){
-		std::cout<<"Warning: File not found"<<std::endl;
-	}
-	else
+	// get #carriers, #carriers/N_thr and fill each dimension
+	int nCarriers = carriers.size();
+	int carrierPerThread = (int) std::ceil((double) nCarriers/nThreads);
+	for (int i = 0; i < nThreads; i++)
 	{
-		// process line by line
-		std::string line;
-		while (std::getline(infile, line))
+		int first = std::min(i*carrierPerThread, nCarriers);
+		int last = std::min(first + carrierPerThread, nCarriers);
+		for (int j = first; j < last; j++)
 		{
-			std::istringstream iss(line);
-			char carrier_type;
-			double q, x_init, y_init, gen_time;
-			if (!(iss >> carrier_type >> q >> x_init >> y_init >> gen_time)) 
-			{
-				break;
-			}
-
-			// read all carriers
-			Carrier carrier(carrier_type, q, x_init, y_init , _detector, gen_time);
-			allCarriers.push_back(carrier);
-			//_carrier_list_sngl.push_back(carrier); //TEST
-		}
-
-		// get #carriers, #carriers/N_thr, initialize carrier_collection
-		int nCarriers = allCarriers.size();
-		int carrierPerThread = (int) std::ceil(nCarriers/nThreads);
-		Carrier emptyCarrier('e', 0.0, -10.0, -10.0, _detector, 0);
-		int count = 0;
-		std::vector<Carrier> defaultVector (carrierPerThread, emptyCarrier);
-		_carrier_list.resize(nThreads); //TEST
-		// 2 for-loops (N_thr(#carriers/N_thr)) to fill each dimension 
-		for (int i = 0; i < nThreads; i++)
-		{
-			//_carrier_list.push_back(defaultVector);
-			for (int j = 0; j < carrierPerThread; j++) 
-			{   			
-				if (count < nCarriers) 
-				{
-					_carrier_list[i].push_back(allCarriers[count]);
-					count++;
-				}
-			}
+			CarrierRecord carrier = {carriers.x[j], carriers.y[j], carriers.q[j], carriers.gen_time[j]};
+			if (carriers.type[j] == 'e') _carrier_list[i].electrons.push_back(carrier);
+			else if (carriers.type[j] == 'h') _carrier_list[i].holes.push_back(carrier);
 		}
 	}
 }
 
+/*
+ * Chunks of carriers, whichever add_carriers_from_file method was used to read them
+ */
+const std::vector<CarrierList> &CarrierCollection::get_chunks() const
+{
+	return _carrier_list.empty() ? _carrier_list_sngl : _carrier_list;
+}
+
 /*
  * Parallelizable method for simulating the drift of a given carrier collection
  *
@@ -86,28 +86,7 @@ void CarrierCollection::add_carriers_from_file(QString filename, int nThreads) /
  */
 void CarrierCollection::simulate_drift( double dt, double max_time, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole, int thrId)
 {
-	// range for through the carriers
-	for (auto carrier : _carrier_list[thrId])
-	{
-		char carrier_type = carrier.get_carrier_type();
-		// simulate drift and add to proper valarray
-		if (carrier_type == 'e')
-		{
-			curr_elec += carrier.simulate_drift( dt , max_time);
-		}
-		else if (carrier_type =='h')
-		{ 
-			curr_hole += carrier.simulate_drift( dt , max_time);
-		}
-	}
-	double trapping_time = _detector->get_trapping_time();
-
-	for (double i = 0.; i < curr_hole.size(); i ++)
-	{
-		double elapsedT = i*dt;
-		curr_elec[i] *= exp(-elapsedT/trapping_time);
-		curr_hole[i] *= exp(-elapsedT/trapping_time);
-	}
+	simulate_drift(dt, max_time, 0., 0., curr_elec, curr_hole, thrId);
 }
 
 /*
@@ -121,39 +100,7 @@ void CarrierCollection::simulate_drift( double dt, double max_time, std::valarra
  */
 void CarrierCollection::simulate_drift( double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole, int thrId)
 {
-	// range for through the carriers
-	for (auto carrier : _carrier_list[thrId])
-	{
-		char carrier_type = carrier.get_carrier_type();
-
-		
-
-		// simulate drift and add to proper valarray
-		if (carrier_type == 'e')
-		{
-			// get and shift carrier position
-			std::array< double,2> x = carrier.get_x();
-			double x_init = x[0]+shift_x;
-			double y_init = x[1]+shift_y;
-			curr_elec += carrier.simulate_drift( dt , max_time, x_init, y_init);
-		}
-		else if (carrier_type =='h')
-		{
-			// get and shift carrier position
-			std::array< double,2> x = carrier.get_x();
-			double x_init = x[0]+shift_x;
-			double y_init = x[1]+shift_y;
-			curr_hole += carrier.simulate_drift( dt , max_time, x_init, y_init);
-		}
-	}
-	double trapping_time = _detector->get_trapping_time();
-
-	for (double i = 0.; i < curr_hole.size(); i ++)
-	{
-		double elapsedT = i*dt;
-		curr_elec[i] *= exp(-elapsedT/trapping_time);
-		curr_hole[i] *= exp(-elapsedT/trapping_time);
-	}
+	drift_carriers(_carrier_list[thrId], dt, max_time, shift_x, shift_y, curr_elec, curr_hole);
 }
 
 //TH2D CarrierCollection::get_e_dist_histogram(int n_bins_x, int n_bins_y,  TString hist_name, TString hist_title, int thrId)
@@ -188,84 +135,232 @@ void CarrierCollection::simulate_drift( double dt, double max_time, double shift
 
 void CarrierCollection::add_carriers_from_file(QString filename)
 {
-	// get char representation and make ifstream
-	char * char_fn = filename.toLocal8Bit().data();
-	std::ifstream infile(char_fn);
+	CarrierData carriers;
+	if (!CarrierFile::read(std::string(filename.toLocal8Bit().data()), carriers)) return;
+	set_species();
 
-	// process line by line
-	std::string line;
-	while (std::getline(infile, line))
+	// Chunks of _carriers_per_chunk carriers (of any type) in file order
+	int in_last = _carrier_list_sngl.empty() ? _carriers_per_chunk : _carrier_list_sngl.back().size();
+	for (size_t j = 0; j < carriers.size(); j++)
 	{
-		std::istringstream iss(line);
-		char carrier_type;
-		double q, x_init, y_init, gen_time;
-		if (!(iss >> carrier_type >> q >> x_init >> y_init >> gen_time)) { 
-			std::cout << "Error while reading file" << std::endl; 
-			break;
-		} 
-
-		Carrier carrier(carrier_type, q, x_init, y_init , _detector, gen_time);
-		_carrier_list_sngl.push_back(carrier);
+		if (carriers.type[j] != 'e' && carriers.type[j] != 'h') continue;
+		if (in_last == _carriers_per_chunk)
+		{
+			_carrier_list_sngl.push_back(CarrierList());
+			in_last = 0;
+		}
+		in_last++;
+		CarrierRecord carrier = {carriers.x[j], carriers.y[j], carriers.q[j], carriers.gen_time[j]};
+		if (carriers.type[j] == 'e') _carrier_list_sngl.back().electrons.push_back(carrier);
+		else _carrier_list_sngl.back().holes.push_back(carrier);
 	}
 }
 
 void CarrierCollection::simulate_drift( double dt, double max_time, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole)
 {
-	// range for through the carriers
-	for (auto carrier : _carrier_list_sngl)
+	simulate_drift(dt, max_time, 0., 0., curr_elec, curr_hole);
+}
+
+void CarrierCollection::simulate_drift( double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole)
+{
+	for (unsigned int c = 0; c < _carrier_list_sngl.size(); c++)
 	{
-		char carrier_type = carrier.get_carrier_type();
-		// simulate drift and add to proper valarray
-		if (carrier_type == 'e')
-		{
-			curr_elec += carrier.simulate_drift( dt , max_time);
-		}
-		else if (carrier_type =='h')
+		drift_carriers(_carrier_list_sngl[c], dt, max_time, shift_x, shift_y, curr_elec, curr_hole);
+	}
+}
+
+/*
+ * Parallel version of the method above. The chunks of carriers are drifted as tasks of the given pool 
+ * (serially if pool is NULL). Every chunk accumulates in its own buffer and the buffers are summed in 
+ * chunk order, so the result does not depend on the number of threads or on the order in which tasks 
+ * are run.
+ */
+void CarrierCollection::simulate_drift( double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole, ThreadPool * pool)
+{
+	int nChunks = _carrier_list_sngl.size();
+	std::vector< std::valarray<double> > chunk_elec(nChunks, std::valarray<double>(curr_elec.size()));
+	std::vector< std::valarray<double> > chunk_hole(nChunks, std::valarray<double>(curr_hole.size()));
+	std::atomic<int> remaining(nChunks);
+
+	for (int c = 0; c < nChunks; c++)
+	{
+		std::function<void()> task = [=, &chunk_elec, &chunk_hole, &remaining]()
 		{
-			curr_hole += carrier.simulate_drift( dt , max_time);
-		}
+			drift_carriers(_carrier_list_sngl[c], dt, max_time, shift_x, shift_y, chunk_elec[c], chunk_hole[c]);
+			remaining--;
+		};
+		if (pool) pool->submit(task);
+		else task();
 	}
-	double trapping_time = _detector->get_trapping_time();
+	if (pool) pool->wait(remaining);
 
-	for (double i = 0.; i < curr_hole.size(); i ++)
+	// deterministic reduction
+	for (int c = 0; c < nChunks; c++)
 	{
-		double elapsedT = i*dt;
-		curr_elec[i] *= exp(-elapsedT/trapping_time);
-		curr_hole[i] *= exp(-elapsedT/trapping_time);
+		curr_elec += chunk_elec[c];
+		curr_hole += chunk_hole[c];
 	}
 }
 
-void CarrierCollection::simulate_drift( double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole)
+/*
+ * Total current (electrons plus holes, with trapping) and its derivatives: one per field
+ * sensitivity of the detector (SMSDetector::solve_d_f_grad_sensitivities), followed by
+ * the derivative with respect to the trapping time (of both types of carrier). d_curr is
+ * resized to hold them.
+ * Chunks are drifted in the given pool (serially if NULL) and summed in chunk order.
+ */
+void CarrierCollection::simulate_drift_sensitivity( double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr, std::vector< std::valarray<double> > &d_curr, ThreadPool * pool)
 {
-	// range for through the carriers
-	for (auto carrier : _carrier_list_sngl)
+	const std::vector<CarrierList> *chunks = &get_chunks(); // (pointer: tasks copy their captures)
+	int nChunks = chunks->size();
+	int n_sens = _detector->get_n_sensitivities();
+	double trapping_elec = _detector->get_trapping_time('e');
+	double trapping_hole = _detector->get_trapping_time('h');
+	std::vector< std::valarray<double> > chunk_curr(nChunks, std::valarray<double>(curr.size()));
+	std::vector< std::vector< std::valarray<double> > > chunk_d_curr(nChunks, std::vector< std::valarray<double> >(n_sens + 1, std::valarray<double>(curr.size())));
+	std::atomic<int> remaining(nChunks);
+
+	for (int c = 0; c < nChunks; c++)
 	{
-		char carrier_type = carrier.get_carrier_type();
-		// simulate drift and add to proper valarray
-		if (carrier_type == 'e')
+		std::function<void()> task = [=, &chunk_curr, &chunk_d_curr, &remaining]()
 		{
-			// get and shift carrier position
-			std::array< double,2> x = carrier.get_x();
-			double x_init = x[0]+shift_x;
-			double y_init = x[1]+shift_y;
-			curr_elec += carrier.simulate_drift( dt , max_time, x_init, y_init);
-		}
-		else if (carrier_type =='h')
+			// Every type adds the derivative with respect to its own trapping time, the sum is
+			// the derivative with respect to a common one
+			const CarrierList &carriers = (*chunks)[c];
+			for (const CarrierRecord &carrier : carriers.electrons)
+			{
+				_electron.simulate_drift_sensitivity(carrier, carrier.x+shift_x, carrier.y+shift_y, dt, max_time, chunk_curr[c], chunk_d_curr[c], _use_w_potential, trapping_elec);
+			}
+			for (const CarrierRecord &carrier : carriers.holes)
+			{
+				_hole.simulate_drift_sensitivity(carrier, carrier.x+shift_x, carrier.y+shift_y, dt, max_time, chunk_curr[c], chunk_d_curr[c], _use_w_potential, trapping_hole);
+			}
+			remaining--;
+		};
+		if (pool) pool->submit(task);
+		else task();
+	}
+	if (pool) pool->wait(remaining);
+
+	// deterministic reduction
+	d_curr.assign(n_sens + 1, std::valarray<double>(curr.size()));
+	for (int c = 0; c < nChunks; c++)
+	{
+		curr += chunk_curr[c];
+		for (int k = 0; k <= n_sens; k++) d_curr[k] += chunk_d_curr[c][k];
+	}
+}
+
+/*
+ * Drifts the carriers of a list shifted by (shift_x, shift_y) and adds their currents to
+ * curr_elec/curr_hole. Trapping effects due to radiation-induced defects (traps) are applied
+ * to every carrier from its own generation, with the trapping time of its type.
+ */
+void CarrierCollection::drift_carriers(const CarrierList &carriers, double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole)
+{
+	double trapping_elec = _detector->get_trapping_time('e');
+	double trapping_hole = _detector->get_trapping_time('h');
+	for (const CarrierRecord &carrier : carriers.electrons)
+	{
+		_electron.simulate_drift(carrier, carrier.x+shift_x, carrier.y+shift_y, dt, max_time, curr_elec, _use_w_potential, trapping_elec);
+	}
+	for (const CarrierRecord &carrier : carriers.holes)
+	{
+		_hole.simulate_drift(carrier, carrier.x+shift_x, carrier.y+shift_y, dt, max_time, curr_hole, _use_w_potential, trapping_hole);
+	}
+}
+
+/*
+ * Same without trapping, adding the current of every carrier to the group of the step
+ * in which it starts to drift (see TrappingDecomposition)
+ */
+void CarrierCollection::drift_carriers(const CarrierList &carriers, double dt, double max_time, double shift_x, double shift_y, TrappingDecomposition &decomposition)
+{
+	size_t n_tSteps = (size_t) std::floor(max_time / dt);
+	for (const CarrierRecord &carrier : carriers.electrons)
+	{
+		std::valarray<double> &curr = decomposition.electrons[CarrierSpecies::start_step(carrier, dt)];
+		if (curr.size() != n_tSteps) curr.resize(n_tSteps);
+		_electron.simulate_drift(carrier, carrier.x+shift_x, carrier.y+shift_y, dt, max_time, curr, _use_w_potential);
+	}
+	for (const CarrierRecord &carrier : carriers.holes)
+	{
+		std::valarray<double> &curr = decomposition.holes[CarrierSpecies::start_step(carrier, dt)];
+		if (curr.size() != n_tSteps) curr.resize(n_tSteps);
+		_hole.simulate_drift(carrier, carrier.x+shift_x, carrier.y+shift_y, dt, max_time, curr, _use_w_potential);
+	}
+}
+
+/*
+ * Drift without trapping of the whole collection, split for the trapping times to be applied
+ * afterwards: the currents for any number of trapping times (e.g. a trapping scan) come from
+ * one drift. Chunks are drifted in the given pool (serially if NULL) and merged in chunk order.
+ */
+void CarrierCollection::simulate_drift( double dt, double max_time, double shift_x, double shift_y, TrappingDecomposition &decomposition, ThreadPool * pool)
+{
+	const std::vector<CarrierList> *chunks = &get_chunks(); // (pointer: tasks copy their captures)
+	int nChunks = chunks->size();
+	std::vector<TrappingDecomposition> chunk_decomposition(nChunks);
+	std::atomic<int> remaining(nChunks);
+
+	for (int c = 0; c < nChunks; c++)
+	{
+		std::function<void()> task = [=, &chunk_decomposition, &remaining]()
 		{
-			// get and shift carrier position
-			std::array< double,2> x = carrier.get_x();
-			double x_init = x[0]+shift_x;
-			double y_init = x[1]+shift_y;
-			curr_hole += carrier.simulate_drift( dt , max_time, x_init, y_init);
-		}
+			drift_carriers((*chunks)[c], dt, max_time, shift_x, shift_y, chunk_decomposition[c]);
+			remaining--;
+		};
+		if (pool) pool->submit(task);
+		else task();
 	}
-	double trapping_time = _detector->get_trapping_time();
+	if (pool) pool->wait(remaining);
+
+	decomposition.dt = dt;
+	for (int c = 0; c < nChunks; c++) decomposition.add(chunk_decomposition[c]);
+}
 
-	for (double i = 0.; i < curr_hole.size(); i ++)
+/*
+ * Adds the groups of another decomposition (same dt and number of steps)
+ */
+void TrappingDecomposition::add(const TrappingDecomposition &other)
+{
+	for (std::map<int, std::valarray<double> >::const_iterator it = other.electrons.begin(); it != other.electrons.end(); ++it)
 	{
-		double elapsedT = i*dt;
-		curr_elec[i] *= exp(-elapsedT/trapping_time);
-		curr_hole[i] *= exp(-elapsedT/trapping_time);
+		std::valarray<double> &curr = electrons[it->first];
+		if (curr.size() != it->second.size()) curr.resize(it->second.size());
+		curr += it->second;
+	}
+	for (std::map<int, std::valarray<double> >::const_iterator it = other.holes.begin(); it != other.holes.end(); ++it)
+	{
+		std::valarray<double> &curr = holes[it->first];
+		if (curr.size() != it->second.size()) curr.resize(it->second.size());
+		curr += it->second;
+	}
+}
+
+/*
+ * Currents with the given trapping times, added to curr_elec/curr_hole. Same result as
+ * a drift with them: every group is multiplied by exp(-age/trapping_time) from its start
+ * step, updated by one multiplication per bin.
+ */
+void TrappingDecomposition::get_current(double trapping_elec, double trapping_hole, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole) const
+{
+	apply(electrons, trapping_elec, curr_elec);
+	apply(holes, trapping_hole, curr_hole);
+}
+
+void TrappingDecomposition::apply(const std::map<int, std::valarray<double> > &groups, double trapping_time, std::valarray<double> &curr) const
+{
+	double trapping_step = exp(-dt/trapping_time);
+	for (std::map<int, std::valarray<double> >::const_iterator it = groups.begin(); it != groups.end(); ++it)
+	{
+		const std::valarray<double> &group = it->second;
+		double trapping = 1.0;
+		for (size_t i = it->first; i < group.size() && i < curr.size(); i++)
+		{
+			curr[i] += group[i]*trapping;
+			trapping *= trapping_step;
+		}
 	}
 }
 
@@ -280,15 +375,12 @@ TH2D CarrierCollection::get_e_dist_histogram(int n_bins_x, int n_bins_y,  TStrin
 	// create histogram object
 	TH2D e_dist = TH2D(hist_name, hist_title, n_bins_x , x_min, x_max, n_bins_y, y_min, y_max);
 
-	// range for through the carriers and fill the histogram
-	for (auto carrier : _carrier_list_sngl)
+	// range for through the electrons and fill the histogram
+	for (const CarrierList &chunk : _carrier_list_sngl)
 	{
-		char carrier_type = carrier.get_carrier_type();
-		if (carrier_type == 'e')
+		for (const CarrierRecord &carrier : chunk.electrons)
 		{
-			std::array< double,2> x = carrier.get_x();
-			double q = carrier.get_q();
-			e_dist.Fill(x[0], x[1], q);
+			e_dist.Fill(carrier.x, carrier.y, carrier.q);
 		}
 	}
 	return e_dist;
@@ -305,15 +397,12 @@ TH2D CarrierCollection::get_e_dist_histogram(int n_bins_x, int n_bins_y, double
 	// create histogram object
 	TH2D e_dist = TH2D(hist_name, hist_title, n_bins_x , x_min, x_max, n_bins_y, y_min, y_max);
 
-	// range for through the carriers and fill the histogram
-	for (auto carrier : _carrier_list_sngl)
+	// range for through the electrons and fill the histogram
+	for (const CarrierList &chunk : _carrier_list_sngl)
 	{
-		char carrier_type = carrier.get_carrier_type();
-		if (carrier_type == 'e')
+		for (const CarrierRecord &carrier : chunk.electrons)
 		{
-			std::array< double,2> x = carrier.get_x();
-			double q = carrier.get_q();
-			e_dist.Fill(x[0]+shift_x, x[1]+shift_y, q);
+			e_dist.Fill(carrier.x+shift_x, carrier.y+shift_y, carrier.q);
 		}
 	}
 	return e_dist;
@@ -4,6 +4,7 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <map>
 
 #include <QString>
 
@@ -11,6 +12,8 @@
 #include <TString.h>
 
 #include "Carrier.h"
+#include "ThreadPool.h"
+#include "CarrierFile.h"
 
 /*
  ***********************************CARRIER COLLECTION***********************************
@@ -22,20 +25,63 @@
  *
  */
 
+/*
+ * Carriers of a part of the file, split by type (file order is kept within each type)
+ */
+struct CarrierList
+{
+  std::vector<CarrierRecord> electrons;
+  std::vector<CarrierRecord> holes;
+
+  size_t size() const { return electrons.size() + holes.size(); }
+};
+
+/*
+ * Currents without trapping of a collection, grouped by the step in which the carriers
+ * start to drift. As trapping is exp(-age/trapping_time) for every carrier, the current
+ * for any trapping times is the sum of the groups, each one weighted from its start
+ * step: trapping scans reweight one drift instead of drifting again.
+ */
+struct TrappingDecomposition
+{
+  double dt;
+  std::map<int, std::valarray<double> > electrons; // start step -> current
+  std::map<int, std::valarray<double> > holes;
+
+  void add(const TrappingDecomposition &other);
+  void get_current(double trapping_elec, double trapping_hole, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole) const;
+
+  private:
+    void apply(const std::map<int, std::valarray<double> > &groups, double trapping_time, std::valarray<double> &curr) const;
+};
+
 class CarrierCollection
 {
   private:
-    std::vector< std::vector<Carrier> > _carrier_list;
-    std::vector<Carrier> _carrier_list_sngl;
+    std::vector<CarrierList> _carrier_list;
+    std::vector<CarrierList> _carrier_list_sngl; // chunks of _carriers_per_chunk carriers, in file order
     SMSDetector * _detector;
+    CarrierSpecies _electron; // transport shared by all the carriers of each type
+    CarrierSpecies _hole;
+    bool _use_w_potential; // induced current from weighting potential differences
+    static const int _carriers_per_chunk = 256; // work unit for parallel drift
+
+    void set_species();
+    const std::vector<CarrierList> &get_chunks() const;
+    void drift_carriers(const CarrierList &carriers, double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole);
+    void drift_carriers(const CarrierList &carriers, double dt, double max_time, double shift_x, double shift_y, TrappingDecomposition &decomposition);
 
   public:
     CarrierCollection(SMSDetector * detector);
     ~CarrierCollection();
 
+    void set_use_w_potential(bool use_w_potential);
+
     void add_carriers_from_file(QString filename, int n_thr);
     void simulate_drift( double dt, double max_time, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole, int thr_id);
     void simulate_drift( double dt, double max_time, double shift_x, double shift_y,  std::valarray<double> &curr_elec, std::valarray<double> &curr_hole, int thr_id);
+    void simulate_drift( double dt, double max_time, double shift_x, double shift_y, TrappingDecomposition &decomposition, ThreadPool * pool);
+    void simulate_drift_sensitivity( double dt, double max_time, double shift_x, double shift_y, std::valarray<double> &curr, std::vector< std::valarray<double> > &d_curr, ThreadPool * pool);
 
 //    TH2D get_e_dist_histogram(int n_bins_x, int n_bins_y, TString hist_name = "e_dist", TString hist_title ="e_dist", int thr_id);
 
@@ -46,6 +92,7 @@ class CarrierCollection
     void add_carriers_from_file(QString filename);
     void simulate_drift( double dt, double max_time, std::valarray<double> &curr_elec, std::valarray<double> &curr_hole);
     void simulate_drift( double dt, double max_time, double shift_x, double shift_y,  std::valarray<double> &curr_elec, std::valarray<double> &curr_hole);
+    void simulate_drift( double dt, double max_time, double shift_x, double shift_y,  std::valarray<double> &curr_elec, std::valarray<double> &curr_hole, ThreadPool * pool);
 
     TH2D get_e_dist_histogram(int n_bins_x, int n_bins_y, TString hist_name = "e_dist", TString hist_title ="e_dist");
     TH2D get_e_dist_histogram(int n_bins_x, int n_bins_y, double shift_x, double shift_y, TString hist_name = "e_dist", TString hist_title ="e_dist");
@@ -0,0 +1,275 @@
+#include "CarrierFile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char CARRIER_MAGIC[8] = {'T','R','A','C','S','C','A','R'};
+static const uint32_t CARRIER_VERSION = 1;
+static const size_t CARRIER_HEADER_SIZE = 24;
+
+/*
+ * Methods of the packed carrier arrays
+ */
+void CarrierData::clear()
+{
+	type.clear();
+	q.clear();
+	x.clear();
+	y.clear();
+	gen_time.clear();
+}
+
+void CarrierData::reserve(size_t n)
+{
+	type.reserve(n);
+	q.reserve(n);
+	x.reserve(n);
+	y.reserve(n);
+	gen_time.reserve(n);
+}
+
+void CarrierData::push_back(char c_type, double c_q, double c_x, double c_y, double c_gen_time)
+{
+	type.push_back(c_type);
+	q.push_back(c_q);
+	x.push_back(c_x);
+	y.push_back(c_y);
+	gen_time.push_back(c_gen_time);
+}
+
+/*
+ * Parses the lines in [begin, end) (begin at the start of a line). Returns
+ * false if it stopped at a line that could not be parsed.
+ */
+static bool parse_lines(const char *begin, const char *end, CarrierData &carriers)
+{
+	char buffer[512];
+	std::string long_line;
+	const char *p = begin;
+	while (p < end)
+	{
+		const char *eol = (const char *) std::memchr(p, '\n', end - p);
+		if (!eol) eol = end;
+
+		// Null terminated copy of the line so strtod cannot go past it
+		size_t length = eol - p;
+		const char *line = buffer;
+		if (length < sizeof(buffer))
+		{
+			std::memcpy(buffer, p, length);
+			buffer[length] = '\0';
+		}
+		else
+		{
+			long_line.assign(p, length);
+			line = long_line.c_str();
+		}
+		p = eol + 1;
+
+		// Same as iss >> type >> q >> x >> y >> gen_time
+		while (*line == ' ' || *line == '\t' || *line == '\r' || *line == '\v' || *line == '\f') line++;
+		if (*line == '\0') return false;
+		char c_type = *line++;
+		double values[4];
+		for (int i = 0; i < 4; i++)
+		{
+			char *next = NULL;
+			values[i] = std::strtod(line, &next);
+			if (next == line) return false;
+			line = next;
+		}
+		carriers.push_back(c_type, values[0], values[1], values[2], values[3]);
+	}
+	return true;
+}
+
+/*
+ * Reads a text carrier file already in memory, with n_threads threads
+ * (0: one per core)
+ */
+bool CarrierFile::read_text(const char *begin, const char *end, CarrierData &carriers, int n_threads)
+{
+	carriers.clear();
+	if (n_threads <= 0) n_threads = std::thread::hardware_concurrency();
+	if (n_threads <= 0) n_threads = 1;
+	// Not worth splitting small files
+	size_t size = end - begin;
+	if (size < (size_t) n_threads*(1 << 16)) n_threads = std::max((int) (size >> 16), 1);
+
+	// Blocks of whole lines
+	std::vector<const char *> bounds(n_threads + 1, end);
+	bounds[0] = begin;
+	for (int i = 1; i < n_threads; i++)
+	{
+		const char *p = std::max(begin + size/n_threads*i, bounds[i-1]);
+		const char *eol = (const char *) std::memchr(p, '\n', end - p);
+		bounds[i] = eol ? eol + 1 : end;
+	}
+
+	std::vector<CarrierData> blocks(n_threads);
+	std::vector<char> complete(n_threads, 1);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < n_threads; i++)
+	{
+		threads.push_back(std::thread([&, i]()
+		{
+			// About 50 bytes per line
+			blocks[i].reserve((bounds[i+1] - bounds[i])/48 + 1);
+			complete[i] = parse_lines(bounds[i], bounds[i+1], blocks[i]);
+		}));
+	}
+	for (unsigned int i = 0; i < threads.size(); i++) threads[i].join();
+
+	// Concatenate in order, up to the first line that could not be parsed
+	size_t n = 0;
+	int last = n_threads - 1;
+	for (int i = 0; i < n_threads; i++)
+	{
+		n += blocks[i].size();
+		if (!complete[i])
+		{
+			last = i;
+			break;
+		}
+	}
+	carriers.reserve(n);
+	for (int i = 0; i <= last; i++)
+	{
+		carriers.type.insert(carriers.type.end(), blocks[i].type.begin(), blocks[i].type.end());
+		carriers.q.insert(carriers.q.end(), blocks[i].q.begin(), blocks[i].q.end());
+		carriers.x.insert(carriers.x.end(), blocks[i].x.begin(), blocks[i].x.end());
+		carriers.y.insert(carriers.y.end(), blocks[i].y.begin(), blocks[i].y.end());
+		carriers.gen_time.insert(carriers.gen_time.end(), blocks[i].gen_time.begin(), blocks[i].gen_time.end());
+		blocks[i] = CarrierData(); // free as we go
+	}
+	return true;
+}
+
+/*
+ * Reads a binary carrier file already in memory
+ */
+bool CarrierFile::read_binary(const char *begin, const char *end, CarrierData &carriers)
+{
+	carriers.clear();
+	size_t size = end - begin;
+	uint32_t version = 0;
+	uint64_t n = 0;
+	if (size >= CARRIER_HEADER_SIZE)
+	{
+		std::memcpy(&version, begin + 8, sizeof(version));
+		std::memcpy(&n, begin + 16, sizeof(n));
+	}
+	uint64_t padded = (n + 7)/8*8;
+	if (size < CARRIER_HEADER_SIZE || std::memcmp(begin, CARRIER_MAGIC, sizeof(CARRIER_MAGIC)) != 0 || version != CARRIER_VERSION
+		|| n > size || size < CARRIER_HEADER_SIZE + padded + 4*n*sizeof(double))
+	{
+		std::cout << "Error while reading file: not a valid binary carrier file" << std::endl;
+		return false;
+	}
+
+	const char *p = begin + CARRIER_HEADER_SIZE;
+	carriers.type.assign(p, p + n);
+	p += padded;
+	std::vector<double> *arrays[4] = {&carriers.q, &carriers.x, &carriers.y, &carriers.gen_time};
+	for (int i = 0; i < 4; i++)
+	{
+		arrays[i]->resize(n);
+		std::memcpy(arrays[i]->data(), p, n*sizeof(double));
+		p += n*sizeof(double);
+	}
+	return true;
+}
+
+/*
+ * Reads a carrier file, text or binary
+ */
+bool CarrierFile::read(std::string filename, CarrierData &carriers, int n_threads)
+{
+	carriers.clear();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		if (fd >= 0) ::close(fd);
+		std::cout << "Warning: File not found" << std::endl;
+		return false;
+	}
+	size_t size = st.st_size;
+	if (size == 0)
+	{
+		::close(fd);
+		return true;
+	}
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+	{
+		std::cout << "File " << filename << " could not be mapped" << std::endl;
+		return false;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	const char *begin = (const char *) map;
+	bool ok;
+	if (size >= sizeof(CARRIER_MAGIC) && std::memcmp(begin, CARRIER_MAGIC, sizeof(CARRIER_MAGIC)) == 0) ok = read_binary(begin, begin + size, carriers);
+	else ok = read_text(begin, begin + size, carriers, n_threads);
+	munmap(map, size);
+	return ok;
+}
+
+/*
+ * Writes the carriers in the binary format
+ */
+bool CarrierFile::write_binary(std::string filename, const CarrierData &carriers)
+{
+	std::ofstream out(filename, std::ios_base::binary | std::ios_base::trunc);
+	if (!out.is_open())
+	{
+		std::cout << "File " << filename << " could not be created" << std::endl;
+		return false;
+	}
+	uint64_t n = carriers.size();
+	uint32_t version = CARRIER_VERSION, reserved = 0;
+	out.write(CARRIER_MAGIC, sizeof(CARRIER_MAGIC));
+	out.write((const char *) &version, sizeof(version));
+	out.write((const char *) &reserved, sizeof(reserved));
+	out.write((const char *) &n, sizeof(n));
+	out.write(carriers.type.data(), n);
+	char padding[8] = {0};
+	out.write(padding, (n + 7)/8*8 - n);
+	out.write((const char *) carriers.q.data(), n*sizeof(double));
+	out.write((const char *) carriers.x.data(), n*sizeof(double));
+	out.write((const char *) carriers.y.data(), n*sizeof(double));
+	out.write((const char *) carriers.gen_time.data(), n*sizeof(double));
+	return out.good();
+}
+
+/*
+ * Writes the carriers in the text format (values with full precision)
+ */
+bool CarrierFile::write_text(std::string filename, const CarrierData &carriers)
+{
+	std::ofstream out(filename, std::ios_base::trunc);
+	if (!out.is_open())
+	{
+		std::cout << "File " << filename << " could not be created" << std::endl;
+		return false;
+	}
+	char line[160];
+	for (size_t i = 0; i < carriers.size(); i++)
+	{
+		int n = std::snprintf(line, sizeof(line), "%c %.17g %.17g %.17g %.17g\n", carriers.type[i], carriers.q[i], carriers.x[i], carriers.y[i], carriers.gen_time[i]);
+		out.write(line, n);
+	}
+	return out.good();
+}
@@ -0,0 +1,54 @@
+#ifndef CARRIER_FILE_H
+#define CARRIER_FILE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ ***********************************CARRIER FILE***********************************
+ *
+ * Reading and writing of carrier distributions. Carriers are kept as packed
+ * arrays (one per field) instead of Carrier objects.
+ *
+ * Two formats are understood, told apart by the first bytes of the file:
+ *
+ *  - Text: one carrier per line, "type q x y gen_time" separated by blanks
+ *    (type is 'e' or 'h'). Reading stops at the first line that cannot be
+ *    parsed, as it always did. The file is mapped in memory and split in
+ *    blocks of whole lines that are parsed in parallel.
+ *
+ *  - Binary (same .carriers extension), native byte order:
+ *      char     magic[8]         "TRACSCAR"
+ *      uint32_t version          1
+ *      uint32_t reserved         0
+ *      uint64_t n                number of carriers
+ *      char     type[n]          padded with zeros to a multiple of 8
+ *      double   q[n], x[n], y[n], gen_time[n]
+ *
+ */
+
+struct CarrierData
+{
+  std::vector<char> type;
+  std::vector<double> q;
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> gen_time;
+
+  size_t size() const { return type.size(); }
+  void clear();
+  void reserve(size_t n);
+  void push_back(char c_type, double c_q, double c_x, double c_y, double c_gen_time);
+};
+
+namespace CarrierFile
+{
+  bool read(std::string filename, CarrierData &carriers, int n_threads = 0);
+  bool read_text(const char *begin, const char *end, CarrierData &carriers, int n_threads = 0);
+  bool read_binary(const char *begin, const char *end, CarrierData &carriers);
+  bool write_binary(std::string filename, const CarrierData &carriers);
+  bool write_text(std::string filename, const CarrierData &carriers);
+}
+
+#endif // CARRIER_FILE_H
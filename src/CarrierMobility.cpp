@@ -45,11 +45,23 @@ JacoboniMobility::JacoboniMobility( char carrier_type, double T)
  *
  */
 
-double JacoboniMobility::obtain_mobility(double e_field_mod)
+double JacoboniMobility::obtain_mobility(double e_field_mod) const
 {
   return _mu0/std::pow(1.0+std::pow(_mu0*e_field_mod/_vsat,_beta), 1.0/_beta); // mum**2/ Vs
 }
 
+/*
+ * Derivative of the mobility with respect to the field modulus,
+ * dmu/dE = -mu (mu0 E/vsat)^beta / (E (1 + (mu0 E/vsat)^beta))
+ */
+
+double JacoboniMobility::obtain_mobility_derivative(double e_field_mod) const
+{
+  if (e_field_mod <= 0.) return 0.;
+  double ratio = std::pow(_mu0*e_field_mod/_vsat, _beta);
+  return -obtain_mobility(e_field_mod)*ratio/(e_field_mod*(1.0 + ratio)); // mum**3/ V**2 s
+}
+
 JacoboniMobility::~JacoboniMobility()
 {
 
@@ -26,7 +26,8 @@ class JacoboniMobility
     JacoboniMobility(char carrier_type, double T);
 		JacoboniMobility();
     ~JacoboniMobility();
-    double obtain_mobility(double e_field_mod);
+    double obtain_mobility(double e_field_mod) const;
+    double obtain_mobility_derivative(double e_field_mod) const;
 };
 
 #endif // CARRIERMOBILITY_H
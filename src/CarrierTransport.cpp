@@ -1,4 +1,7 @@
 #include <CarrierTransport.h>
+#include <Profiler.h>
+
+#include <limits>
 
 DriftTransport::DriftTransport(char carrier_type, Function * d_f_grad, double givenT) :
   _mu(carrier_type, givenT)
@@ -10,14 +13,24 @@ DriftTransport::DriftTransport(char carrier_type, Function * d_f_grad, double gi
   else {
     _sign = 1;
   }
+  double inf = std::numeric_limits<double>::infinity();
+  _box = {{-inf, inf, -inf, inf}};
 }
 
-void DriftTransport::operator() ( const std::array<double,2>  &x , std::array<double,2>  &dxdt , const double /* t */ )
+DriftTransport::DriftTransport(char carrier_type, Function * d_f_grad, double givenT, const std::array<double,4> &box) :
+  DriftTransport(carrier_type, d_f_grad, givenT)
+{
+  _box = box;
+}
+
+void DriftTransport::operator() ( const std::array<double,2>  &x , std::array<double,2>  &dxdt , const double /* t */ ) const
 {
   // FIXME: avoid temporal creation overhead
   Array<double> e_field((std::size_t) 2); // temp wrap for e. field
   double e_field_mod;
   Point eval_point(x[0],x[1],0.0);
+  // RK4 stages of a carrier near the border may fall outside (extrapolated)
+  if (x[0] <= _box[0] || x[0] >= _box[1] || x[1] <= _box[2] || x[1] >= _box[3]) Profiler::add(Profiler::LOCATION_MISSES);
   (*_d_f_grad)(e_field, eval_point);
   e_field_mod = sqrt(e_field[0]*e_field[0] + e_field[1]*e_field[1]);
   dxdt[0] = _sign*_mu.obtain_mobility(e_field_mod) * e_field[0];
@@ -32,3 +45,67 @@ DriftTransport::~DriftTransport()
 DriftTransport::DriftTransport()
 {
 }
+
+DriftSensitivity::DriftSensitivity(char carrier_type, Function * d_f_grad, const std::vector<Function *> &d_f_grad_sens, double givenT, double h) :
+  _mu(carrier_type, givenT),
+  _d_f_grad(d_f_grad),
+  _d_f_grad_sens(d_f_grad_sens),
+  _sign((carrier_type == 'e') ? -1 : 1),
+  _h(h)
+{
+}
+
+void DriftSensitivity::operator() ( const std::vector<double> &s , std::vector<double> &dsdt , const double /* t */ ) const
+{
+  std::array<double,2> x = {{s[0], s[1]}};
+  double e_field[2];
+  double e_jacobian[2][2];
+  eval_jacobian(_d_f_grad, x, _h, e_field, e_jacobian);
+  double e_field_mod = sqrt(e_field[0]*e_field[0] + e_field[1]*e_field[1]);
+  double mu = _mu.obtain_mobility(e_field_mod);
+  double dmu = (e_field_mod > 0.) ? _mu.obtain_mobility_derivative(e_field_mod)/e_field_mod : 0.;
+
+  // v = sign mu(|E|) E  ->  dv/dE = sign (mu I + mu'(|E|) E E^T/|E|)
+  double dv_de[2][2] = {{_sign*(mu + dmu*e_field[0]*e_field[0]), _sign*dmu*e_field[0]*e_field[1]},
+                        {_sign*dmu*e_field[1]*e_field[0], _sign*(mu + dmu*e_field[1]*e_field[1])}};
+  dsdt.resize(s.size());
+  dsdt[0] = _sign*mu*e_field[0];
+  dsdt[1] = _sign*mu*e_field[1];
+
+  double sens[2];
+  Array<double> wrap_x(2, x.data());
+  Array<double> wrap_sens(2, sens);
+  for (unsigned int k = 0; k < _d_f_grad_sens.size(); k++)
+  {
+    // total derivative of the field seen by the carrier: moved carrier plus changed field
+    const double *dx_dp = &s[2+2*k];
+    _d_f_grad_sens[k]->eval(wrap_sens, wrap_x);
+    double de_dp[2];
+    for (int i = 0; i < 2; i++) de_dp[i] = e_jacobian[i][0]*dx_dp[0] + e_jacobian[i][1]*dx_dp[1] + sens[i];
+    for (int i = 0; i < 2; i++) dsdt[2+2*k+i] = dv_de[i][0]*de_dp[0] + dv_de[i][1]*de_dp[1];
+  }
+}
+
+/*
+ * Value of the vector function f at x and its spatial derivatives
+ * jacobian[i][j] = df_i/dx_j (central differences with step h)
+ */
+void DriftSensitivity::eval_jacobian(Function * f, const std::array<double,2> &x, double h, double value[2], double jacobian[2][2])
+{
+  std::array<double,2> point = x;
+  double plus[2], minus[2];
+  Array<double> wrap_point(2, point.data());
+  Array<double> wrap_value(2, value);
+  Array<double> wrap_plus(2, plus);
+  Array<double> wrap_minus(2, minus);
+  f->eval(wrap_value, wrap_point);
+  for (int j = 0; j < 2; j++)
+  {
+    point[j] = x[j] + h;
+    f->eval(wrap_plus, wrap_point);
+    point[j] = x[j] - h;
+    f->eval(wrap_minus, wrap_point);
+    point[j] = x[j];
+    for (int i = 0; i < 2; i++) jacobian[i][j] = (plus[i] - minus[i])/(2.*h);
+  }
+}
@@ -5,6 +5,8 @@
 #include <dolfin.h>
 
 #include <CarrierMobility.h>
+#include <array>
+#include <vector>
 
 using namespace dolfin;
 
@@ -14,14 +16,39 @@ class DriftTransport
     JacoboniMobility _mu;
     Function * _d_f_grad;
     int _sign;
+    std::array<double,4> _box; // x_min, x_max, y_min, y_max of the detector (evaluations outside are counted)
 
 
   public:
     DriftTransport(char carrier_type, Function * d_f_grad, double givenT = 253.);
+    DriftTransport(char carrier_type, Function * d_f_grad, double givenT, const std::array<double,4> &box);
 		DriftTransport();
     ~DriftTransport();
-    void operator() ( const std::array< double,2> &x , std::array< double,2> &dxdt , const double /* t */ );
+    void operator() ( const std::array< double,2> &x , std::array< double,2> &dxdt , const double /* t */ ) const;
 
 };
 
+/*
+ * Drift velocity together with its tangent-linear model. The state is the
+ * position followed by its derivatives with respect to every parameter of the
+ * given field sensitivities, s = (x, y, dx/dp_0, dy/dp_0, dx/dp_1, ...), that
+ * evolve as d(dx/dp)/dt = dv/dE (J_E dx/dp + dE/dp). The spatial derivatives
+ * J_E of the field are central differences with step h.
+ */
+class DriftSensitivity
+{
+  private:
+    JacoboniMobility _mu;
+    Function * _d_f_grad;
+    std::vector<Function *> _d_f_grad_sens;
+    int _sign;
+    double _h;
+
+  public:
+    DriftSensitivity(char carrier_type, Function * d_f_grad, const std::vector<Function *> &d_f_grad_sens, double givenT, double h);
+    void operator() ( const std::vector<double> &s , std::vector<double> &dsdt , const double /* t */ ) const;
+
+    static void eval_jacobian(Function * f, const std::array<double,2> &x, double h, double value[2], double jacobian[2][2]);
+};
+
 #endif // CARRIERTRANSPORT_H
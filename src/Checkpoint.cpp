@@ -0,0 +1,252 @@
+#include "Checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <unistd.h>
+
+static const char CHECKPOINT_MAGIC[8] = {'T','R','A','C','S','C','K','P'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+/*
+ ********************** CONSTRUCTOR OF THE CLASS CHECKPOINT **************************
+ */
+Checkpoint::Checkpoint() :
+	_n_points(0),
+	_n_samples(0),
+	_key(0),
+	_interval(60.),
+	_n_restored(0)
+{
+}
+
+/*
+ * Starts checkpointing a scan of n_points waveforms of n_samples into
+ * filename. If resume, the points already in a matching file are loaded and
+ * new ones are appended to it. Returns the number of points loaded.
+ */
+int Checkpoint::open(std::string filename, int n_points, int n_samples, uint64_t key, bool resume, double interval)
+{
+	if (_out.is_open()) _out.close();
+	_filename = filename;
+	_n_points = n_points;
+	_n_samples = n_samples;
+	_key = key;
+	_interval = interval;
+	_done.assign(n_points, 0);
+	_restored.clear();
+	_n_restored = 0;
+
+	if (resume) _n_restored = load();
+
+	if (_n_restored > 0)
+	{
+		_out.open(filename, std::ios_base::binary | std::ios_base::app);
+	}
+	else
+	{
+		_out.open(filename, std::ios_base::binary | std::ios_base::trunc);
+		_out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+		_out.write((const char *) &CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION));
+		_out.write((const char *) &_n_samples, sizeof(_n_samples));
+		_out.write((const char *) &_n_points, sizeof(_n_points));
+		_out.write((const char *) &_key, sizeof(_key));
+		_out.flush();
+	}
+	if (!_out.is_open()) std::cout << "Checkpoint file " << filename << " could not be created, running without checkpoints" << std::endl;
+	_last_flush = std::chrono::steady_clock::now();
+	return _n_restored;
+}
+
+/*
+ * Reads the points of an existing checkpoint file. The file is truncated
+ * after the last complete record so new records can be appended.
+ */
+int Checkpoint::load()
+{
+	std::ifstream in(_filename, std::ios_base::binary);
+	if (!in.is_open()) return 0;
+
+	char magic[8];
+	uint32_t version = 0, n_samples = 0;
+	uint64_t n_points = 0, key = 0;
+	in.read(magic, sizeof(magic));
+	in.read((char *) &version, sizeof(version));
+	in.read((char *) &n_samples, sizeof(n_samples));
+	in.read((char *) &n_points, sizeof(n_points));
+	in.read((char *) &key, sizeof(key));
+	if (!in || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 || version != CHECKPOINT_VERSION
+		|| n_samples != _n_samples || n_points != _n_points || key != _key)
+	{
+		std::cout << "Checkpoint " << _filename << " is from a different simulation, starting from scratch" << std::endl;
+		return 0;
+	}
+
+	_restored.assign(_n_points*_n_samples, 0.);
+	std::vector<double> samples(_n_samples);
+	std::streamoff good_end = in.tellg();
+	int n = 0;
+	while (true)
+	{
+		int64_t point;
+		in.read((char *) &point, sizeof(point));
+		in.read((char *) samples.data(), _n_samples*sizeof(double));
+		if (!in) break;
+		if (point >= 0 && (uint64_t) point < _n_points)
+		{
+			if (!_done[point]) n++;
+			_done[point] = 1;
+			std::memcpy(&_restored[(uint64_t) point*_n_samples], samples.data(), _n_samples*sizeof(double));
+		}
+		good_end = in.tellg();
+	}
+	in.close();
+
+	// Drop a record cut by the crash
+	if (truncate(_filename.c_str(), good_end) != 0) std::cout << "Checkpoint " << _filename << " could not be truncated" << std::endl;
+
+	std::cout << "Checkpoint " << _filename << ": " << n << " of " << _n_points << " points already done" << std::endl;
+	if (n == 0) _restored.clear();
+	return n;
+}
+
+/*
+ * Records that point is done, with its waveform (n_samples values)
+ */
+void Checkpoint::save(int point, const double *samples)
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	if (!_out.is_open()) return;
+	int64_t p = point;
+	_out.write((const char *) &p, sizeof(p));
+	_out.write((const char *) samples, _n_samples*sizeof(double));
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (std::chrono::duration<double>(now - _last_flush).count() >= _interval)
+	{
+		_out.flush();
+		_last_flush = now;
+	}
+}
+
+/*
+ * Writes every saved point to disk
+ */
+void Checkpoint::flush()
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	if (_out.is_open()) _out.flush();
+	_last_flush = std::chrono::steady_clock::now();
+}
+
+/*
+ * End of a successful run: the checkpoint is not needed anymore
+ */
+void Checkpoint::finish()
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	if (!_out.is_open()) return;
+	_out.close();
+	std::remove(_filename.c_str());
+}
+
+bool Checkpoint::is_open()
+{
+	return _out.is_open();
+}
+
+/*
+ * True if point was loaded from the checkpoint file
+ */
+bool Checkpoint::is_done(int point)
+{
+	return point >= 0 && (uint64_t) point < _done.size() && _done[point];
+}
+
+/*
+ * Waveform of a point loaded from the checkpoint file, NULL if there is none
+ */
+const double * Checkpoint::get_waveform(int point)
+{
+	if (!is_done(point) || _restored.empty()) return NULL;
+	return &_restored[(uint64_t) point*_n_samples];
+}
+
+int Checkpoint::get_n_restored()
+{
+	return _n_restored;
+}
+
+/*
+ * FNV-1a hash of the contents of a file (seed allows chaining several files).
+ * Used as the key of checkpoints and cached results.
+ */
+uint64_t Checkpoint::hash_file(std::string filename, uint64_t seed)
+{
+	uint64_t hash = seed;
+	std::ifstream in(filename, std::ios_base::binary);
+	std::vector<char> buffer(1 << 16);
+	while (in)
+	{
+		in.read(buffer.data(), buffer.size());
+		std::streamsize n = in.gcount();
+		for (std::streamsize i = 0; i < n; i++)
+		{
+			hash ^= (unsigned char) buffer[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+/*
+ * FNV-1a hash of the "Key = value" lines of a configuration file (same
+ * parsing as utilities::get_config_value), leaving out the ignored keys.
+ * Comments and formatting do not change it.
+ */
+uint64_t Checkpoint::hash_config(std::string config_filename, const std::set<std::string> &ignored, uint64_t seed)
+{
+	uint64_t hash = seed;
+	std::ifstream configFile(config_filename, std::ios_base::in);
+	std::string line, id, eq, val;
+	while (std::getline(configFile, line))
+	{
+		char start = line[0];
+		if (start == '#' || start == '\0' || start == '\t') continue;  // skip comments
+		std::istringstream isstream(line);
+		if (!(isstream >> id >> eq >> val) || eq != "=" || ignored.count(id)) continue;
+		std::string entry = id + "=" + val + "\n";
+		for (size_t i = 0; i < entry.size(); i++)
+		{
+			hash ^= (unsigned char) entry[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+/*
+ * Key of the checkpoint of a scan: the configuration values that change the
+ * waveforms or the numbering of the points (the scan range is kept) and the
+ * contents of the carrier file. Output, checkpointing, progress and thread
+ * settings can be changed before --resume.
+ */
+uint64_t Checkpoint::inputs_key(std::string config_filename, std::string carriers_file)
+{
+	static const std::set<std::string> ignored = {
+		"OutputFormat", "RootCompression", "CheckpointInterval", "ProgressInterval", "ResultCache",
+		"NumberOfThreads", "CarrierThreads"};
+	return hash_file(carriers_file, hash_config(config_filename, ignored));
+}
+
+/*
+ ********************** DESTRUCTOR OF THE CLASS CHECKPOINT **************************
+ */
+Checkpoint::~Checkpoint()
+{
+	// Not finished: keep the file for a later resume
+	std::lock_guard<std::mutex> lock(_mtx);
+	if (_out.is_open()) _out.close();
+}
@@ -0,0 +1,71 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+
+/*
+ **********************************CHECKPOINT**********************************
+ *
+ * Checkpoint of a long scan: every finished point (e.g. one (V, y, z)) is
+ * appended to a file together with its waveform, and the file is flushed to
+ * disk every `interval` seconds. If the run dies, at most the points of the
+ * last interval are lost.
+ *
+ * When resuming, the points found in the file are loaded back (is_done(),
+ * get_waveform()) and only the rest have to be simulated. The file carries a
+ * key (hash of the inputs, see inputs_key()): a checkpoint of a different
+ * configuration or scan size is ignored and overwritten. A record cut by the
+ * crash at the end of the file is dropped.
+ *
+ * save() can be called from several threads at the same time.
+ *
+ * File layout (native byte order): "TRACSCKP", uint32 version, uint32
+ * n_samples, uint64 n_points, uint64 key, then records of int64 point
+ * followed by n_samples doubles.
+ *
+ */
+
+class Checkpoint
+{
+  private:
+    std::string _filename;
+    uint64_t _n_points;
+    uint32_t _n_samples;
+    uint64_t _key;
+    double _interval;   // seconds between flushes
+    std::vector<char> _done;
+    std::vector<double> _restored; // waveforms of the points loaded on resume
+    int _n_restored;
+
+    std::ofstream _out;
+    std::mutex _mtx;
+    std::chrono::steady_clock::time_point _last_flush;
+
+    int load();
+
+  public:
+    Checkpoint();
+    ~Checkpoint();
+
+    int open(std::string filename, int n_points, int n_samples, uint64_t key, bool resume, double interval = 60.);
+    void save(int point, const double *samples);
+    void flush();
+    void finish();
+    bool is_open();
+
+    bool is_done(int point);
+    const double * get_waveform(int point);
+    int get_n_restored();
+
+    static uint64_t hash_file(std::string filename, uint64_t seed = 14695981039346656037ULL);
+    static uint64_t hash_config(std::string config_filename, const std::set<std::string> &ignored, uint64_t seed = 14695981039346656037ULL);
+    static uint64_t inputs_key(std::string config_filename, std::string carriers_file);
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,227 @@
+#include "ElectronicsChain.h"
+
+#include <cstdlib>
+#include <cmath>
+#include <sstream>
+#include <iostream>
+
+/*
+ * Returns the parameter of every waveform: values broadcast if there is only
+ * one
+ */
+static std::vector<double> per_waveform(const std::vector<double> &values, int n_wave)
+{
+	if ((int) values.size() == n_wave) return values;
+	if (values.size() != 1) std::cout << "Electronics: " << values.size() << " stage parameters for " << n_wave << " waveforms, using the first one for all" << std::endl;
+	return std::vector<double>(n_wave, values.empty() ? 0.0 : values[0]);
+}
+
+/*
+ * Constructor: builds the chain from a description like "CRRC:1e-9:2,GAIN:10"
+ * (see ElectronicsChain.h). Unknown stages are reported and skipped.
+ */
+ElectronicsChain::ElectronicsChain(std::string description)
+{
+	if (description == "None" || description.empty()) return;
+
+	std::istringstream stages(description);
+	std::string stage;
+	while (std::getline(stages, stage, ','))
+	{
+		std::vector<std::string> fields;
+		std::istringstream fstream(stage);
+		std::string field;
+		while (std::getline(fstream, field, ':')) fields.push_back(field);
+		if (fields.empty()) continue;
+
+		// Numeric parameters of the stage
+		std::vector<double> par;
+		bool ok = true;
+		for (unsigned int i = 1; i < fields.size(); i++)
+		{
+			char *end = NULL;
+			par.push_back(std::strtod(fields[i].c_str(), &end));
+			if (end == fields[i].c_str() || *end != '\0') ok = false;
+		}
+
+		if (ok && fields[0] == "GAIN" && par.size() == 1) add_gain(par[0]);
+		else if (ok && fields[0] == "RC" && par.size() == 1) add_rc(par[0]);
+		else if (ok && fields[0] == "CRRC" && par.size() == 2) add_crrc(par[0], (int) par[1]);
+		else if (ok && fields[0] == "TF" && par.empty()) add_transfer_function();
+		else std::cout << "Electronics: stage " << stage << " not understood, skipped" << std::endl;
+	}
+}
+
+/*
+ * Methods to append stages. Vector versions take one parameter per waveform
+ * of the batches given to process()
+ */
+void ElectronicsChain::add_gain(double gain)
+{
+	add_gain(std::vector<double>(1, gain));
+}
+
+void ElectronicsChain::add_gain(std::vector<double> gain)
+{
+	Stage stage = {GAIN, gain, 0, NULL};
+	_stages.push_back(stage);
+}
+
+void ElectronicsChain::add_rc(double tau)
+{
+	add_rc(std::vector<double>(1, tau));
+}
+
+void ElectronicsChain::add_rc(std::vector<double> tau)
+{
+	Stage stage = {RC, tau, 0, NULL};
+	_stages.push_back(stage);
+}
+
+void ElectronicsChain::add_crrc(double tau, int n)
+{
+	add_crrc(std::vector<double>(1, tau), n);
+}
+
+void ElectronicsChain::add_crrc(std::vector<double> tau, int n)
+{
+	Stage stage = {CRRC, tau, n, NULL};
+	_stages.push_back(stage);
+}
+
+void ElectronicsChain::add_transfer_function(TransferFunction *tf)
+{
+	Stage stage = {TF, std::vector<double>(), 0, tf};
+	_stages.push_back(stage);
+}
+
+/*
+ * True if the chain has no stages
+ */
+bool ElectronicsChain::is_empty()
+{
+	return _stages.empty();
+}
+
+/*
+ * Shapes (in place) a batch of waveforms sampled every dt. All of them must
+ * have the same number of samples.
+ */
+void ElectronicsChain::process(std::vector< std::valarray<double> > &waveforms, double dt)
+{
+	int n_wave = waveforms.size();
+	if (n_wave == 0 || _stages.empty()) return;
+	int n = waveforms[0].size();
+
+	// Interleave: buf[j*n_wave + w] is sample j of waveform w
+	std::vector<double> buf((size_t) n*n_wave);
+	for (int w = 0; w < n_wave; w++)
+	{
+		for (int j = 0; j < n; j++) buf[(size_t) j*n_wave + w] = waveforms[w][j];
+	}
+
+	for (unsigned int s = 0; s < _stages.size(); s++)
+	{
+		Stage &stage = _stages[s];
+		switch (stage.type)
+		{
+			case GAIN:
+				apply_gain(buf, n_wave, per_waveform(stage.values, n_wave));
+				break;
+			case RC:
+				apply_rc(buf, n_wave, per_waveform(stage.values, n_wave), dt);
+				break;
+			case CRRC:
+				apply_cr(buf, n_wave, per_waveform(stage.values, n_wave), dt);
+				for (int i = 0; i < stage.order; i++) apply_rc(buf, n_wave, per_waveform(stage.values, n_wave), dt);
+				break;
+			case TF:
+				apply_tf(buf, n_wave, stage.tf, dt);
+				break;
+		}
+	}
+
+	for (int w = 0; w < n_wave; w++)
+	{
+		for (int j = 0; j < n; j++) waveforms[w][j] = buf[(size_t) j*n_wave + w];
+	}
+}
+
+/*
+ * Multiplies every waveform by its gain
+ */
+void ElectronicsChain::apply_gain(std::vector<double> &buf, int n_wave, const std::vector<double> &gain)
+{
+	const double *g = gain.data();
+	for (size_t j = 0; j < buf.size(); j += n_wave)
+	{
+		double *x = &buf[j];
+		for (int w = 0; w < n_wave; w++) x[w] *= g[w];
+	}
+}
+
+/*
+ * Low pass RC filter, y[j] = y[j-1] + dt/(tau+dt)*(x[j]-y[j-1]) with y[-1] = 0
+ */
+void ElectronicsChain::apply_rc(std::vector<double> &buf, int n_wave, const std::vector<double> &tau, double dt)
+{
+	std::vector<double> alfa(n_wave), y(n_wave, 0.);
+	for (int w = 0; w < n_wave; w++) alfa[w] = dt/(tau[w]+dt);
+	const double *a = alfa.data();
+	double *yw = y.data();
+	for (size_t j = 0; j < buf.size(); j += n_wave)
+	{
+		double *x = &buf[j];
+		for (int w = 0; w < n_wave; w++)
+		{
+			yw[w] += a[w]*(x[w]-yw[w]);
+			x[w] = yw[w];
+		}
+	}
+}
+
+/*
+ * High pass CR filter, y[j] = tau/(tau+dt)*(y[j-1] + x[j] - x[j-1]) with
+ * x[-1] = y[-1] = 0
+ */
+void ElectronicsChain::apply_cr(std::vector<double> &buf, int n_wave, const std::vector<double> &tau, double dt)
+{
+	std::vector<double> beta(n_wave), y(n_wave, 0.), x_prev(n_wave, 0.);
+	for (int w = 0; w < n_wave; w++) beta[w] = tau[w]/(tau[w]+dt);
+	const double *b = beta.data();
+	double *yw = y.data();
+	double *xp = x_prev.data();
+	for (size_t j = 0; j < buf.size(); j += n_wave)
+	{
+		double *x = &buf[j];
+		for (int w = 0; w < n_wave; w++)
+		{
+			double xi = x[w];
+			yw[w] = b[w]*(yw[w] + xi - xp[w]);
+			xp[w] = xi;
+			x[w] = yw[w];
+		}
+	}
+}
+
+/*
+ * Convolution with the transfer function, one waveform at a time (FFT). The
+ * output is shifted by the start time of the transfer function so that it
+ * keeps the time axis of the input.
+ */
+void ElectronicsChain::apply_tf(std::vector<double> &buf, int n_wave, TransferFunction *tf, double dt)
+{
+	int n = buf.size()/n_wave;
+	int shift = (int) std::lround(-tf->get_start()/dt);
+	std::vector<double> in(n), out(2*n);
+	for (int w = 0; w < n_wave; w++)
+	{
+		for (int j = 0; j < n; j++) in[j] = buf[(size_t) j*n_wave + w];
+		tf->convolve(in.data(), n, dt, out.data());
+		for (int j = 0; j < n; j++)
+		{
+			int k = j + shift;
+			buf[(size_t) j*n_wave + w] = (k >= 0 && k < 2*n) ? out[k] : 0.;
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef ELECTRONICSCHAIN_H
+#define ELECTRONICSCHAIN_H
+
+#include <string>
+#include <vector>
+#include <valarray>
+
+#include "TransferFunction.h"
+
+/*
+ *******************************ELECTRONICS CHAIN*******************************
+ *
+ * Front-end electronics as a chain of stages applied in order:
+ *
+ *  - GAIN:g       multiply by g
+ *  - RC:tau       low pass filter (integrator), tau = R*C in seconds
+ *  - CRRC:tau:n   high pass (CR) followed by n low pass (RC) filters, all
+ *                 with time constant tau
+ *  - TF           convolution with the tabulated amplifier transfer function
+ *                 (time aligned: output has the same length and time axis as
+ *                 the input)
+ *
+ * A chain is built with the add_ methods or from a description string with
+ * the stages separated by commas, e.g. "TF" or "CRRC:1e-9:2,GAIN:10" (used
+ * for the Electronics key of Config.TRACS). "None" gives an empty chain.
+ *
+ * process() shapes a whole batch of waveforms of the same length at once.
+ * The batch is stored interleaved (all waveforms at time j, then time j+1...)
+ * so the filters run along time with the waveforms in the inner loop, which
+ * the compiler vectorizes. Stage parameters may be given per waveform
+ * (e.g. several capacitances applied to copies of one current), then one pass
+ * computes all the variants.
+ *
+ */
+
+class ElectronicsChain
+{
+  private:
+    enum StageType { GAIN, RC, CRRC, TF };
+
+    struct Stage
+    {
+      StageType type;
+      std::vector<double> values; // gain or time constant, one or one per waveform
+      int order;                  // number of RC integrators of a CR-RC^n stage
+      TransferFunction *tf;
+    };
+
+    std::vector<Stage> _stages;
+
+    void apply_gain(std::vector<double> &buf, int n_wave, const std::vector<double> &gain);
+    void apply_rc(std::vector<double> &buf, int n_wave, const std::vector<double> &tau, double dt);
+    void apply_cr(std::vector<double> &buf, int n_wave, const std::vector<double> &tau, double dt);
+    void apply_tf(std::vector<double> &buf, int n_wave, TransferFunction *tf, double dt);
+
+  public:
+    ElectronicsChain(std::string description = "None");
+
+    void add_gain(double gain);
+    void add_gain(std::vector<double> gain);
+    void add_rc(double tau);
+    void add_rc(std::vector<double> tau);
+    void add_crrc(double tau, int n);
+    void add_crrc(std::vector<double> tau, int n);
+    void add_transfer_function(TransferFunction *tf = TransferFunction::get_default());
+
+    void process(std::vector< std::valarray<double> > &waveforms, double dt);
+    bool is_empty();
+};
+
+#endif // ELECTRONICSCHAIN_H
@@ -2,16 +2,24 @@
 //#include <iostream>
  #include <thread>
 #include <mutex>          // std::mutex
+#include <condition_variable>
 #include "global.h"
+#include "Profiler.h"
 
 //using namespace std;
 //num_threads = 2;
 //extern const int num_threads = 2;
 std::mutex mtx, mtx_nt;           // mutex for critical sections
+std::mutex mtx_ready;             // threads that finished their setup
+std::condition_variable cv_ready;
+int n_ready = 0;
 std::string fnm="Config.TRACS";
 //num_threads = 8;//std::thread::hardware_concurrency();
 int init_num_threads; // initial number of threads, which might change dynamically
+bool resume = false; // --resume: continue the scan from its checkpoint
+bool quiet = false; // --quiet: no progress lines
 void call_from_thread(int tid);
+void call_from_thread_shared(int tid);
 std::vector<TRACSInterface*> TRACSsim(num_threads);
 std::vector<std::thread> t(num_threads);
 //std::vector<TRACSInterface*> TRACSsim;
@@ -43,12 +51,23 @@ void resize_TI(size_t newSize)
 int main(int argc, char* argv[])
 {
 	std::cout << "Number of cores = " << std::thread::hardware_concurrency() <<std::endl;
-	if(argc<2)
+	// Arguments in any order: number of threads (first number), shared, --resume, --quiet
+	num_threads = std::thread::hardware_concurrency(); // No. of threads = No. of cores
+	bool shared = false;
+	bool threads_given = false;
+	for (int a = 1; a < argc; a++)
 	{
-		num_threads = std::thread::hardware_concurrency(); // No. of threads = No. of cores
+		std::string arg = argv[a];
+		if (arg == "--resume") resume = true;
+		else if (arg == "--quiet") quiet = true;
+		else if (arg == "shared") shared = true;
+		else if (!threads_given && !arg.empty() && arg.find_first_not_of("0123456789") == std::string::npos)
+		{
+			num_threads = atoi(arg.c_str());
+			threads_given = true;
+		}
+		else std::cout << "Unknown argument " << arg << " (use [N] [shared] [--resume] [--quiet])" << std::endl;
 	}
-	else
-		num_threads = atoi(argv[1]);
 	//num_threads = 100;
 	//num_threads = nthreads;
 	if(num_threads == 0){
@@ -57,6 +76,39 @@ int main(int argc, char* argv[])
 	}
 	init_num_threads = num_threads;
 	TRACSsim.resize(num_threads);
+
+	// "shared" mode: a single detector, field set and carrier collection is 
+	// built and solved once and used read-only by all the threads. Each thread 
+	// only keeps its own scan state and currents.
+	if (shared)
+	{
+		TRACSsim[0] = new TRACSInterface(fnm); // may reduce num_threads
+		TRACSsim[0]->set_tcount(0);
+		TRACSsim.resize(num_threads);
+		for (int i = 1; i < num_threads; ++i)
+		{
+			TRACSsim[i] = new TRACSInterface(fnm, TRACSsim[0]);
+			TRACSsim[i]->set_tcount(i);
+		}
+		TRACSsim[0]->resize_array();
+		TRACSsim[0]->write_header(0);
+		TRACSsim[0]->open_checkpoint(fnm, resume);
+		TRACSsim[0]->start_progress(fnm, quiet);
+
+		t.resize(num_threads);
+		for (int i = 0; i < num_threads; ++i) {
+			t[i] = std::thread(call_from_thread_shared, i);
+		}
+		for (int i = 0; i < num_threads; ++i) {
+			t[i].join();
+		}
+		progress.finish();
+		TRACSsim[0]->write_to_file(0);
+		checkpoint.finish();
+		Profiler::print_summary();
+		Profiler::write_json("interface_test_profile.json");
+		return 0;
+	}
 	//TRACSInterface *tp = NULL; // pointer
 	//load up a vector
 	//for (auto i = 0; i < num_threads; i++) {
@@ -116,7 +168,11 @@ int main(int argc, char* argv[])
              t[i].join();
          }
     //write output to single file!
+    progress.finish();
     TRACSsim[0]->write_to_file(0);
+    checkpoint.finish();
+    Profiler::print_summary();
+    Profiler::write_json("interface_test_profile.json");
 
     //getter test
     std::vector<double> neff_test = TRACSsim[0]->get_NeffParam();
@@ -165,10 +221,9 @@ int main(int argc, char* argv[])
 	      	TRACSsim[tid]->set_tcount(tid);
 	      	if(tid==0)
 	      	{
-	      		i_ramo_array.clear();
-				//i_conv_array.clear();
 	      		TRACSsim[tid]->resize_array();
 	      		TRACSsim[tid]->write_header(tid);
+	      		TRACSsim[tid]->open_checkpoint(fnm, resume);
 	      		TRACSsim.resize(num_threads);
 	      		//t.resize(num_threads);
 	      		mtx_nt.unlock();
@@ -176,6 +231,16 @@ int main(int argc, char* argv[])
 	       	//TRACSsim[tid]->write_header(tid);
 		    std::cout << "Made it t" << tid << std::endl;
 		    mtx.unlock();
+		    // Progress starts (and counts from 0) once every thread is ready to loop
+		    {
+		    	std::unique_lock<std::mutex> lock(mtx_ready);
+		    	if (++n_ready == num_threads)
+		    	{
+		    		TRACSsim[0]->start_progress(fnm, quiet);
+		    		cv_ready.notify_all();
+		    	}
+		    	else cv_ready.wait(lock, []{ return n_ready >= num_threads; });
+		    }
 		    TRACSsim[tid]->loop_on(tid);
 		    /*
 		      	 if(tid==0){
@@ -206,3 +271,9 @@ int main(int argc, char* argv[])
 	    }
       	 }
 
+//This function will be called from a thread (shared fields mode)
+//Interfaces are already built, only the scan is run here
+
+      void call_from_thread_shared(int tid) {
+	      	TRACSsim[tid]->loop_on(tid);
+      	 }
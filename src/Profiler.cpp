@@ -0,0 +1,245 @@
+#include "Profiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <time.h>
+#include <sys/resource.h>
+
+std::mutex Profiler::_mtx;
+std::vector< std::unique_ptr<Profiler::ThreadRecord> > Profiler::_threads;
+
+// Start of the run (first use of the profiler)
+static const std::chrono::steady_clock::time_point profiler_start = std::chrono::steady_clock::now();
+
+/*
+ * Record of the calling thread, created on first use
+ */
+Profiler::ThreadRecord * Profiler::get_thread_record()
+{
+	thread_local ThreadRecord *record = NULL;
+	if (record) return record;
+
+	std::lock_guard<std::mutex> lock(_mtx);
+	_threads.push_back(std::unique_ptr<ThreadRecord>(new ThreadRecord));
+	record = _threads.back().get();
+	record->name = (_threads.size() == 1) ? "main" : "thread" + std::to_string(_threads.size() - 1);
+	for (int i = 0; i < N_PHASES; i++)
+	{
+		record->wall[i] = record->cpu[i] = 0.;
+		record->calls[i] = 0;
+	}
+	for (int i = 0; i < N_COUNTERS; i++) record->counters[i] = 0;
+	return record;
+}
+
+Profiler::Scope::Scope(Phase phase) :
+	_phase(phase),
+	_wall0(wall_time()),
+	_cpu0(thread_cpu_time())
+{
+}
+
+Profiler::Scope::~Scope()
+{
+	ThreadRecord *record = get_thread_record();
+	record->wall[_phase] += wall_time() - _wall0;
+	record->cpu[_phase] += thread_cpu_time() - _cpu0;
+	record->calls[_phase]++;
+}
+
+/*
+ * Adds n to a counter of the calling thread
+ */
+void Profiler::add(Counter counter, uint64_t n)
+{
+	get_thread_record()->counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+/*
+ * Name of the calling thread in the reports (e.g. "writer", "pool3")
+ */
+void Profiler::set_thread_name(std::string name)
+{
+	ThreadRecord *record = get_thread_record();
+	std::lock_guard<std::mutex> lock(_mtx);
+	record->name = name;
+}
+
+/*
+ * Seconds since the start of the run
+ */
+double Profiler::wall_time()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - profiler_start).count();
+}
+
+/*
+ * CPU seconds used by the calling thread
+ */
+double Profiler::thread_cpu_time()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0.;
+	return ts.tv_sec + 1.e-9*ts.tv_nsec;
+}
+
+/*
+ * CPU seconds used by the whole process
+ */
+double Profiler::process_cpu_time()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return 0.;
+	return ts.tv_sec + 1.e-9*ts.tv_nsec;
+}
+
+/*
+ * Peak resident memory of the process in kB
+ */
+long Profiler::peak_memory_kb()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return usage.ru_maxrss;
+}
+
+/*
+ * Records merged by thread name, in order of creation. The last entry is the
+ * sum of all threads. Called with _mtx locked
+ */
+std::vector<Profiler::Totals> Profiler::get_totals()
+{
+	std::vector<Totals> totals;
+	Totals zero;
+	for (int p = 0; p < N_PHASES; p++)
+	{
+		zero.wall[p] = zero.cpu[p] = 0.;
+		zero.calls[p] = 0;
+	}
+	for (int c = 0; c < N_COUNTERS; c++) zero.counters[c] = 0;
+	Totals all = zero;
+	all.name = "all";
+
+	for (unsigned int t = 0; t < _threads.size(); t++)
+	{
+		const ThreadRecord &record = *_threads[t];
+		unsigned int i = 0;
+		while (i < totals.size() && totals[i].name != record.name) i++;
+		if (i == totals.size())
+		{
+			Totals entry = zero;
+			entry.name = record.name;
+			totals.push_back(entry);
+		}
+		for (int p = 0; p < N_PHASES; p++)
+		{
+			totals[i].wall[p] += record.wall[p];
+			totals[i].cpu[p] += record.cpu[p];
+			totals[i].calls[p] += record.calls[p];
+			all.wall[p] += record.wall[p];
+			all.cpu[p] += record.cpu[p];
+			all.calls[p] += record.calls[p];
+		}
+		for (int c = 0; c < N_COUNTERS; c++)
+		{
+			totals[i].counters[c] += record.counters[c];
+			all.counters[c] += record.counters[c];
+		}
+	}
+	totals.push_back(all);
+	return totals;
+}
+
+const char * Profiler::phase_name(int phase)
+{
+	static const char *names[N_PHASES] = {"field_solve", "carrier_read", "drift", "convolution", "shaping", "write"};
+	return names[phase];
+}
+
+const char * Profiler::counter_name(int counter)
+{
+	static const char *names[N_COUNTERS] = {"field_evaluations", "location_misses", "carriers_exited", "carriers_timed_out"};
+	return names[counter];
+}
+
+/*
+ * Table of the time per phase (all threads and per thread) and the counters
+ */
+void Profiler::print_summary(std::ostream &out)
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	std::vector<Totals> totals = get_totals();
+	const Totals &all = totals.back();
+	char line[256];
+	out << "=============================== PROFILE ===============================" << std::endl;
+	std::snprintf(line, sizeof(line), "Run: %.3f s wall, %.3f s CPU, peak memory %.1f MB", wall_time(), process_cpu_time(), peak_memory_kb()/1024.);
+	out << line << std::endl;
+
+	std::snprintf(line, sizeof(line), "%-14s %12s %12s %10s", "phase", "wall [s]", "cpu [s]", "calls");
+	out << line << std::endl;
+	for (int p = 0; p < N_PHASES; p++)
+	{
+		if (all.calls[p] == 0) continue;
+		std::snprintf(line, sizeof(line), "%-14s %12.3f %12.3f %10llu", phase_name(p), all.wall[p], all.cpu[p], (unsigned long long) all.calls[p]);
+		out << line << std::endl;
+	}
+
+	out << "Per thread (wall [s] of every phase):" << std::endl;
+	for (unsigned int t = 0; t + 1 < totals.size(); t++)
+	{
+		std::ostringstream row;
+		std::snprintf(line, sizeof(line), "%-14s", totals[t].name.c_str());
+		row << line;
+		for (int p = 0; p < N_PHASES; p++)
+		{
+			if (totals[t].calls[p] == 0) continue;
+			std::snprintf(line, sizeof(line), " %s %.3f", phase_name(p), totals[t].wall[p]);
+			row << line;
+		}
+		out << row.str() << std::endl;
+	}
+
+	for (int c = 0; c < N_COUNTERS; c++)
+	{
+		std::snprintf(line, sizeof(line), "%-20s %llu", counter_name(c), (unsigned long long) all.counters[c]);
+		out << line << std::endl;
+	}
+	out << "=======================================================================" << std::endl;
+}
+
+/*
+ * Same information as print_summary() in JSON
+ */
+bool Profiler::write_json(std::string filename)
+{
+	std::ofstream out(filename, std::ios_base::trunc);
+	if (!out.is_open())
+	{
+		std::cout << "File " << filename << " could not be created" << std::endl;
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(_mtx);
+	std::vector<Totals> totals = get_totals();
+	out << "{\n";
+	out << "  \"wall_seconds\": " << wall_time() << ",\n";
+	out << "  \"cpu_seconds\": " << process_cpu_time() << ",\n";
+	out << "  \"peak_memory_kb\": " << peak_memory_kb() << ",\n";
+	out << "  \"threads\": [\n";
+	for (unsigned int t = 0; t < totals.size(); t++)
+	{
+		const Totals &entry = totals[t];
+		out << "    {\"name\": \"" << entry.name << "\", \"phases\": {";
+		for (int p = 0; p < N_PHASES; p++)
+		{
+			out << (p ? ", " : "") << "\"" << phase_name(p) << "\": {\"wall\": " << entry.wall[p] << ", \"cpu\": " << entry.cpu[p] << ", \"calls\": " << entry.calls[p] << "}";
+		}
+		out << "}, \"counters\": {";
+		for (int c = 0; c < N_COUNTERS; c++) out << (c ? ", " : "") << "\"" << counter_name(c) << "\": " << entry.counters[c];
+		out << "}}" << (t + 1 < totals.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	return out.good();
+}
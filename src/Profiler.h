@@ -0,0 +1,89 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <stdint.h>
+
+/*
+ ***********************************PROFILER***********************************
+ *
+ * Always-on instrumentation of a run. Code regions are attributed to a phase
+ * with a Profiler::Scope object; the wall and CPU time of every scope is
+ * added to the phase, separately for every thread. Scopes are meant for
+ * coarse regions (a task, a solve, a point), not for single carriers.
+ * Nested scopes are counted in both phases.
+ *
+ * Counters (field evaluations, evaluations outside the detector, carriers
+ * that left the detector or were still inside at the end of the time
+ * window) are also kept per thread, so adding to them does not contend.
+ *
+ * print_summary() and write_json() report everything, plus the peak memory
+ * of the process. They are meant to be called at the end of the run, once
+ * the workers are idle.
+ *
+ */
+
+class Profiler
+{
+  public:
+    enum Phase { FIELD_SOLVE, CARRIER_READ, DRIFT, CONVOLUTION, SHAPING, WRITE, N_PHASES };
+    enum Counter { FIELD_EVALS, LOCATION_MISSES, CARRIERS_EXITED, CARRIERS_TIMED_OUT, N_COUNTERS };
+
+    class Scope
+    {
+      private:
+        Phase _phase;
+        double _wall0;
+        double _cpu0;
+
+      public:
+        Scope(Phase phase);
+        ~Scope();
+    };
+
+    static void add(Counter counter, uint64_t n = 1);
+    static void set_thread_name(std::string name);
+
+    static void print_summary(std::ostream &out = std::cout);
+    static bool write_json(std::string filename);
+
+    static double wall_time();
+    static double thread_cpu_time();
+    static double process_cpu_time();
+    static long peak_memory_kb();
+
+  private:
+    struct ThreadRecord
+    {
+      std::string name;
+      double wall[N_PHASES];
+      double cpu[N_PHASES];
+      uint64_t calls[N_PHASES];
+      std::atomic<uint64_t> counters[N_COUNTERS];
+    };
+
+    // Totals of the threads with the same name (e.g. one solver thread per voltage)
+    struct Totals
+    {
+      std::string name;
+      double wall[N_PHASES];
+      double cpu[N_PHASES];
+      uint64_t calls[N_PHASES];
+      uint64_t counters[N_COUNTERS];
+    };
+
+    static std::mutex _mtx;
+    static std::vector< std::unique_ptr<ThreadRecord> > _threads;
+
+    static ThreadRecord * get_thread_record();
+    static std::vector<Totals> get_totals();
+    static const char * phase_name(int phase);
+    static const char * counter_name(int counter);
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,121 @@
+#include "Progress.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+static double now_seconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Progress::Progress() :
+	_done(0),
+	_skipped(0),
+	_total(0),
+	_interval(0.),
+	_t0(0.),
+	_stop(false)
+{
+}
+
+Progress::~Progress()
+{
+	// finish() was not called (e.g. error exit): stop silently
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+		_stop = true;
+	}
+	_cv.notify_all();
+	if (_reporter.joinable()) _reporter.join();
+}
+
+/*
+ * Starts counting total points. Lines are printed every interval seconds,
+ * interval <= 0 prints nothing
+ */
+void Progress::start(uint64_t total, double interval, std::string unit)
+{
+	finish();
+	_done = 0;
+	_skipped = 0;
+	_total = total;
+	_interval = interval;
+	_unit = unit;
+	_t0 = now_seconds();
+	_stop = false;
+	if (_interval > 0) _reporter = std::thread(&Progress::report_loop, this);
+}
+
+void Progress::add(uint64_t n)
+{
+	_done.fetch_add(n, std::memory_order_relaxed);
+}
+
+void Progress::skip(uint64_t n)
+{
+	_skipped.fetch_add(n, std::memory_order_relaxed);
+	_done.fetch_add(n, std::memory_order_relaxed);
+}
+
+/*
+ * Stops the reporter and prints the final line (not in quiet mode)
+ */
+void Progress::finish()
+{
+	if (!_reporter.joinable()) return;
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+		_stop = true;
+	}
+	_cv.notify_all();
+	_reporter.join();
+	print(true);
+}
+
+void Progress::report_loop()
+{
+	std::unique_lock<std::mutex> lock(_mtx);
+	while (!_stop)
+	{
+		_cv.wait_for(lock, std::chrono::duration<double>(_interval), [this]{ return _stop; });
+		if (!_stop) print(false);
+	}
+}
+
+/*
+ * One line: done/total, throughput of the simulated points and ETA
+ */
+void Progress::print(bool final)
+{
+	uint64_t done = _done.load(std::memory_order_relaxed);
+	uint64_t skipped = _skipped.load(std::memory_order_relaxed);
+	double elapsed = now_seconds() - _t0;
+	double rate = (elapsed > 0) ? (done - skipped)/elapsed : 0.;
+	char line[256];
+	if (final)
+	{
+		std::snprintf(line, sizeof(line), "Done: %llu/%llu %s in %s (%.2f %s/s)", (unsigned long long) done, (unsigned long long) _total, _unit.c_str(),
+				format_time(elapsed).c_str(), rate, _unit.c_str());
+	}
+	else
+	{
+		std::string eta = (rate > 0 && done <= _total) ? format_time((_total - done)/rate) : "unknown";
+		std::snprintf(line, sizeof(line), "Progress: %llu/%llu %s (%.1f%%), %.2f %s/s, ETA %s", (unsigned long long) done, (unsigned long long) _total, _unit.c_str(),
+				_total ? 100.*done/_total : 100., rate, _unit.c_str(), eta.c_str());
+	}
+	std::cout << line << std::endl;
+}
+
+/*
+ * 3725 -> "1h02m05s"
+ */
+std::string Progress::format_time(double seconds)
+{
+	long s = (long) (seconds + 0.5);
+	char text[64];
+	if (s >= 3600) std::snprintf(text, sizeof(text), "%ldh%02ldm%02lds", s/3600, (s/60)%60, s%60);
+	else if (s >= 60) std::snprintf(text, sizeof(text), "%ldm%02lds", s/60, s%60);
+	else std::snprintf(text, sizeof(text), "%lds", s);
+	return text;
+}
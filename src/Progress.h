@@ -0,0 +1,55 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+
+/*
+ ***********************************PROGRESS***********************************
+ *
+ * Progress of a scan. Workers only increment an atomic counter when a point
+ * is done (add) or taken from a checkpoint/cache (skip); a single reporter
+ * thread prints one line every interval seconds with the completed points,
+ * the throughput and the estimated time left. Skipped points count as done
+ * but not in the throughput, so a resumed run gets a sensible ETA.
+ *
+ * An interval <= 0 is the quiet mode: nothing is printed at all, for batch
+ * jobs. finish() stops the reporter and prints the final line.
+ *
+ */
+
+class Progress
+{
+  private:
+    std::atomic<uint64_t> _done;
+    std::atomic<uint64_t> _skipped;
+    uint64_t _total;
+    double _interval;
+    std::string _unit;
+    double _t0;
+
+    std::thread _reporter;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _stop;
+
+    void report_loop();
+    void print(bool final);
+
+  public:
+    Progress();
+    ~Progress();
+
+    void start(uint64_t total, double interval, std::string unit = "points");
+    void add(uint64_t n = 1);
+    void skip(uint64_t n = 1);
+    void finish();
+
+    static std::string format_time(double seconds);
+};
+
+#endif // PROGRESS_H
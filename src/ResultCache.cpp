@@ -0,0 +1,239 @@
+#include "ResultCache.h"
+#include "Checkpoint.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#include <unistd.h>
+
+static const char CACHE_MAGIC[8] = {'T','R','A','C','S','R','E','S'};
+static const uint32_t CACHE_VERSION = 1;
+static const uint64_t CACHE_HEADER_SIZE = 16;
+static const uint64_t RECORD_HEADER_SIZE = 16;
+
+// Bump when a change in the simulation makes old currents invalid
+static const uint32_t PHYSICS_VERSION = 2; // 2: trapping from the generation of every carrier
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+ ********************** CONSTRUCTOR OF THE CLASS RESULT CACHE **************************
+ */
+ResultCache::ResultCache() :
+	_end(0),
+	_n_hits(0),
+	_n_added(0)
+{
+}
+
+/*
+ * Opens (or creates) the cache file and indexes its entries. Returns false,
+ * and the cache stays unused, if the file cannot be used
+ */
+bool ResultCache::open(std::string filename)
+{
+	close();
+	_filename = filename;
+	_index.clear();
+	_n_hits = _n_added = 0;
+
+	std::ifstream in(filename, std::ios_base::binary);
+	bool exists = in.is_open();
+	if (exists)
+	{
+		in.seekg(0, std::ios_base::end);
+		uint64_t size = in.tellg();
+		in.seekg(0, std::ios_base::beg);
+		char magic[8];
+		uint32_t version = 0;
+		in.read(magic, sizeof(magic));
+		in.read((char *) &version, sizeof(version));
+		if (size == 0)
+		{
+			exists = false;
+		}
+		else if (!in || std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 || version != CACHE_VERSION)
+		{
+			std::cout << "File " << filename << " is not a TRACS result cache, running without cache" << std::endl;
+			return false;
+		}
+		else
+		{
+			uint64_t pos = CACHE_HEADER_SIZE;
+			while (pos + RECORD_HEADER_SIZE <= size)
+			{
+				uint64_t key = 0;
+				uint32_t n_samples = 0;
+				in.seekg(pos);
+				in.read((char *) &key, sizeof(key));
+				in.read((char *) &n_samples, sizeof(n_samples));
+				if (!in || pos + RECORD_HEADER_SIZE + n_samples*sizeof(double) > size) break;
+				_index[key] = std::make_pair(pos + RECORD_HEADER_SIZE, n_samples);
+				pos += RECORD_HEADER_SIZE + n_samples*sizeof(double);
+			}
+			_end = pos;
+			// Drop a record cut by a crash
+			if (pos < size && truncate(filename.c_str(), pos) != 0) std::cout << "Result cache " << filename << " could not be truncated" << std::endl;
+		}
+	}
+	in.close();
+
+	if (!exists)
+	{
+		std::ofstream out(filename, std::ios_base::binary | std::ios_base::trunc);
+		uint32_t reserved = 0;
+		out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		out.write((const char *) &CACHE_VERSION, sizeof(CACHE_VERSION));
+		out.write((const char *) &reserved, sizeof(reserved));
+		_end = CACHE_HEADER_SIZE;
+	}
+
+	_file.open(filename, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+	if (!_file.is_open())
+	{
+		std::cout << "Result cache " << filename << " could not be opened, running without cache" << std::endl;
+		_index.clear();
+		return false;
+	}
+	std::cout << "Result cache " << filename << ": " << _index.size() << " waveforms" << std::endl;
+	return true;
+}
+
+/*
+ * Writes the new entries to disk and closes the file
+ */
+void ResultCache::close()
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	if (!_file.is_open()) return;
+	_file.close();
+	if (_n_added > 0 || _n_hits > 0) std::cout << "Result cache " << _filename << ": " << _n_hits << " waveforms reused, " << _n_added << " added" << std::endl;
+}
+
+bool ResultCache::is_open()
+{
+	return _file.is_open();
+}
+
+/*
+ * True if there is a waveform of n_samples under key
+ */
+bool ResultCache::contains(uint64_t key, int n_samples)
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	std::unordered_map< uint64_t, std::pair<uint64_t, uint32_t> >::const_iterator it = _index.find(key);
+	return _file.is_open() && it != _index.end() && it->second.second == (uint32_t) n_samples;
+}
+
+/*
+ * Copies the waveform under key into samples. Returns false if there is
+ * none (or it has a different number of samples)
+ */
+bool ResultCache::get(uint64_t key, double *samples, int n_samples)
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	std::unordered_map< uint64_t, std::pair<uint64_t, uint32_t> >::const_iterator it = _index.find(key);
+	if (!_file.is_open() || it == _index.end() || it->second.second != (uint32_t) n_samples) return false;
+	_file.clear();
+	_file.seekg(it->second.first);
+	_file.read((char *) samples, n_samples*sizeof(double));
+	if (!_file)
+	{
+		_file.clear();
+		return false;
+	}
+	_n_hits++;
+	return true;
+}
+
+/*
+ * Appends the waveform of key (n_samples values)
+ */
+void ResultCache::put(uint64_t key, const double *samples, int n_samples)
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	if (!_file.is_open()) return;
+	std::unordered_map< uint64_t, std::pair<uint64_t, uint32_t> >::const_iterator it = _index.find(key);
+	if (it != _index.end() && it->second.second == (uint32_t) n_samples) return;
+
+	uint32_t n = n_samples, reserved = 0;
+	_file.clear();
+	_file.seekp(_end);
+	_file.write((const char *) &key, sizeof(key));
+	_file.write((const char *) &n, sizeof(n));
+	_file.write((const char *) &reserved, sizeof(reserved));
+	_file.write((const char *) samples, n*sizeof(double));
+	if (!_file)
+	{
+		std::cout << "Result cache " << _filename << " could not be written" << std::endl;
+		_file.clear();
+		return;
+	}
+	_index[key] = std::make_pair(_end + RECORD_HEADER_SIZE, n);
+	_end += RECORD_HEADER_SIZE + n*sizeof(double);
+	_n_added++;
+}
+
+int ResultCache::get_n_entries()
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	return _index.size();
+}
+
+int ResultCache::get_n_hits()
+{
+	return _n_hits;
+}
+
+int ResultCache::get_n_added()
+{
+	return _n_added;
+}
+
+/*
+ * Hash of the inputs of config_filename that change the Ramo current and of
+ * the contents of the carrier file. Every line "Key = value" is part of it
+ * (see Checkpoint::hash_config) except the keys that only affect the
+ * electronics, the scan range, the output or the performance.
+ */
+uint64_t ResultCache::inputs_key(std::string config_filename, std::string carriers_file)
+{
+	static const std::set<std::string> ignored = {
+		"Capacitance", "Electronics", "OutputFormat", "RootCompression", "CheckpointInterval", "ProgressInterval", "ResultCache",
+		"NumberOfThreads", "CarrierThreads", "Lambda", "ScanType", "CarrierFile",
+		"InitialVoltage", "VoltageStep", "MaxVoltage", "InitialZ", "MaximumZ", "StepInZ", "InitialY", "MaximumY", "StepInY"};
+
+	uint64_t hash = fnv1a(14695981039346656037ULL, &PHYSICS_VERSION, sizeof(PHYSICS_VERSION));
+	hash = Checkpoint::hash_config(config_filename, ignored, hash);
+	return Checkpoint::hash_file(carriers_file, hash);
+}
+
+/*
+ * Key of one point. Voltage (V) and positions (um) are rounded to 1e-6 so
+ * that the same point reached through a different scan range (e.g. z0 +
+ * i*dz) gets the same key
+ */
+uint64_t ResultCache::point_key(uint64_t inputs, double voltage, double y, double z)
+{
+	int64_t values[3] = {(int64_t) std::llround(voltage*1.e6), (int64_t) std::llround(y*1.e6), (int64_t) std::llround(z*1.e6)};
+	return fnv1a(inputs, values, sizeof(values));
+}
+
+/*
+ ********************** DESTRUCTOR OF THE CLASS RESULT CACHE **************************
+ */
+ResultCache::~ResultCache()
+{
+	close();
+}
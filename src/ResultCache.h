@@ -0,0 +1,64 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+
+/*
+ *********************************RESULT CACHE*********************************
+ *
+ * Persistent cache of Ramo currents (before any electronics) shared by all
+ * the runs that use the same cache file. Every waveform is stored under a key
+ * that hashes everything the current depends on: the simulation inputs of
+ * the configuration file (see inputs_key()), the contents of the carrier
+ * file and the voltage, y and z of the point. A rerun after changing only
+ * the capacitance, the electronics or the scan range finds the points that
+ * were already simulated and only drifts the new ones.
+ *
+ * Entries are only appended, the file is never pruned: delete it to start
+ * over. An entry cut by a crash at the end of the file is dropped. get() and
+ * put() can be called from several threads at the same time.
+ *
+ * File layout (native byte order): "TRACSRES", uint32 version, uint32
+ * reserved, then records of uint64 key, uint32 n_samples, uint32 reserved
+ * followed by n_samples doubles. A key found more than once takes the last
+ * record.
+ *
+ */
+
+class ResultCache
+{
+  private:
+    std::string _filename;
+    std::fstream _file;
+    std::mutex _mtx;
+    // Offset of the samples and number of samples of every key
+    std::unordered_map< uint64_t, std::pair<uint64_t, uint32_t> > _index;
+    uint64_t _end;
+    int _n_hits;
+    int _n_added;
+
+  public:
+    ResultCache();
+    ~ResultCache();
+
+    bool open(std::string filename);
+    void close();
+    bool is_open();
+
+    bool contains(uint64_t key, int n_samples);
+    bool get(uint64_t key, double *samples, int n_samples);
+    void put(uint64_t key, const double *samples, int n_samples);
+
+    int get_n_entries();
+    int get_n_hits();
+    int get_n_added();
+
+    static uint64_t inputs_key(std::string config_filename, std::string carriers_file);
+    static uint64_t point_key(uint64_t inputs, double voltage, double y, double z);
+};
+
+#endif // RESULT_CACHE_H
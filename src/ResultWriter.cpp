@@ -0,0 +1,173 @@
+#include "ResultWriter.h"
+
+#include <cstdio>
+#include <iostream>
+
+/*
+ * Constructor of the writer. Starts the background thread.
+ */
+ResultWriter::ResultWriter(std::size_t max_rows, std::size_t flush_bytes) :
+	_max_rows(max_rows > 0 ? max_rows : 1),
+	_flush_bytes(flush_bytes),
+	_busy(0),
+	_flush(false),
+	_stop(false)
+{
+	_thread = std::thread(&ResultWriter::run, this);
+}
+
+/*
+ * Queues one row of the file filename. Equivalent to
+ * utilities::write_to_file_row(filename, hist, temp, yShift, height, voltage)
+ * Blocks only if the queue is full.
+ */
+void ResultWriter::write_row(std::string filename, TH1D *hist, double temp, double yShift, double height, double voltage)
+{
+	int steps = hist->GetNbinsX();
+	std::vector<double> samples(steps);
+	for (int i = 1; i <= steps; i++)
+	{
+		samples[i-1] = hist->GetBinContent(i);
+	}
+	write_row(filename, samples.data(), steps, temp, yShift, height, voltage);
+}
+
+/*
+ * Same from the n samples of an array
+ */
+void ResultWriter::write_row(std::string filename, const double *samples, int n, double temp, double yShift, double height, double voltage)
+{
+	Row row;
+	row.filename = filename;
+	row.temp = temp;
+	row.y_shift = yShift;
+	row.height = height;
+	row.voltage = voltage;
+	row.samples.assign(samples, samples + n);
+
+	std::unique_lock<std::mutex> lock(_mtx);
+	_cv_pop.wait(lock, [this]{ return _queue.size() < _max_rows; });
+	_queue.push_back(std::move(row));
+	lock.unlock();
+	_cv_push.notify_one();
+}
+
+/*
+ * Blocks until every queued row has been written to its file
+ */
+void ResultWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(_mtx);
+	if (_stop) return;
+	_flush = true;
+	_cv_push.notify_one();
+	_cv_pop.wait(lock, [this]{ return !_flush; });
+}
+
+/*
+ * Writes everything left, closes the files and stops the background thread
+ */
+void ResultWriter::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+		_stop = true;
+	}
+	_cv_push.notify_one();
+	if (_thread.joinable()) _thread.join();
+}
+
+/*
+ * Main loop of the background thread: take all the queued rows at once,
+ * format them outside the lock and write the buffers that are full
+ */
+void ResultWriter::run()
+{
+	std::deque<Row> batch;
+	std::unique_lock<std::mutex> lock(_mtx);
+	while (true)
+	{
+		_cv_push.wait(lock, [this]{ return _stop || _flush || !_queue.empty(); });
+		if (!_queue.empty())
+		{
+			batch.swap(_queue);
+			_busy = batch.size();
+			lock.unlock();
+			_cv_pop.notify_all();
+			for (unsigned int i = 0; i < batch.size(); i++)
+			{
+				format_row(batch[i]);
+			}
+			batch.clear();
+			write_buffers(false);
+			lock.lock();
+			_busy = 0;
+			continue;
+		}
+		// Queue empty: everything requested so far is formatted
+		if (_flush || _stop)
+		{
+			lock.unlock();
+			write_buffers(true);
+			if (_stop) _files.clear();
+			lock.lock();
+			_flush = false;
+			_cv_pop.notify_all();
+			if (_stop) return;
+		}
+	}
+}
+
+/*
+ * Appends one row to the buffer of its file, in the format of
+ * utilities::write_to_file_row
+ */
+void ResultWriter::format_row(const Row &row)
+{
+	std::unique_ptr<OutFile> &file = _files[row.filename];
+	if (!file)
+	{
+		file.reset(new OutFile);
+		file->out.open(row.filename, std::ios_base::app);
+		if (!file->out.is_open()) std::cout << "File " << row.filename << " could not be open for writing" << std::endl;
+		file->buffer.reserve(_flush_bytes + 4096);
+	}
+
+	// Header of the row with the default stream format, samples as std::fixed
+	// with 9 decimals
+	char num[128];
+	std::snprintf(num, sizeof(num), "%lu %g %g 0  %g %g ", (unsigned long) row.samples.size(), row.temp-273., row.voltage, row.y_shift/1000., row.height/1000.);
+	file->buffer += num;
+	for (unsigned int i = 0; i < row.samples.size(); i++)
+	{
+		int n = std::snprintf(num, sizeof(num), "%.9f ", row.samples[i]);
+		file->buffer.append(num, n);
+	}
+	file->buffer += '\n';
+}
+
+/*
+ * Writes the buffers larger than _flush_bytes (all of them if sync) to disk
+ */
+void ResultWriter::write_buffers(bool sync)
+{
+	for (auto it = _files.begin(); it != _files.end(); ++it)
+	{
+		OutFile &file = *it->second;
+		if (!sync && file.buffer.size() < _flush_bytes) continue;
+		if (file.out.is_open())
+		{
+			file.out.write(file.buffer.data(), file.buffer.size());
+			if (sync) file.out.flush();
+		}
+		file.buffer.clear();
+	}
+}
+
+/*
+ ********************** DESTRUCTOR OF THE CLASS RESULT WRITER **************************
+ */
+ResultWriter::~ResultWriter()
+{
+	close();
+}
@@ -0,0 +1,79 @@
+#ifndef RESULTWRITER_H
+#define RESULTWRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <TH1D.h>
+
+/*
+ *********************************RESULT WRITER*********************************
+ *
+ * Asynchronous writer for the rows of the .hetct files. Same output as
+ * utilities::write_to_file_row, but the calling thread only copies the bin
+ * contents into a bounded queue. A background thread formats the rows into
+ * one buffer per file and writes a buffer out once it is larger than
+ * flush_bytes. Files are opened (in append mode) the first time they are
+ * used and kept open until close().
+ *
+ * write_row() only blocks while the queue is full. flush() blocks until all
+ * the queued rows are on disk, call it before anything else touches the files
+ * (e.g. rewriting a header).
+ *
+ */
+
+class ResultWriter
+{
+  private:
+    struct Row
+    {
+      std::string filename;
+      double temp;
+      double y_shift;
+      double height;
+      double voltage;
+      std::vector<double> samples;
+    };
+
+    struct OutFile
+    {
+      std::ofstream out;
+      std::string buffer;
+    };
+
+    std::size_t _max_rows;    // queue capacity
+    std::size_t _flush_bytes; // buffer size that triggers a write to disk
+
+    std::deque<Row> _queue;
+    std::map< std::string, std::unique_ptr<OutFile> > _files;
+
+    std::mutex _mtx;
+    std::condition_variable _cv_push; // signaled when a row is queued
+    std::condition_variable _cv_pop;  // signaled when a row leaves the queue
+    int _busy;   // rows taken from the queue but not yet formatted
+    bool _flush; // flush requested
+    bool _stop;
+    std::thread _thread;
+
+    void run();
+    void format_row(const Row &row);
+    void write_buffers(bool sync);
+
+  public:
+    ResultWriter(std::size_t max_rows = 1024, std::size_t flush_bytes = 1 << 20);
+    ~ResultWriter();
+
+    void write_row(std::string filename, TH1D *hist, double temp, double yShift, double height, double voltage);
+    void write_row(std::string filename, const double *samples, int n, double temp, double yShift, double height, double voltage);
+    void flush();
+    void close();
+};
+
+#endif // RESULTWRITER_H
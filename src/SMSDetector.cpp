@@ -9,6 +9,7 @@ SMSDetector::SMSDetector(double pitch, double width, double depth, int nns, char
     _depth(depth), //Vertical size of the pad (typically 300microns)
     _tempK(tempK), // Temperature of the detector
     _trapping_time(trapping), // Trapping constant simulates radiation-induced defects (traps)
+    _trapping_time_holes(trapping),
     _fluence(fluence), // Irradiation fluence in neutron equivalent (neq)
     _nns(nns), // Number of neighbouring strips
     _bulk_type(bulk_type), //Dopant type of the silicon (p/n)
@@ -23,10 +24,19 @@ SMSDetector::SMSDetector(double pitch, double width, double depth, int nns, char
     // Mesh properties
     _n_cells_x(n_cells_x),
     _n_cells_y(n_cells_y),
+#ifdef TRACS_MPI
+    // Every MPI rank solves a whole detector on its own (no mesh partitioning)
+#if DOLFIN_VERSION_MINOR>=6
+    _mesh(MPI_COMM_SELF, Point(_x_min,_y_min),Point(_x_max,_y_max), _n_cells_x, _n_cells_y),
+#else
+    _mesh(MPI_COMM_SELF, _x_min,_y_min,_x_max,_y_max, _n_cells_x, _n_cells_y),
+#endif
+#else
 #if DOLFIN_VERSION_MINOR>=6
     _mesh(Point(_x_min,_y_min),Point(_x_max,_y_max), _n_cells_x, _n_cells_y),
 #else
     _mesh(_x_min,_y_min,_x_max,_y_max, _n_cells_x, _n_cells_y),
+#endif
 #endif
     _periodic_boundary(_x_min, _x_max, _depth),
 
@@ -45,7 +55,8 @@ SMSDetector::SMSDetector(double pitch, double width, double depth, int nns, char
     _w_u(_V_p),
     _d_u(_V_p),
     _w_f_grad(_V_g), // Weighting field
-    _d_f_grad(_V_g)
+    _d_f_grad(_V_g),
+    _operator_cache(false)
 {
 }
 
@@ -85,7 +96,7 @@ void SMSDetector::solve_w_u()
   bcs.push_back(&neighbour_strip_BC);
   bcs.push_back(&backplane_BC);
 
-  solve(_a_p == _L_p , _w_u, bcs);
+  solve_poisson(_w_u, bcs);
 }
 
 /*
@@ -93,14 +104,27 @@ void SMSDetector::solve_w_u()
  */
 
 void SMSDetector::solve_d_u()
+{
+	if (_fluence <= 0)
+	{
+		// Idiot-proofing
+		_trapping_time = std::numeric_limits<double>::max();
+		_trapping_time_holes = std::numeric_limits<double>::max();
+	}
+	solve_d_u(_d_u, _v_strips, _v_backplane);
+}
+
+/*
+ * Solves Poisson's equation for the given electrode voltages and stores 
+ * the solution in d_u
+ */
+void SMSDetector::solve_d_u(Function &d_u, double v_strips, double v_backplane)
 {
 	Constant fpois(_f_poisson); 
 	Source f;
 	if (_fluence <= 0)
 	{
 		_L_p.f = fpois;
-		// Idiot-proofing
-		_trapping_time = std::numeric_limits<double>::max();
 	}
 	else 
 	{
@@ -118,9 +142,9 @@ void SMSDetector::solve_d_u()
 
 	
   // Set BC values
-  Constant central_strip_V(_v_strips);
-  Constant neighbour_strip_V(_v_strips);
-  Constant backplane_V(_v_backplane);
+  Constant central_strip_V(v_strips);
+  Constant neighbour_strip_V(v_strips);
+  Constant backplane_V(v_backplane);
   // Set BC variables
   DirichletBC central_strip_BC(_V_p, central_strip_V, _central_strip);
   DirichletBC neighbour_strip_BC(_V_p, neighbour_strip_V, _neighbour_strips);
@@ -131,7 +155,34 @@ void SMSDetector::solve_d_u()
   bcs.push_back(&neighbour_strip_BC);
   bcs.push_back(&backplane_BC);
 
-  solve(_a_p == _L_p , _d_u, bcs);
+  solve_poisson(d_u, bcs);
+}
+
+/*
+ * Solves _a_p == _L_p with the given boundary conditions. With the operator
+ * cache the matrix is assembled and factorized only once: it depends on the
+ * mesh and on where the boundary conditions are, not on the source (Neff) or
+ * on the voltages, so only the right hand side is assembled for every solve.
+ */
+void SMSDetector::solve_poisson(Function &u, std::vector<const DirichletBC*> &bcs)
+{
+  if (!_operator_cache)
+  {
+    solve(_a_p == _L_p , u, bcs);
+    return;
+  }
+  if (!_lu_p)
+  {
+    _A_p.reset(new Matrix);
+    assemble(*_A_p, _a_p);
+    for (unsigned int i = 0; i < bcs.size(); i++) bcs[i]->apply(*_A_p);
+    _lu_p.reset(new LUSolver(_A_p));
+    _lu_p->parameters["reuse_factorization"] = true;
+  }
+  Vector b;
+  assemble(b, _L_p);
+  for (unsigned int i = 0; i < bcs.size(); i++) bcs[i]->apply(b);
+  _lu_p->solve(*u.vector(), b);
 }
 
 /*
@@ -139,11 +190,7 @@ void SMSDetector::solve_d_u()
  */
 void SMSDetector::solve_w_f_grad()
 {
-
-  _L_g.u = _w_u;
-  solve(_a_g == _L_g, _w_f_grad);
-  // Change sign E = - grad(u)
-  _w_f_grad = _w_f_grad * (-1.0);
+  solve_grad(_w_u, _w_f_grad);
 }
 
 /*
@@ -151,11 +198,107 @@ void SMSDetector::solve_w_f_grad()
  */
 void SMSDetector::solve_d_f_grad()
 {
-  _L_g.u = _d_u;
-  solve(_a_g == _L_g, _d_f_grad);
+  solve_grad(_d_u, _d_f_grad);
+}
+
+/*
+ * Calculates the field f_grad = -grad(u) of a given potential
+ */
+void SMSDetector::solve_grad(Function &u, Function &f_grad)
+{
+  _L_g.u = u;
+  if (!_operator_cache)
+  {
+    solve(_a_g == _L_g, f_grad);
+  }
+  else
+  {
+    // Projection matrix of the gradient, assembled and factorized once
+    if (!_lu_g)
+    {
+      _A_g.reset(new Matrix);
+      assemble(*_A_g, _a_g);
+      _lu_g.reset(new LUSolver(_A_g));
+      _lu_g->parameters["reuse_factorization"] = true;
+    }
+    Vector b;
+    assemble(b, _L_g);
+    _lu_g->solve(*f_grad.vector(), b);
+  }
   // Change sign E = - grad(u)
-  _d_f_grad = _d_f_grad * (-1.0);
+  f_grad = f_grad * (-1.0);
+}
 
+/*
+ * Keeps the assembled and factorized operators of the field solvers between
+ * solves (repeated solves on the same mesh, e.g. fits of Neff). Off by
+ * default. Geometry and mesh must not change while it is on.
+ */
+void SMSDetector::set_operator_cache(bool operator_cache)
+{
+  _operator_cache = operator_cache;
+  if (!_operator_cache)
+  {
+    _A_p.reset();
+    _lu_p.reset();
+    _A_g.reset();
+    _lu_g.reset();
+  }
+}
+
+/*
+ * Tangent-linear model of the drifting field: solves dE/dp for every parameter p
+ * of params, at the current voltages and Neff. Parameters are the indices of the
+ * Neff parametrization (0-3: y0..y3, 5-6: z1, z2) or SENSITIVITY_BIAS. Poisson's
+ * equation is linear, so d(d_u)/dp solves the same operator with the derivative
+ * of the right hand side and of the boundary values: with the operator cache on
+ * every parameter costs one assembly of b and one back substitution.
+ */
+void SMSDetector::solve_d_f_grad_sensitivities(const std::vector<int> &params)
+{
+  _sensitivity_params = params;
+  _d_f_grad_sens.clear();
+  Function d_u_sens(_V_p);
+  for (unsigned int k = 0; k < params.size(); k++)
+  {
+    std::shared_ptr<Function> d_f_grad_sens(new Function(_V_g));
+    solve_d_u_sensitivity(d_u_sens, params[k]);
+    solve_grad(d_u_sens, *d_f_grad_sens);
+    _d_f_grad_sens.push_back(d_f_grad_sens);
+  }
+}
+
+/*
+ * Derivative of the drifting potential with respect to one parameter
+ */
+void SMSDetector::solve_d_u_sensitivity(Function &d_u_sens, int param)
+{
+  bool neff_param = (param >= 0 && param < 8);
+  if ((neff_param && _fluence <= 0) || param == 4 || param == 7 || param < 0 || param > SENSITIVITY_BIAS)
+  {
+    // Neff is not used without fluence and z0, z3 are fixed to the detector faces
+    d_u_sens.vector()->zero();
+    return;
+  }
+
+  Constant zero(0.0);
+  // One cell for the zone boundaries (see SourceSensitivity)
+  SourceSensitivity f(_neff_type, _neff_param, param, (param < 4) ? 1.0 : _depth/_n_cells_y);
+  if (neff_param) _L_p.f = f;
+  else _L_p.f = zero; // Neff (or the constant source) does not depend on the bias
+
+  // Only the biased electrode changes with the bias
+  Constant strips_V((param == SENSITIVITY_BIAS && _implant_type == 'n') ? 1.0 : 0.0);
+  Constant backplane_V((param == SENSITIVITY_BIAS && _implant_type == 'p') ? 1.0 : 0.0);
+  DirichletBC central_strip_BC(_V_p, strips_V, _central_strip);
+  DirichletBC neighbour_strip_BC(_V_p, strips_V, _neighbour_strips);
+  DirichletBC backplane_BC(_V_p, backplane_V, _backplane);
+  std::vector<const DirichletBC*> bcs;
+  bcs.push_back(&central_strip_BC);
+  bcs.push_back(&neighbour_strip_BC);
+  bcs.push_back(&backplane_BC);
+
+  solve_poisson(d_u_sens, bcs);
 }
 
 /*
@@ -221,6 +364,32 @@ RectangleMesh * SMSDetector::get_mesh()
 	return &_mesh;
 }
 
+/*
+ * Getter for the smallest side of the mesh cells
+ */
+double SMSDetector::get_cell_size()
+{
+	return std::min((_x_max - _x_min)/_n_cells_x, (_y_max - _y_min)/_n_cells_y);
+}
+
+/*
+ * Getters for the field sensitivities of the last solve_d_f_grad_sensitivities()
+ */
+int SMSDetector::get_n_sensitivities()
+{
+	return _d_f_grad_sens.size();
+}
+
+int SMSDetector::get_sensitivity_param(int k)
+{
+	return _sensitivity_params[k];
+}
+
+Function * SMSDetector::get_d_f_grad_sensitivity(int k)
+{
+	return _d_f_grad_sens[k].get();
+}
+
 /*
  * Getter for the minimum X value
  */
@@ -262,13 +431,21 @@ double SMSDetector::get_y_max()
 }
 
 /*
- * Getter for the trapping factor
+ * Getter for the trapping factor (of electrons, see below)
  */
 double SMSDetector::get_trapping_time()
 {
   return _trapping_time;
 }
 
+/*
+ * Getter for the trapping time of one type of carrier ('e' or 'h')
+ */
+double SMSDetector::get_trapping_time(char carrier_type)
+{
+  return (carrier_type == 'h') ? _trapping_time_holes : _trapping_time;
+}
+
 /*
  * Getter for the fluence
  */
@@ -417,11 +594,21 @@ void SMSDetector::set_temperature(double temperature)
 }
 
 /*
- * Setter for changing the number of cells in y direction of the mesh
+ * Setter for changing the trapping time of both electrons and holes
  */
 void SMSDetector::set_trapping_time(double trapping_tau)
 {
   _trapping_time = trapping_tau;
+  _trapping_time_holes = trapping_tau;
+}
+
+/*
+ * Setter for different trapping times of electrons and holes
+ */
+void SMSDetector::set_trapping_time(double trapping_tau_electrons, double trapping_tau_holes)
+{
+  _trapping_time = trapping_tau_electrons;
+  _trapping_time_holes = trapping_tau_holes;
 }
 
 /*
@@ -20,7 +20,8 @@ class SMSDetector
     double _width; // in microns
     double _depth; // in microns
     double _tempK; // temperature in Kelvin
-    double _trapping_time; // radiation damage effect
+    double _trapping_time; // radiation damage effect (electrons)
+    double _trapping_time_holes; // same as electrons unless set apart
     double _fluence; // irradiation fluence (in neq)
     int _nns; // numbre of neighbouring strips
     char _bulk_type; // p or n
@@ -73,7 +74,26 @@ class SMSDetector
     Function _w_f_grad; // function to store the weighting field (vectorial)
     Function _d_f_grad; // function to store the drifting field (vectorial)
 
+    // Assembled and factorized operators, reused by every solve (see set_operator_cache)
+    bool _operator_cache;
+    std::shared_ptr<Matrix> _A_p;
+    std::shared_ptr<LUSolver> _lu_p;
+    std::shared_ptr<Matrix> _A_g;
+    std::shared_ptr<LUSolver> _lu_g;
+
+    // tangent-linear drifting fields: derivatives of _d_f_grad with respect to parameters
+    std::vector<int> _sensitivity_params;
+    std::vector< std::shared_ptr<Function> > _d_f_grad_sens;
+
+    void solve_d_u(Function &d_u, double v_strips, double v_backplane);
+    void solve_poisson(Function &u, std::vector<const DirichletBC*> &bcs);
+    void solve_grad(Function &u, Function &f_grad);
+    void solve_d_u_sensitivity(Function &d_u_sens, int param);
+
   public:
+    // parameter of solve_d_f_grad_sensitivities() after the 8 of Neff (y0..y3, z0..z3)
+    static const int SENSITIVITY_BIAS = 8;
+
     // default constructor and destructor
     SMSDetector(double pitch, double width, double depth, int nns, char bulk_type, char implant_type, int n_cells_x = 100, int n_cells_y = 100, double tempK = 253., double trapping = 9e300, double fluence = 0.0, std::vector<double> neff_param = {0}, std::string neff_type = "Trilinear");
     ~SMSDetector();
@@ -90,14 +110,19 @@ class SMSDetector
     void set_derived(); // Properly sets all derived quantities
     void set_temperature(double temperature);
     void set_trapping_time(double trapping_tau);
+    void set_trapping_time(double trapping_tau_electrons, double trapping_tau_holes);
     void set_fluence(double fluencia);
 	void set_neff_param(std::vector<double> neff_parameters);
 	void set_neff_type(std::string newApproach);
-    // solve potentials
+    void set_operator_cache(bool operator_cache);
+    // solve potentials. DOLFIN assembly and the PETSc solvers are not thread
+    // safe, and the fields read by get_*() are PETSc vectors too: no solve may
+    // run while other threads evaluate the fields (drift)
     void solve_w_u();
     void solve_d_u();
     void solve_w_f_grad();
     void solve_d_f_grad();
+    void solve_d_f_grad_sensitivities(const std::vector<int> &params);
 
     // get methods
     Function * get_w_u();
@@ -105,12 +130,17 @@ class SMSDetector
     Function * get_w_f_grad();
     Function * get_d_f_grad();
 	RectangleMesh * get_mesh();
+    double get_cell_size();
+    int get_n_sensitivities();
+    int get_sensitivity_param(int k);
+    Function * get_d_f_grad_sensitivity(int k);
     double get_x_min();
     double get_x_max();
     double get_y_min();
     double get_y_max();
     double get_temperature();
     double get_trapping_time();
+    double get_trapping_time(char carrier_type);
 	double get_fluence();
 	double get_depth();
 	double get_pitch();
@@ -0,0 +1,361 @@
+#include "ScanFile.h"
+#include "ResultWriter.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char SCAN_MAGIC[8] = {'T','R','A','C','S','S','C','N'};
+static const uint32_t SCAN_VERSION = 1;
+static const size_t CHANNEL_NAME_SIZE = 32;
+static const uint64_t DATA_ALIGNMENT = 4096;
+
+/*
+ ********************** CONSTRUCTOR OF THE CLASS SCAN FILE WRITER **************************
+ */
+ScanFileWriter::ScanFileWriter() :
+	_buffer(1 << 20),
+	_n_samples(0),
+	_n_waveforms(0),
+	_written(0)
+{
+}
+
+/*
+ * Creates filename and writes everything up to the data block. The waveforms
+ * are then given in order with write_waveform()
+ */
+bool ScanFileWriter::open(std::string filename, std::string text, std::vector<double> voltages, std::vector<double> y, std::vector<double> z, std::vector<std::string> channels, int n_samples, double dt, double t0, double temperature)
+{
+	close();
+
+	ScanFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, SCAN_MAGIC, sizeof(SCAN_MAGIC));
+	header.version = SCAN_VERSION;
+	header.n_channels = channels.size();
+	header.n_voltages = voltages.size();
+	header.n_y = y.size();
+	header.n_z = z.size();
+	header.n_samples = n_samples;
+	header.dt = dt;
+	header.t0 = t0;
+	header.temperature = temperature;
+	header.text_size = text.size();
+	uint64_t end = sizeof(header) + (voltages.size() + y.size() + z.size())*sizeof(double) + channels.size()*CHANNEL_NAME_SIZE + text.size();
+	header.data_offset = (end + DATA_ALIGNMENT - 1)/DATA_ALIGNMENT*DATA_ALIGNMENT;
+
+	_out.rdbuf()->pubsetbuf(_buffer.data(), _buffer.size());
+	_out.open(filename, std::ios_base::binary | std::ios_base::trunc);
+	if (!_out.is_open())
+	{
+		std::cout << "File " << filename << " could not be created" << std::endl;
+		return false;
+	}
+
+	_out.write((const char *) &header, sizeof(header));
+	_out.write((const char *) voltages.data(), voltages.size()*sizeof(double));
+	_out.write((const char *) y.data(), y.size()*sizeof(double));
+	_out.write((const char *) z.data(), z.size()*sizeof(double));
+	for (unsigned int i = 0; i < channels.size(); i++)
+	{
+		char name[CHANNEL_NAME_SIZE] = {0};
+		std::strncpy(name, channels[i].c_str(), CHANNEL_NAME_SIZE-1);
+		_out.write(name, CHANNEL_NAME_SIZE);
+	}
+	_out.write(text.data(), text.size());
+	std::vector<char> padding(header.data_offset - end, 0);
+	_out.write(padding.data(), padding.size());
+
+	_n_samples = n_samples;
+	_n_waveforms = (uint64_t) header.n_voltages*header.n_y*header.n_z*header.n_channels;
+	_written = 0;
+	return true;
+}
+
+/*
+ * Appends the next waveform (n_samples values) of the data block: channel
+ * runs fastest, then z, y and voltage
+ */
+void ScanFileWriter::write_waveform(const double *samples)
+{
+	if (!_out.is_open()) return;
+	if (_written == _n_waveforms)
+	{
+		std::cout << "Scan file: more waveforms than points in the scan, ignored" << std::endl;
+		return;
+	}
+	_out.write((const char *) samples, _n_samples*sizeof(double));
+	_written++;
+}
+
+bool ScanFileWriter::is_open()
+{
+	return _out.is_open();
+}
+
+/*
+ * Writes the buffered data and closes the file
+ */
+void ScanFileWriter::close()
+{
+	if (!_out.is_open()) return;
+	if (_written != _n_waveforms) std::cout << "Scan file: closed with " << _written << " of " << _n_waveforms << " waveforms" << std::endl;
+	_out.close();
+}
+
+/*
+ ********************** DESTRUCTOR OF THE CLASS SCAN FILE WRITER **************************
+ */
+ScanFileWriter::~ScanFileWriter()
+{
+	close();
+}
+
+/*
+ ********************** CONSTRUCTOR OF THE CLASS SCAN FILE READER **************************
+ */
+ScanFileReader::ScanFileReader() :
+	_fd(-1),
+	_map(NULL),
+	_size(0),
+	_voltages(NULL),
+	_y(NULL),
+	_z(NULL),
+	_data(NULL),
+	_n_waveforms(0)
+{
+	std::memset(&_header, 0, sizeof(_header));
+}
+
+/*
+ * Maps filename (read only) and checks its header. Returns false if it is
+ * not a scan file
+ */
+bool ScanFileReader::open(std::string filename)
+{
+	close();
+
+	_fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat st;
+	if (_fd < 0 || fstat(_fd, &st) != 0)
+	{
+		std::cout << "File " << filename << " could not be open" << std::endl;
+		close();
+		return false;
+	}
+	_size = st.st_size;
+	if (_size < sizeof(ScanFileHeader))
+	{
+		std::cout << "File " << filename << " is not a TRACS scan file" << std::endl;
+		close();
+		return false;
+	}
+	void *map = mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+	if (map == MAP_FAILED)
+	{
+		std::cout << "File " << filename << " could not be mapped" << std::endl;
+		_map = NULL;
+		close();
+		return false;
+	}
+	_map = (const char *) map;
+
+	std::memcpy(&_header, _map, sizeof(_header));
+	uint64_t n_axis = (uint64_t) _header.n_voltages + _header.n_y + _header.n_z;
+	uint64_t end = sizeof(_header) + n_axis*sizeof(double) + (uint64_t) _header.n_channels*CHANNEL_NAME_SIZE + _header.text_size;
+	if (std::memcmp(_header.magic, SCAN_MAGIC, sizeof(SCAN_MAGIC)) != 0 || _header.version != SCAN_VERSION
+		|| _header.data_offset < end || _header.data_offset > _size || _header.data_offset % sizeof(double) != 0)
+	{
+		std::cout << "File " << filename << " is not a TRACS scan file (version " << SCAN_VERSION << ")" << std::endl;
+		close();
+		return false;
+	}
+
+	_voltages = (const double *) (_map + sizeof(_header));
+	_y = _voltages + _header.n_voltages;
+	_z = _y + _header.n_y;
+	_data = (const double *) (_map + _header.data_offset);
+
+	uint64_t n_total = (uint64_t) _header.n_voltages*_header.n_y*_header.n_z*_header.n_channels;
+	_n_waveforms = 0;
+	if (_header.n_samples > 0) _n_waveforms = (_size - _header.data_offset)/(_header.n_samples*sizeof(double));
+	if (_n_waveforms > n_total) _n_waveforms = n_total;
+	return true;
+}
+
+/*
+ * Unmaps the file
+ */
+void ScanFileReader::close()
+{
+	if (_map) munmap((void *) _map, _size);
+	if (_fd >= 0) ::close(_fd);
+	_fd = -1;
+	_map = NULL;
+	_size = 0;
+	_voltages = _y = _z = _data = NULL;
+	_n_waveforms = 0;
+	std::memset(&_header, 0, sizeof(_header));
+}
+
+bool ScanFileReader::is_open()
+{
+	return _map != NULL;
+}
+
+/*
+ * Getters
+ */
+int ScanFileReader::get_n_voltages()
+{
+	return _header.n_voltages;
+}
+
+int ScanFileReader::get_n_y()
+{
+	return _header.n_y;
+}
+
+int ScanFileReader::get_n_z()
+{
+	return _header.n_z;
+}
+
+int ScanFileReader::get_n_channels()
+{
+	return _header.n_channels;
+}
+
+int ScanFileReader::get_n_samples()
+{
+	return _header.n_samples;
+}
+
+double ScanFileReader::get_dt()
+{
+	return _header.dt;
+}
+
+double ScanFileReader::get_t0()
+{
+	return _header.t0;
+}
+
+double ScanFileReader::get_temperature()
+{
+	return _header.temperature;
+}
+
+double ScanFileReader::get_voltage(int v)
+{
+	return _voltages[v];
+}
+
+double ScanFileReader::get_y(int y)
+{
+	return _y[y];
+}
+
+double ScanFileReader::get_z(int z)
+{
+	return _z[z];
+}
+
+std::string ScanFileReader::get_channel_name(int channel)
+{
+	const char *name = (const char *) (_z + _header.n_z) + channel*CHANNEL_NAME_SIZE;
+	return std::string(name, strnlen(name, CHANNEL_NAME_SIZE));
+}
+
+/*
+ * Index of the channel called name, -1 if there is none
+ */
+int ScanFileReader::find_channel(std::string name)
+{
+	for (int i = 0; i < get_n_channels(); i++)
+	{
+		if (get_channel_name(i) == name) return i;
+	}
+	return -1;
+}
+
+/*
+ * Header of the equivalent .hetct file
+ */
+std::string ScanFileReader::get_text()
+{
+	if (!_map) return "";
+	const char *text = (const char *) (_z + _header.n_z) + _header.n_channels*CHANNEL_NAME_SIZE;
+	return std::string(text, _header.text_size);
+}
+
+/*
+ * False if the scan was interrupted before all the waveforms were written
+ */
+bool ScanFileReader::is_complete()
+{
+	return _n_waveforms == (uint64_t) _header.n_voltages*_header.n_y*_header.n_z*_header.n_channels;
+}
+
+/*
+ * The n_samples values of one waveform, directly from the mapped file. NULL if
+ * out of range or not written
+ */
+const double * ScanFileReader::get_waveform(int v, int y, int z, int channel)
+{
+	if (v < 0 || y < 0 || z < 0 || channel < 0 || v >= get_n_voltages() || y >= get_n_y() || z >= get_n_z() || channel >= get_n_channels()) return NULL;
+	uint64_t index = (((uint64_t) v*_header.n_y + y)*_header.n_z + z)*_header.n_channels + channel;
+	if (index >= _n_waveforms) return NULL;
+	return _data + index*_header.n_samples;
+}
+
+/*
+ * Converts one channel to the legacy .hetct text format (same header and rows
+ * as the files written directly by TRACS)
+ */
+bool ScanFileReader::write_hetct(std::string filename, int channel)
+{
+	if (!_map || channel < 0 || channel >= get_n_channels()) return false;
+
+	std::ofstream header(filename);
+	if (!header.is_open())
+	{
+		std::cout << "File could not be created" << std::endl;
+		return false;
+	}
+	header << get_text();
+	header.close();
+
+	ResultWriter results;
+	for (int v = 0; v < get_n_voltages(); v++)
+	{
+		for (int y = 0; y < get_n_y(); y++)
+		{
+			for (int z = 0; z < get_n_z(); z++)
+			{
+				const double *samples = get_waveform(v, y, z, channel);
+				if (!samples)
+				{
+					std::cout << "Scan file is incomplete, only the points simulated were converted" << std::endl;
+					return true;
+				}
+				results.write_row(filename, samples, get_n_samples(), get_temperature(), get_y(y), get_z(z), get_voltage(v));
+			}
+		}
+	}
+	results.close();
+	return true;
+}
+
+/*
+ ********************** DESTRUCTOR OF THE CLASS SCAN FILE READER **************************
+ */
+ScanFileReader::~ScanFileReader()
+{
+	close();
+}
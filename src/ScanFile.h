@@ -0,0 +1,109 @@
+#ifndef SCANFILE_H
+#define SCANFILE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+
+/*
+ ***********************************SCAN FILE***********************************
+ *
+ * Binary, self-describing output of a whole scan (.tscan). Layout (native
+ * byte order, i.e. little endian on every machine TRACS runs on):
+ *
+ *   ScanFileHeader                       fixed size block, see below
+ *   double voltages[n_voltages]          in V
+ *   double y[n_y], z[n_z]                in micrometers
+ *   char   channels[n_channels][32]      channel names, 0 terminated
+ *   char   text[text_size]               header of the equivalent .hetct file
+ *   zero padding up to data_offset       (multiple of 4096)
+ *   double data[n_voltages][n_y][n_z][n_channels][n_samples]
+ *
+ * Sample j of every waveform is at time t0 + j*dt (seconds). The data block
+ * is page aligned, so a reader can map the file and use the waveforms in
+ * place. Waveforms are written in the order of the data block: a file whose
+ * scan was interrupted is still readable, with the points written so far.
+ *
+ * ScanFileWriter writes the file sequentially, ScanFileReader maps it
+ * (read only) and converts it back to the .hetct text format.
+ *
+ */
+
+struct ScanFileHeader
+{
+  char magic[8];        // "TRACSSCN"
+  uint32_t version;
+  uint32_t n_channels;
+  uint32_t n_voltages;
+  uint32_t n_y;
+  uint32_t n_z;
+  uint32_t n_samples;
+  double dt;
+  double t0;
+  double temperature;   // in K
+  uint64_t text_size;
+  uint64_t data_offset;
+};
+
+class ScanFileWriter
+{
+  private:
+    std::ofstream _out;
+    std::vector<char> _buffer; // stream buffer
+    uint64_t _n_samples;
+    uint64_t _n_waveforms;     // expected
+    uint64_t _written;
+
+  public:
+    ScanFileWriter();
+    ~ScanFileWriter();
+
+    bool open(std::string filename, std::string text, std::vector<double> voltages, std::vector<double> y, std::vector<double> z, std::vector<std::string> channels, int n_samples, double dt, double t0, double temperature);
+    void write_waveform(const double *samples);
+    bool is_open();
+    void close();
+};
+
+class ScanFileReader
+{
+  private:
+    int _fd;
+    const char *_map;
+    size_t _size;
+    ScanFileHeader _header;
+    const double *_voltages;
+    const double *_y;
+    const double *_z;
+    const double *_data;
+    uint64_t _n_waveforms;     // complete waveforms in the file
+
+  public:
+    ScanFileReader();
+    ~ScanFileReader();
+
+    bool open(std::string filename);
+    void close();
+    bool is_open();
+
+    int get_n_voltages();
+    int get_n_y();
+    int get_n_z();
+    int get_n_channels();
+    int get_n_samples();
+    double get_dt();
+    double get_t0();
+    double get_temperature();
+    double get_voltage(int v);
+    double get_y(int y);
+    double get_z(int z);
+    std::string get_channel_name(int channel);
+    int find_channel(std::string name);
+    std::string get_text();
+    bool is_complete();
+
+    const double * get_waveform(int v, int y, int z, int channel = 0);
+    bool write_hetct(std::string filename, int channel = 0);
+};
+
+#endif // SCANFILE_H
@@ -0,0 +1,154 @@
+#include "ScanTree.h"
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <TNamed.h>
+#include <TParameter.h>
+#include <TList.h>
+
+/*
+ ********************** CONSTRUCTOR OF THE CLASS SCAN TREE **************************
+ */
+ScanTree::ScanTree() :
+	_file(NULL),
+	_tree(NULL),
+	_dt(0.),
+	_voltage(0.),
+	_y(0.),
+	_z(0.),
+	_temperature(0.)
+{
+}
+
+/*
+ * Adds a waveform of n_samples (first one at time t0) to every entry. Only
+ * before open()
+ */
+void ScanTree::add_stage(std::string name, int n_samples, double t0)
+{
+	if (_tree)
+	{
+		std::cout << "ScanTree: stage " << name << " added after open(), ignored" << std::endl;
+		return;
+	}
+	Stage stage;
+	stage.name = name;
+	stage.n_samples = n_samples;
+	stage.t0 = t0;
+	stage.values.assign(n_samples, 0.);
+	stage.charge = stage.amplitude = stage.t_amplitude = 0.;
+	_stages.push_back(stage);
+}
+
+/*
+ * Creates filename with the tree. compression is the ROOT setting
+ * (100*algorithm + level, e.g. 101 zlib level 1, 404 LZ4 level 4)
+ */
+bool ScanTree::open(std::string filename, double dt, std::string header, int compression, long autosave_bytes)
+{
+	close();
+
+	_file = new TFile(filename.c_str(), "RECREATE", "TRACS scan", compression);
+	if (_file->IsZombie())
+	{
+		std::cout << "File " << filename << " could not be created" << std::endl;
+		delete _file;
+		_file = NULL;
+		return false;
+	}
+	_dt = dt;
+
+	_tree = new TTree("tracs", "TRACS scan");
+	_tree->SetDirectory(_file);
+	_tree->Branch("V", &_voltage, "V/D");
+	_tree->Branch("y", &_y, "y/D");
+	_tree->Branch("z", &_z, "z/D");
+	_tree->Branch("T", &_temperature, "T/D");
+	for (unsigned int i = 0; i < _stages.size(); i++)
+	{
+		Stage &stage = _stages[i];
+		// Room for about 64 entries per basket
+		int basket = std::min(std::max(64*stage.n_samples*(int) sizeof(double), 32000), 4000000);
+		std::string leaf = stage.name + "[" + std::to_string(stage.n_samples) + "]/D";
+		_tree->Branch(stage.name.c_str(), stage.values.data(), leaf.c_str(), basket);
+		_tree->Branch((stage.name+"_charge").c_str(), &stage.charge, (stage.name+"_charge/D").c_str());
+		_tree->Branch((stage.name+"_amplitude").c_str(), &stage.amplitude, (stage.name+"_amplitude/D").c_str());
+		_tree->Branch((stage.name+"_tamplitude").c_str(), &stage.t_amplitude, (stage.name+"_tamplitude/D").c_str());
+		_tree->GetUserInfo()->Add(new TParameter<double>((stage.name+"_t0").c_str(), stage.t0));
+	}
+	_tree->GetUserInfo()->Add(new TParameter<double>("dt", dt));
+	_tree->SetAutoSave(-autosave_bytes);
+	_tree->SetAutoFlush(-autosave_bytes/4);
+
+	if (!header.empty())
+	{
+		_file->cd();
+		TNamed text("header", header.c_str());
+		text.Write();
+	}
+	return true;
+}
+
+/*
+ * Adds one entry. waveforms has one array per stage, in the order they were
+ * added
+ */
+void ScanTree::fill(double voltage, double y, double z, double temperature, const std::vector<const double *> &waveforms)
+{
+	if (!_tree) return;
+	if (waveforms.size() != _stages.size())
+	{
+		std::cout << "ScanTree: " << waveforms.size() << " waveforms for " << _stages.size() << " stages, entry skipped" << std::endl;
+		return;
+	}
+	_voltage = voltage;
+	_y = y;
+	_z = z;
+	_temperature = temperature;
+	for (unsigned int i = 0; i < _stages.size(); i++)
+	{
+		Stage &stage = _stages[i];
+		const double *in = waveforms[i];
+		double sum = 0.;
+		int j_max = 0;
+		for (int j = 0; j < stage.n_samples; j++)
+		{
+			stage.values[j] = in[j];
+			sum += in[j];
+			if (std::fabs(in[j]) > std::fabs(in[j_max])) j_max = j;
+		}
+		stage.charge = sum*_dt;
+		stage.amplitude = stage.n_samples > 0 ? in[j_max] : 0.;
+		stage.t_amplitude = stage.t0 + j_max*_dt;
+	}
+	_tree->Fill();
+}
+
+bool ScanTree::is_open()
+{
+	return _tree != NULL;
+}
+
+/*
+ * Writes the tree and closes the file
+ */
+void ScanTree::close()
+{
+	if (!_file) return;
+	_file->cd();
+	_tree->Write("", TObject::kOverwrite);
+	_file->Close();
+	delete _file; // owns the tree
+	_file = NULL;
+	_tree = NULL;
+}
+
+/*
+ ********************** DESTRUCTOR OF THE CLASS SCAN TREE **************************
+ */
+ScanTree::~ScanTree()
+{
+	close();
+}
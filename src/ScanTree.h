@@ -0,0 +1,69 @@
+#ifndef SCANTREE_H
+#define SCANTREE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <TFile.h>
+#include <TTree.h>
+
+/*
+ ***********************************SCAN TREE***********************************
+ *
+ * ROOT output of a whole run: one compressed TTree ("tracs") with one entry
+ * per scan point. Branches:
+ *
+ *  - V, y, z, T               bias (V), position (um), temperature (K)
+ *  - <stage>[n]               waveform of every processing stage added with
+ *                             add_stage() (e.g. i_ramo, i_conv, i_shaped)
+ *  - <stage>_charge           integral of the waveform (sum*dt)
+ *  - <stage>_amplitude        value of the sample with the largest |I|
+ *  - <stage>_tamplitude       time of that sample
+ *
+ * The time step and the time of the first sample of every stage are stored
+ * in the user info of the tree (TParameter "dt" and "<stage>_t0"), the text
+ * of the .hetct header as a TNamed "header".
+ *
+ * Waveforms are fixed size arrays, so no dictionaries are needed to read the
+ * file. Baskets hold several entries (sequential writes, better compression)
+ * and the tree is autosaved, so a file of an interrupted run can be read up
+ * to its last autosave.
+ *
+ */
+
+class ScanTree
+{
+  private:
+    struct Stage
+    {
+      std::string name;
+      int n_samples;
+      double t0;
+      std::vector<double> values;
+      double charge;
+      double amplitude;
+      double t_amplitude;
+    };
+
+    TFile *_file;
+    TTree *_tree;
+    std::deque<Stage> _stages; // branch addresses must not move
+    double _dt;
+    double _voltage;
+    double _y;
+    double _z;
+    double _temperature;
+
+  public:
+    ScanTree();
+    ~ScanTree();
+
+    void add_stage(std::string name, int n_samples, double t0);
+    bool open(std::string filename, double dt, std::string header = "", int compression = 101, long autosave_bytes = 32000000);
+    void fill(double voltage, double y, double z, double temperature, const std::vector<const double *> &waveforms);
+    bool is_open();
+    void close();
+};
+
+#endif // SCANTREE_H
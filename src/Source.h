@@ -146,3 +146,54 @@
 	}
 
  };
+
+/*
+ * DERIVATIVE OF THE SOURCE TERM
+ *
+ * Derivative of the source term above with respect to one of its 8 parameters
+ * (0-3: y0..y3, 4-7: z0..z3), as a central difference with step h. The source
+ * is linear in y0..y3, so these derivatives are exact for any step. The tanh
+ * bridges at the zX are much sharper than the mesh: for those the step has to
+ * be about one cell, so that the quadrature sees the zone boundary move.
+ */
+ class SourceSensitivity : public Expression
+ {
+ public:
+
+	Source plus;
+	Source minus;
+	double h;
+
+	SourceSensitivity(std::string Neff_type, const std::vector<double> &neff_param, int param, double step) : h(step)
+	{
+		set(plus, Neff_type, neff_param, param, +h);
+		set(minus, Neff_type, neff_param, param, -h);
+	}
+
+	void eval(Array<double>& values, const Array<double>& x) const
+	{
+		double value_plus = 0., value_minus = 0.;
+		Array<double> wrap_plus(1, &value_plus);
+		Array<double> wrap_minus(1, &value_minus);
+		plus.eval(wrap_plus, x);
+		minus.eval(wrap_minus, x);
+		values[0] = (value_plus - value_minus)/(2.*h);
+	}
+
+ private:
+
+	static void set(Source &f, std::string Neff_type, std::vector<double> p, int param, double shift)
+	{
+		p[param] += shift;
+		f.set_NeffApproach(Neff_type);
+		f.set_y0(p[0]);
+		f.set_y1(p[1]);
+		f.set_y2(p[2]);
+		f.set_y3(p[3]);
+		f.set_z0(p[4]);
+		f.set_z1(p[5]);
+		f.set_z2(p[6]);
+		f.set_z3(p[7]);
+	}
+
+ };
@@ -1,4 +1,5 @@
 #include "TRACSInterface.h"
+#include "Profiler.h"
 #include <mutex>          // std::mutex
 /*
  * Constructor of class TRACSInterface
@@ -10,10 +11,18 @@
  * functionalities with their own code and use TRACS as a library for 
  * silicon detectors simulation.
  *
+ * If sharedFields is given, no detector or carrier collection is built: 
+ * the ones from sharedFields (solved once, read-only) are used and this 
+ * object only keeps its own scan state and currents. All interfaces 
+ * sharing fields must be created before any of them calls loop_on.
+ *
  */
- std::mutex mtx2;           // mutex for critical section
 //extern const int num_threads;
-TRACSInterface::TRACSInterface(std::string filename)
+TRACSInterface::TRACSInterface(std::string filename, TRACSInterface * sharedFields) :
+	fieldOwner(sharedFields ? sharedFields : this),
+	fieldUsers(1),
+	fieldWaiting(0),
+	fieldGeneration(0)
 {
 	neff_param = std::vector<double>(8,0);
 	//utilities::parse_config_file(filename, carrierFile, depth, width, pitch, nns, temp, trapping, fluence, n_cells_x, n_cells_y, bulk_type, implant_type, C, dt, max_time, vBias, vDepletion, zPos, yPos, neff_param, neffType);
@@ -59,7 +68,19 @@ TRACSInterface::TRACSInterface(std::string filename)
 
 	parameters["allow_extrapolation"] = true;
 
-	detector = new SMSDetector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
+	if (fieldOwner == this)
+	{
+		detector = new SMSDetector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
+		double trapping_e = trapping, trapping_h = trapping; // electrons and holes may have their own
+		utilities::get_trapping_times(filename, trapping, trapping_e, trapping_h);
+		detector->set_trapping_time(trapping_e, trapping_h);
+	}
+	else
+	{
+		detector = fieldOwner->detector;
+		std::lock_guard<std::mutex> lock(fieldOwner->fieldMtx);
+		fieldOwner->fieldUsers++;
+	}
 	//SMSDetector detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
 	//detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
 	//detector = new SMSDetector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType):
@@ -67,9 +88,46 @@ TRACSInterface::TRACSInterface(std::string filename)
 
 	n_tSteps = (int) std::floor(max_time / dt);
 
-	carrierCollection = new CarrierCollection(detector);
-	QString carrierFileName = QString::fromUtf8(carrierFile.c_str());
-	carrierCollection->add_carriers_from_file(carrierFileName);
+	if (fieldOwner == this)
+	{
+		carrierCollection = new CarrierCollection(detector);
+		QString carrierFileName = QString::fromUtf8(carrierFile.c_str());
+		Profiler::Scope scope(Profiler::CARRIER_READ);
+		carrierCollection->add_carriers_from_file(carrierFileName);
+	}
+	else
+	{
+		carrierCollection = fieldOwner->carrierCollection;
+	}
+
+	// Optional: threads drifting the carriers of a single point. Interfaces 
+	// sharing fields also share the pool of the owner
+	carrierPool = NULL;
+	if (fieldOwner == this)
+	{
+		std::string carrierThreads = "1";
+		utilities::get_config_value(filename, "CarrierThreads", carrierThreads);
+		if (carrierThreads.find_first_not_of("0123456789") != std::string::npos)
+		{
+			std::cout << "Invalid CarrierThreads = " << carrierThreads << ", using 1" << std::endl;
+			carrierThreads = "1";
+		}
+		set_carrierThreads(std::atoi(carrierThreads.c_str()));
+	}
+	else
+	{
+		carrierPool = fieldOwner->carrierPool;
+	}
+
+	// Optional: how the induced current is obtained (defaults to the weighting field)
+	ramoCurrent = "Field";
+	utilities::get_config_value(filename, "RamoCurrent", ramoCurrent);
+	set_ramoCurrent(ramoCurrent);
+
+	// Optional: compression of the ROOT tree written by write_to_file
+	std::string compression = "101";
+	utilities::get_config_value(filename, "RootCompression", compression);
+	rootCompression = std::atoi(compression.c_str());
 
 	//currents
 	i_elec.resize((size_t) n_tSteps);
@@ -219,13 +277,11 @@ TH1D * TRACSInterface::GetItRc()
 		htit.Form("ramo_rc%d%d", tcount, count2);
 		hname.Form("Ramo_current_%d_%d", tcount, count2);
 		i_rc    = new TH1D(htit,hname,n_tSteps, 0.0, max_time);
-		std::valarray<double> i_shaped ((size_t) n_tSteps);	
-		double RC = 50.*C; // Ohms*Farad
-		double alfa = dt/(RC+dt);
+		std::vector<double> i_shaped(n_tSteps);
+		shape_rc(i_shaped.data());
 
-		for (int j = 1; j <n_tSteps; j++) 
+		for (int j = 0; j <n_tSteps; j++) 
 		{
-			i_shaped[j]=i_shaped[j-1]+alfa*(i_total[j]-i_shaped[j-1]);
 			i_rc->SetBinContent(j+1, i_shaped[j]);
 		}
 		count2++;
@@ -234,6 +290,39 @@ TH1D * TRACSInterface::GetItRc()
 		return i_rc;
 }
 
+/*
+ * i_total after a RC circuit (R = 50 Ohm, C from the config), n_tSteps values 
+ */
+void TRACSInterface::shape_rc(double *out)
+{
+	Profiler::Scope scope(Profiler::SHAPING);
+	ElectronicsChain rc;
+	rc.add_rc(50.*C); // Ohms*Farad
+	std::vector< std::valarray<double> > i_shaped(1, i_total);
+	rc.process(i_shaped, dt);
+	for (int j = 0; j < n_tSteps; j++) out[j] = i_shaped[0][j];
+}
+
+/*
+ * i_total convoluted with the amplifier transfer function, 2*n_tSteps values
+ * (same as H1DConvolution). Thread safe.
+ */
+void TRACSInterface::convolve_tf(double *out)
+{
+	Profiler::Scope scope(Profiler::CONVOLUTION);
+	TransferFunction::get_default()->convolve(&i_total[0], n_tSteps, max_time/n_tSteps, out);
+}
+
+/*
+ * Index of the current point (voltage, y and z of thread tid) in the 
+ * waveform stores
+ */
+int TRACSInterface::point_index(int tid)
+{
+	int z = tid + params[0]*num_threads; // z points are distributed round robin
+	return (params[2]*(n_ySteps+1) + params[1])*(n_zSteps+1) + z;
+}
+
 /*
  * Convert i_total to TH1D after convolution with the amplifier TransferFunction
  */
@@ -244,16 +333,9 @@ TH1D * TRACSInterface::GetItConv()
 	}
 	else
 	{
-		//TF1 *f1 = new TF1("f1","abs(sin(x)/x)*sqrt(x)",0,10);
-   		//float r = f1->GetRandom();
-		TString htit, hname;
-		htit.Form("ramo_conv_%d_%d", tcount, count3);
-		hname.Form("Ramo current_%d_%d", tcount, count3);
-		i_conv  = new TH1D(htit,hname,n_tSteps, 0.0, max_time);
+		// Thread safe: transfer function and its spectrum are cached
 		i_ramo = GetItRamo();
-		//mtx2.lock();
 		i_conv = H1DConvolution( i_ramo , C*1.e12, tcount );
-		//mtx2.unlock();
 		count3++;
 	}
 		return i_conv;
@@ -266,6 +348,7 @@ TH1D * TRACSInterface::GetItConv()
  */
 void TRACSInterface::simulate_ramo_current()
 {
+	Profiler::Scope scope(Profiler::DRIFT);
 	i_rc = NULL;
 	i_ramo = NULL;
 	i_conv = NULL;
@@ -273,7 +356,7 @@ void TRACSInterface::simulate_ramo_current()
 	i_elec = 0;
 	i_total = 0;
 
-	carrierCollection->simulate_drift( dt, max_time, yPos, zPos, i_elec, i_hole);
+	carrierCollection->simulate_drift( dt, max_time, yPos, zPos, i_elec, i_hole, carrierPool);
 	i_total = i_elec + i_hole;
 }
 
@@ -374,12 +457,14 @@ void TRACSInterface::set_vBias(double newVBias)
  */
 void TRACSInterface::calculate_fields()
 {
+	Profiler::Scope scope(Profiler::FIELD_SOLVE);
 	// Get detector ready
 	//SMSDetector detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
 	//pDetector = &detector;
 	detector->solve_w_u();
 	detector->solve_d_u();
-	detector->solve_w_f_grad();
+	// Weighting field only needed when the current is computed as q*mu*(E.Ew)
+	if (ramoCurrent != "Potential") detector->solve_w_f_grad();
 	detector->solve_d_f_grad();
 	detector->get_mesh()->bounding_box_tree();
 	//detector->solve_d_f_grad();
@@ -409,10 +494,41 @@ void TRACSInterface::set_neffType(std::string newParametrization)
 void TRACSInterface::set_carrierFile(std::string newCarrFile)
 {
 	QString carrierFileName = QString::fromUtf8(newCarrFile.c_str());
+	Profiler::Scope scope(Profiler::CARRIER_READ);
 	carrierCollection->add_carriers_from_file(carrierFileName);
 }
 
 
+/*
+ * Selects how the Ramo current is calculated. "Field" (default) uses 
+ * q*mu*(E.Ew) at the beginning of every time step, "Potential" uses the 
+ * difference of the weighting potential between both ends of the step, 
+ * which conserves the induced charge for any time step and does not need 
+ * the weighting field. Fields should be calculated again after changing it.
+ */
+void TRACSInterface::set_ramoCurrent(std::string newRamoCurrent)
+{
+	if (newRamoCurrent != "Field" && newRamoCurrent != "Potential")
+	{
+		std::cout << "Unknown RamoCurrent '" << newRamoCurrent << "', using Field" << std::endl;
+		newRamoCurrent = "Field";
+	}
+	ramoCurrent = newRamoCurrent;
+	carrierCollection->set_use_w_potential(ramoCurrent == "Potential");
+}
+
+/*
+ * Sets the number of threads used to drift the carriers of every single 
+ * point (0 for as many as cores). With 1 the carriers are drifted serially 
+ * in the calling thread. The result does not depend on this number.
+ */
+void TRACSInterface::set_carrierThreads(int nCarrierThreads)
+{
+	if (nCarrierThreads == 0) nCarrierThreads = std::thread::hardware_concurrency();
+	delete carrierPool;
+	carrierPool = (nCarrierThreads > 1) ? new ThreadPool(nCarrierThreads) : NULL;
+}
+
 /*
  * Returns the pointer
  * to the TRACS simulated tree 
@@ -440,26 +556,46 @@ void TRACSInterface::set_carrierFile(std::string newCarrFile)
 	 		 		//loop
 		 		 	for (params[2] = 0; params[2] < n_par2 + 1; params[2]++)
 		 			{
-		 	 			detector->set_voltages(voltages[params[2]], vDepletion);
-						calculate_fields();
+						// Only the owner of the fields solves them, the rest wait for it.
+						// Nobody drifts during the solve (DOLFIN/PETSc are not thread safe):
+						// every interface has passed the barrier at the end of the previous voltage
+						if (fieldOwner == this)
+						{
+		 	 				detector->set_voltages(voltages[params[2]], vDepletion);
+							if (params[2] == 0) calculate_fields();
+							else
+							{
+								Profiler::Scope scope(Profiler::FIELD_SOLVE);
+								detector->solve_d_u();
+								detector->solve_d_f_grad();
+							}
+						}
+						fieldOwner->sync_fields();
 
 						for (params[1] = 0; params[1] < n_par1 + 1; params[1]++)
 						{
 							set_yPos(y_shifts[params[1]]);
 							for (params[0] = 0; params[0] < n_par0 + 1; params[0]++)
 							{
-								std::cout << "Height " << z_shifts_array[tid][params[0]] << " of " << z_shifts.back()  <<  " || Y Position " << y_shifts[params[1]] << " of " << y_shifts.back() << " || Voltage " << voltages[params[2]] << " of " << voltages.back() << std::endl;								
 								set_zPos(z_shifts_array[tid][params[0]]);
-								simulate_ramo_current();
-								i_ramo = GetItRamo();
-								i_ramo_array[tid][params[0]] = i_ramo; // for output
-								i_ramo = NULL;
-								i_rc = GetItRc();
-								i_rc_array[tid][params[0]] = i_rc; // for output								
-								mtx2.lock();
-								i_conv = GetItConv();
-								i_conv_array[tid][params[0]] = i_conv; // for output
-								mtx2.unlock();
+								int point = point_index(tid);
+								// Points of a resumed run come from the checkpoint
+								const double *restored = checkpoint.get_waveform(point);
+								if (restored)
+								{
+									i_total = std::valarray<double>(restored, n_tSteps);
+									progress.skip();
+								}
+								else
+								{
+									simulate_ramo_current();
+									checkpoint.save(point, &i_total[0]);
+									progress.add();
+								}
+								// for output, no histograms needed
+								i_ramo_store.set_waveform(point, i_total);
+								shape_rc(i_rc_store.get_waveform(point));
+								convolve_tf(i_conv_store.get_waveform(point));
 								//write to file
 								//mtx2.lock();
 								//utilities::write_to_file_row(hetct_conv_filename, i_conv, detector->get_temperature(), y_shifts[params[1]], z_shifts_array[tid][params[0]], voltages[params[2]]);
@@ -475,6 +611,9 @@ void TRACSInterface::set_carrierFile(std::string newCarrFile)
 						//i_ramo->Write();
 						//i_rc->Write();
 						//tfile->Close();
+
+						// Fields must not change until every interface is done with them
+						fieldOwner->sync_fields();
 	 		 		}
  	
 	 		 	
@@ -489,6 +628,26 @@ void TRACSInterface::set_carrierFile(std::string newCarrFile)
 
  }
 
+ /*
+  * Barrier for all the interfaces sharing the fields of this one. Returns 
+  * once every one of them has called it. Trivial if fields are not shared.
+  */
+ void TRACSInterface::sync_fields()
+ {
+	std::unique_lock<std::mutex> lock(fieldMtx);
+	int generation = fieldGeneration;
+	if (++fieldWaiting == fieldUsers)
+	{
+		fieldWaiting = 0;
+		fieldGeneration++;
+		fieldCv.notify_all();
+	}
+	else
+	{
+		fieldCv.wait(lock, [&]{ return generation != fieldGeneration; });
+	}
+ }
+
  /*
   *
   * Write to file header. The input int is used to label files (multithreading)! 
@@ -522,22 +681,49 @@ void TRACSInterface::set_carrierFile(std::string newCarrFile)
 /*
  *Resizing for storing data in memory 
  *and using it later/writing to a single output file.
+ *One waveform per (voltage, y, z) point of the scan.
  *
 */
     void TRACSInterface::resize_array()
     {
-    	i_ramo_array.resize(num_threads);
-    	i_rc_array.resize(num_threads);
-    	i_conv_array.resize(num_threads);
-
-    	for (int i = 0; i < num_threads; i++)
-    		{
-    			i_ramo_array[i].resize(z_shifts_array[i].size());
-    			i_rc_array[i].resize(z_shifts_array[i].size());
-    			i_conv_array[i].resize(z_shifts_array[i].size());
-    			std::cout << "i_ramo_array[xlen][ylen]   " << i_ramo_array.size()<<"  " <<i_ramo_array[i].size() <<std::endl;
-    		}	
+    	int n_points = (n_vSteps+1)*(n_ySteps+1)*(n_zSteps+1);
+    	double bw = max_time/n_tSteps;
+    	i_ramo_store.resize(n_points, n_tSteps, 0.0, max_time);
+    	i_rc_store.resize(n_points, n_tSteps, 0.0, max_time);
+    	i_conv_store.resize(n_points, 2*n_tSteps, -n_tSteps*bw, n_tSteps*bw);
+    	std::cout << "Waveform stores: " << n_points << " points x " << n_tSteps << " samples" << std::endl;
+    }
+
+/*
+ * Opens the checkpoint of the scan (every point of the stores), next to the
+ * output files. With resume, the points found in it are not simulated again.
+ * CheckpointInterval (seconds) of config_filename sets how often it goes to
+ * disk, 0 disables it.
+ */
+    void TRACSInterface::open_checkpoint(std::string config_filename, bool resume)
+    {
+    	std::string interval = "60";
+    	utilities::get_config_value(config_filename, "CheckpointInterval", interval);
+    	double seconds = std::atof(interval.c_str());
+    	if (seconds <= 0)
+    	{
+    		if (resume) std::cout << "CheckpointInterval is 0, nothing to resume" << std::endl;
+    		return;
+    	}
+    	std::string filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+"_"+std::to_string(tcount)+".ckp";
+    	uint64_t key = Checkpoint::inputs_key(config_filename, carrierFile);
+    	checkpoint.open(filename, i_ramo_store.get_n_points(), n_tSteps, key, resume, seconds);
+    }
 
+/*
+ * Starts the progress report of the scan (every point of the stores), a line
+ * every ProgressInterval seconds of config_filename. Quiet or 0 print nothing.
+ */
+    void TRACSInterface::start_progress(std::string config_filename, bool quiet)
+    {
+    	std::string interval = "10";
+    	utilities::get_config_value(config_filename, "ProgressInterval", interval);
+    	progress.start(i_ramo_store.get_n_points(), quiet ? 0. : std::atof(interval.c_str()));
     }
 
 /*
@@ -547,8 +733,21 @@ void TRACSInterface::set_carrierFile(std::string newCarrFile)
  */
     void TRACSInterface::write_to_file(int tid)
     {
+    	Profiler::Scope scope(Profiler::WRITE);
     	write_header(tid);
     	std::cout << "Writing to file..." <<std::endl;
+    	ResultWriter results; // files stay open for the whole dump
+
+    	// Same points in a ROOT tree
+    	std::vector<double> z_chifs(z_shifts), y_chifs(y_shifts);
+    	for (unsigned int i = 0; i < z_chifs.size(); i++) z_chifs[i] /= 1000.;
+    	for (unsigned int i = 0; i < y_chifs.size(); i++) y_chifs[i] /= 1000.;
+    	std::string root_filename = hetct_noconv_filename.substr(0, hetct_noconv_filename.rfind("_noconv.hetct")) + ".root";
+    	ScanTree tree;
+    	tree.add_stage("i_ramo", i_ramo_store.get_n_samples(), i_ramo_store.get_t_min());
+    	tree.add_stage("i_conv", i_conv_store.get_n_samples(), i_conv_store.get_t_min());
+    	tree.add_stage("i_rc", i_rc_store.get_n_samples(), i_rc_store.get_t_min());
+    	tree.open(root_filename, max_time/n_tSteps, utilities::hetct_header(detector, C, dt, y_chifs, z_chifs, waveLength, scanType, carrierFile, voltages), rootCompression);
 
     		//n_par0 = (int) z_shifts_array[tid].size()-1;
     				params[0] = 0; //thread 
@@ -561,27 +760,17 @@ void TRACSInterface::set_carrierFile(std::string newCarrFile)
 		 			{
 						for (params[1] = 0; params[1] < n_par1 + 1; params[1]++)
 						{
-							for (int i = 0; i < num_threads; i++)
-							{							
-								for (params[0] = 0; params[0] < i_ramo_array[i].size(); params[0]++)
-								{
-									utilities::write_to_file_row(hetct_noconv_filename, i_ramo_array[i][params[0]], detector->get_temperature(), y_shifts[params[1]], z_shifts_array[i][params[0]], voltages[params[2]]);
-									utilities::write_to_file_row(hetct_conv_filename, i_conv_array[i][params[0]], detector->get_temperature(), y_shifts[params[1]], z_shifts_array[i][params[0]], voltages[params[2]]);
-									utilities::write_to_file_row(hetct_rc_filename, i_rc_array[i][params[0]], detector->get_temperature(), y_shifts[params[1]], z_shifts_array[i][params[0]], voltages[params[2]]);
-
-								}
-								
-
+							for (int z = 0; z < n_zSteps + 1; z++)
+							{
+								int point = (params[2]*(n_par1+1) + params[1])*(n_zSteps+1) + z;
+								results.write_row(hetct_noconv_filename, i_ramo_store.get_waveform(point), i_ramo_store.get_n_samples(), detector->get_temperature(), y_shifts[params[1]], z_shifts[z], voltages[params[2]]);
+								results.write_row(hetct_conv_filename, i_conv_store.get_waveform(point), i_conv_store.get_n_samples(), detector->get_temperature(), y_shifts[params[1]], z_shifts[z], voltages[params[2]]);
+								results.write_row(hetct_rc_filename, i_rc_store.get_waveform(point), i_rc_store.get_n_samples(), detector->get_temperature(), y_shifts[params[1]], z_shifts[z], voltages[params[2]]);
+								std::vector<const double *> waveforms = {i_ramo_store.get_waveform(point), i_conv_store.get_waveform(point), i_rc_store.get_waveform(point)};
+								tree.fill(voltages[params[2]], y_shifts[params[1]], z_shifts[z], detector->get_temperature(), waveforms);
 							}
 						}
-						//std::string root_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_"+voltage+"V_"+neigh+"nns_"+scanType+".root";
-						 // std::string hetct_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+".hetct";
-
-						// Open a ROOT file to save result
-						//TFile *tfile = new TFile(root_filename.c_str(), "RECREATE" );
-						//i_ramo->Write();
-						//i_rc->Write();
-						//tfile->Close();
 	 		 		}
+	 		 	tree.close();
 
     }
\ No newline at end of file
@@ -5,6 +5,12 @@
 #include "utilities.h"
 #include "Carrier.h"
 #include "CarrierCollection.h"
+#include "ThreadPool.h"
+#include "ResultWriter.h"
+#include "ElectronicsChain.h"
+#include "WaveformStore.h"
+#include "ScanTree.h"
+#include "Checkpoint.h"
 #include <TFile.h>
 #include "TF1.h"
 #include <TH1D.h> // 1 Dimesional ROOT histogram 
@@ -16,6 +22,8 @@
 #include <vector>
 #include "global.h"
 #include <stdlib.h>     /* exit, EXIT_FAILURE */
+#include <mutex>
+#include <condition_variable>
 
 
 using std::vector;
@@ -90,6 +98,8 @@ class TRACSInterface
 		std::string carrierFile;
 		std::string neffType;
 		std::string scanType;
+		std::string ramoCurrent; // "Field" (q*mu*E.Ew) or "Potential" (weighting potential differences)
+		int rootCompression; // ROOT compression setting of the output tree (RootCompression)
 
 		//file naming
 		std::string trap, start;
@@ -118,11 +128,27 @@ class TRACSInterface
 		SMSDetector * detector;
 		//SMSDetector * pDetector;
 		CarrierCollection * carrierCollection;
+		ThreadPool * carrierPool; // drifts the carriers of one point in parallel (NULL: serial)
+
+		// Field sharing between interfaces (multithreading). The owner solves 
+		// the fields, every interface using them waits in sync_fields() so that 
+		// nobody drifts carriers while the fields are being recalculated.
+		TRACSInterface * fieldOwner;
+		int fieldUsers;
+		int fieldWaiting;
+		int fieldGeneration;
+		std::mutex fieldMtx;
+		std::condition_variable fieldCv;
+
+		void sync_fields();
+		void shape_rc(double *out);
+		void convolve_tf(double *out);
+		int point_index(int tid);
 
 	public:
 
 		// Constructor
-		TRACSInterface(std::string filename); // Reads values, initializes detector
+		TRACSInterface(std::string filename, TRACSInterface * sharedFields = NULL); // Reads values, initializes detector
 
 		// Destructor
 		~TRACSInterface();
@@ -151,8 +177,12 @@ class TRACSInterface
 		void write_header(int tid = 0);
 		void resize_array();
 		void write_to_file(int tid = 0);
+		void open_checkpoint(std::string config_filename, bool resume = false);
+		void start_progress(std::string config_filename, bool quiet = false);
 		void set_neffType(std::string newParametrization);
 		void set_carrierFile(std::string newCarrFile);
+		void set_ramoCurrent(std::string newRamoCurrent);
+		void set_carrierThreads(int nCarrierThreads);
 
 		
 };
@@ -0,0 +1,170 @@
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+/*
+ * Constructor of the thread pool. Launches n_threads workers that live until
+ * the pool is destroyed. At least one worker is always created.
+ */
+ThreadPool::ThreadPool(int n_threads) :
+	_queued(0),
+	_pending(0),
+	_next_queue(0),
+	_stop(false)
+{
+	if (n_threads < 1) n_threads = 1;
+
+	for (int i = 0; i < n_threads; i++)
+	{
+		_queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+	}
+	for (int i = 0; i < n_threads; i++)
+	{
+		_workers.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+	}
+}
+
+/*
+ * Queues a task. Tasks are spread round-robin over the worker queues, idle
+ * workers will steal them anyway if the distribution is uneven.
+ */
+void ThreadPool::submit(std::function<void()> task)
+{
+	int id = _next_queue++ % _queues.size();
+	_pending++;
+	{
+		std::lock_guard<std::mutex> lock(_queues[id]->mtx);
+		_queues[id]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+		_queued++;
+	}
+	_cv_work.notify_one();
+}
+
+/*
+ * Blocks until all submitted tasks have been run. The calling thread runs
+ * queued tasks itself instead of sleeping while there are any left.
+ */
+void ThreadPool::wait()
+{
+	std::function<void()> task;
+	while (_pending > 0)
+	{
+		if (pop_task(0, task))
+		{
+			run_task(task);
+		}
+		else
+		{
+			std::unique_lock<std::mutex> lock(_mtx);
+			_cv_done.wait(lock, [this]{ return _pending == 0 || _queued > 0; });
+		}
+	}
+}
+
+/*
+ * Blocks until remaining reaches zero. Tasks of the batch are expected to 
+ * decrement it when they finish. Other tasks may be run meanwhile.
+ */
+void ThreadPool::wait(std::atomic<int> &remaining)
+{
+	std::function<void()> task;
+	while (remaining > 0)
+	{
+		if (pop_task(0, task))
+		{
+			run_task(task);
+		}
+		else
+		{
+			std::unique_lock<std::mutex> lock(_mtx);
+			_cv_done.wait(lock, [&]{ return remaining == 0 || _queued > 0; });
+		}
+	}
+}
+
+/*
+ * Getter for the number of worker threads
+ */
+int ThreadPool::get_n_threads()
+{
+	return _workers.size();
+}
+
+/*
+ * Takes a task from the back of the own queue or, if empty, steals one from
+ * the front of the queue of another worker. Returns false if no task found.
+ */
+bool ThreadPool::pop_task(int id, std::function<void()> &task)
+{
+	int n_queues = _queues.size();
+	for (int i = 0; i < n_queues; i++)
+	{
+		WorkQueue & queue = *_queues[(id + i) % n_queues];
+		std::lock_guard<std::mutex> lock(queue.mtx);
+		if (queue.tasks.empty()) continue;
+		if (i == 0)
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		_queued--;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Runs a task and wakes up the threads in wait() to check their condition
+ */
+void ThreadPool::run_task(std::function<void()> &task)
+{
+	task();
+	task = nullptr;
+	_pending--;
+	std::lock_guard<std::mutex> lock(_mtx);
+	_cv_done.notify_all();
+}
+
+/*
+ * Main loop of every worker: run tasks while there are any, sleep otherwise
+ */
+void ThreadPool::worker_loop(int id)
+{
+	std::function<void()> task;
+	Profiler::set_thread_name("pool" + std::to_string(id));
+	while (true)
+	{
+		if (pop_task(id, task))
+		{
+			run_task(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(_mtx);
+		_cv_work.wait(lock, [this]{ return _stop || _queued > 0; });
+		if (_stop && _queued == 0) return;
+	}
+}
+
+/*
+ ********************** DESTRUCTOR OF THE CLASS THREAD POOL **************************
+ * Remaining queued tasks are run before the workers exit.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+		_stop = true;
+	}
+	_cv_work.notify_all();
+	for (unsigned int i = 0; i < _workers.size(); i++)
+	{
+		_workers[i].join();
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/*
+ ***********************************THREAD POOL***********************************
+ *
+ * Persistent pool of worker threads. Threads are created once and reused for
+ * the whole simulation instead of being created and joined for every point.
+ *
+ * Every worker owns a task queue. Submitted tasks are distributed round-robin
+ * over the queues; a worker takes tasks from the back of its own queue and,
+ * when it runs out of work, steals from the front of the other queues. This
+ * way the load balances itself when some tasks finish early (e.g. carriers
+ * leaving the detector).
+ *
+ * wait() blocks until every submitted task has been run. wait(remaining) only
+ * blocks until a counter decremented by the tasks of one batch reaches zero, so
+ * several users can share one pool. The calling thread helps running queued 
+ * tasks while it waits.
+ *
+ */
+
+class ThreadPool
+{
+  private:
+    struct WorkQueue
+    {
+      std::mutex mtx;
+      std::deque< std::function<void()> > tasks;
+    };
+
+    std::vector<std::thread> _workers;
+    std::vector< std::unique_ptr<WorkQueue> > _queues;
+
+    std::mutex _mtx;
+    std::condition_variable _cv_work; // signaled when tasks are queued or on stop
+    std::condition_variable _cv_done; // signaled when all tasks are done
+    std::atomic<int> _queued;  // tasks waiting in a queue
+    std::atomic<int> _pending; // tasks submitted but not finished
+    std::atomic<unsigned int> _next_queue;
+    bool _stop;
+
+    bool pop_task(int id, std::function<void()> &task);
+    void run_task(std::function<void()> &task);
+    void worker_loop(int id);
+
+  public:
+    ThreadPool(int n_threads);
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+    void wait();
+    void wait(std::atomic<int> &remaining);
+    int get_n_threads();
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,224 @@
+#include "TransferFunction.h"
+
+#include <TFile.h>
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+/*
+ * Constructor: reads the transfer function from histogram histname of the
+ * ROOT file filename. The file is closed right after. time_unit is the unit
+ * of the time axis of the histogram in the units of the dt given to
+ * convolve() (default: table in ns, signals in seconds).
+ */
+TransferFunction::TransferFunction(std::string filename, std::string histname, double time_unit) :
+	_bin_width(time_unit),
+	_start(0.0)
+{
+	TFile *ftf = new TFile(filename.c_str());
+	TH1D *htf = ftf->IsZombie() ? NULL : (TH1D *) ftf->Get(histname.c_str());
+	if (htf)
+	{
+		read_table(htf, time_unit);
+	}
+	else
+	{
+		std::cout << "Transfer function " << histname << " could not be read from " << filename << ", convoluted currents will be zero" << std::endl;
+	}
+	ftf->Close();
+	delete ftf;
+}
+
+/*
+ * Constructor from an histogram already in memory (values are copied)
+ */
+TransferFunction::TransferFunction(TH1D *htf, double time_unit) :
+	_bin_width(time_unit),
+	_start(0.0)
+{
+	read_table(htf, time_unit);
+}
+
+/*
+ * Copies the bin contents and bin width of htf
+ */
+void TransferFunction::read_table(TH1D *htf, double time_unit)
+{
+	int n_bins = htf->GetNbinsX();
+	_samples.resize(n_bins);
+	for (int i = 1; i <= n_bins; i++)
+	{
+		_samples[i-1] = htf->GetBinContent(i);
+	}
+	if (n_bins > 1) _bin_width = (htf->GetBinCenter(2) - htf->GetBinCenter(1))*time_unit;
+	if (n_bins > 0) _start = htf->GetBinCenter(1)*time_unit;
+}
+
+/*
+ * Transfer function sampled every dt, starting at the first bin of the table.
+ * Values are scaled by dt/bin width, so for dt equal to the bin width the
+ * table is returned unchanged.
+ */
+std::vector<double> TransferFunction::resample(double dt)
+{
+	std::vector<double> result;
+	int n_table = _samples.size();
+	if (n_table == 0 || dt <= 0) return result;
+
+	// Same sampling up to rounding errors: take the table as it is
+	double ratio = dt/_bin_width;
+	if (std::fabs(ratio - 1.0) < 1e-6) ratio = 1.0;
+
+	int n_samples = (int) std::floor((n_table-1)/ratio + 1e-9) + 1;
+	result.resize(n_samples);
+	for (int k = 0; k < n_samples; k++)
+	{
+		double pos = k*ratio;
+		int idx = (int) std::floor(pos);
+		double frac = pos - idx;
+		if (idx >= n_table-1)
+		{
+			result[k] = ratio*_samples[n_table-1];
+		}
+		else
+		{
+			result[k] = ratio*((1.0-frac)*_samples[idx] + frac*_samples[idx+1]);
+		}
+	}
+	return result;
+}
+
+/*
+ * Returns the cached spectrum for signals of n samples every dt, computing it
+ * the first time it is needed
+ */
+std::shared_ptr<const TransferFunction::Spectrum> TransferFunction::get_spectrum(double dt, int n)
+{
+	std::pair<double, int> key(dt, n);
+	{
+		std::lock_guard<std::mutex> lock(_mtx);
+		auto it = _spectra.find(key);
+		if (it != _spectra.end()) return it->second;
+	}
+
+	// Computed outside the lock; if two threads race both results are equal
+	std::vector<double> tf = resample(dt);
+	std::shared_ptr<Spectrum> spectrum(new Spectrum);
+	// No wrap around for the linear convolution of n + tf.size() - 1 samples
+	int n_linear = n + std::max((int) tf.size(), 1) - 1;
+	spectrum->n_fft = 1;
+	while (spectrum->n_fft < n_linear) spectrum->n_fft *= 2;
+	spectrum->values.assign(spectrum->n_fft, std::complex<double>(0., 0.));
+	for (unsigned int i = 0; i < tf.size(); i++)
+	{
+		spectrum->values[i] = tf[i];
+	}
+	fft(spectrum->values, false);
+
+	std::lock_guard<std::mutex> lock(_mtx);
+	return _spectra.insert(std::make_pair(key, spectrum)).first->second;
+}
+
+/*
+ * Convolutes the n samples of in (every dt) with the transfer function.
+ * out must have room for 2*n samples. Thread safe.
+ */
+void TransferFunction::convolve(const double *in, int n, double dt, double *out)
+{
+	for (int i = 0; i < 2*n; i++) out[i] = 0.;
+	if (n <= 0 || _samples.empty()) return;
+
+	std::shared_ptr<const Spectrum> spectrum = get_spectrum(dt, n);
+	std::vector< std::complex<double> > signal(spectrum->n_fft, std::complex<double>(0., 0.));
+	for (int i = 0; i < n; i++)
+	{
+		signal[i] = in[i];
+	}
+	fft(signal, false);
+	for (int i = 0; i < spectrum->n_fft; i++)
+	{
+		signal[i] *= spectrum->values[i];
+	}
+	fft(signal, true);
+
+	int n_out = std::min(2*n, spectrum->n_fft);
+	for (int i = 0; i < n_out; i++)
+	{
+		out[i] = signal[i].real();
+	}
+}
+
+/*
+ * True if no transfer function could be read
+ */
+bool TransferFunction::is_empty()
+{
+	return _samples.empty();
+}
+
+/*
+ * Time of the first sample of the transfer function (negative for a centered
+ * one)
+ */
+double TransferFunction::get_start()
+{
+	return _start;
+}
+
+/*
+ * Transfer function of the amplifier used by H1DConvolution, read on first use
+ */
+TransferFunction * TransferFunction::get_default()
+{
+	static TransferFunction tf("Centered_100ps_TransferFunction_Cividec_06052014.root", "shtf", 1.e-9);
+	return &tf;
+}
+
+/*
+ * In place iterative radix-2 FFT. Size of data must be a power of 2. The
+ * inverse transform is normalised (divided by the size).
+ */
+void TransferFunction::fft(std::vector< std::complex<double> > &data, bool inverse)
+{
+	int n = data.size();
+	if (n < 2) return;
+
+	// Bit reversal permutation
+	for (int i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) std::swap(data[i], data[j]);
+	}
+
+	// Twiddle factors of the last stage, the other stages use every (n/len)-th
+	std::vector< std::complex<double> > roots(n/2);
+	double angle = 2*M_PI/n*(inverse ? 1 : -1);
+	for (int k = 0; k < n/2; k++)
+	{
+		roots[k] = std::complex<double>(std::cos(k*angle), std::sin(k*angle));
+	}
+
+	// Butterflies
+	for (int len = 2; len <= n; len <<= 1)
+	{
+		int stride = n/len;
+		for (int i = 0; i < n; i += len)
+		{
+			for (int j = 0; j < len/2; j++)
+			{
+				std::complex<double> u = data[i+j];
+				std::complex<double> v = data[i+j+len/2]*roots[j*stride];
+				data[i+j] = u + v;
+				data[i+j+len/2] = u - v;
+			}
+		}
+	}
+
+	if (inverse)
+	{
+		for (int i = 0; i < n; i++) data[i] /= n;
+	}
+}
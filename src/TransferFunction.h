@@ -0,0 +1,65 @@
+#ifndef TRANSFERFUNCTION_H
+#define TRANSFERFUNCTION_H
+
+#include <string>
+#include <vector>
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <TH1D.h>
+
+/*
+ *******************************TRANSFER FUNCTION*******************************
+ *
+ * Response of the readout electronics given as a tabulated transfer function
+ * (by default the Cividec amplifier in
+ * Centered_100ps_TransferFunction_Cividec_06052014.root).
+ *
+ * The table is read once. For every (dt, number of samples) used, it is
+ * resampled to dt (linear interpolation, scaled by dt/bin width so the
+ * discrete convolution keeps the normalisation of the table). The time axis
+ * of the table is converted with time_unit: the Cividec table is in ns while
+ * the currents of TRACS are binned in seconds. The FFT of the result is
+ * cached, so every convolution is one forward and one inverse FFT of the
+ * signal. convolve() works on plain arrays, keeps no state besides the
+ * cache and can be called from several threads at once.
+ *
+ * Output is the discrete linear convolution out[n] = sum_m in[m]*tf[n-m] for
+ * n = 0 ... 2N-1, same as the old bin by bin H1DConvolution.
+ *
+ */
+
+class TransferFunction
+{
+  private:
+    struct Spectrum
+    {
+      int n_fft;
+      std::vector< std::complex<double> > values;
+    };
+
+    std::vector<double> _samples; // table values
+    double _bin_width;            // table bin width (in units of dt)
+    double _start;                // time of the first table bin (in units of dt)
+    std::mutex _mtx;              // guards the cache
+    std::map< std::pair<double, int>, std::shared_ptr<const Spectrum> > _spectra;
+
+    void read_table(TH1D *htf, double time_unit);
+    std::shared_ptr<const Spectrum> get_spectrum(double dt, int n);
+
+  public:
+    TransferFunction(std::string filename, std::string histname = "shtf", double time_unit = 1.e-9);
+    TransferFunction(TH1D *htf, double time_unit = 1.0);
+
+    void convolve(const double *in, int n, double dt, double *out);
+    std::vector<double> resample(double dt);
+    bool is_empty();
+    double get_start();
+
+    static TransferFunction * get_default();
+    static void fft(std::vector< std::complex<double> > &data, bool inverse);
+};
+
+#endif // TRANSFERFUNCTION_H
@@ -0,0 +1,97 @@
+#include "WaveformStore.h"
+
+#include <algorithm>
+
+/*
+ * Constructor: n_points waveforms of n_samples, all set to zero
+ */
+WaveformStore::WaveformStore(int n_points, int n_samples, double t_min, double t_max) :
+	_n_points(0),
+	_n_samples(0),
+	_t_min(t_min),
+	_t_max(t_max)
+{
+	resize(n_points, n_samples, t_min, t_max);
+}
+
+/*
+ * Reallocates the store for n_points waveforms of n_samples in [t_min, t_max].
+ * All values are set to zero.
+ */
+void WaveformStore::resize(int n_points, int n_samples, double t_min, double t_max)
+{
+	_n_points = std::max(n_points, 0);
+	_n_samples = std::max(n_samples, 0);
+	_t_min = t_min;
+	_t_max = t_max;
+	_data.assign((size_t) _n_points*_n_samples, 0.);
+}
+
+/*
+ * Frees the memory of all the waveforms
+ */
+void WaveformStore::clear()
+{
+	_n_points = 0;
+	_n_samples = 0;
+	std::vector<double>().swap(_data);
+}
+
+/*
+ * Pointer to the n_samples values of a point (can be written)
+ */
+double * WaveformStore::get_waveform(int point)
+{
+	return &_data[(size_t) point*_n_samples];
+}
+
+/*
+ * Copies waveform into point (extra samples are ignored, missing ones are 0)
+ */
+void WaveformStore::set_waveform(int point, const std::valarray<double> &waveform)
+{
+	double *out = get_waveform(point);
+	int n = std::min((int) waveform.size(), _n_samples);
+	for (int j = 0; j < n; j++) out[j] = waveform[j];
+	for (int j = n; j < _n_samples; j++) out[j] = 0.;
+}
+
+/*
+ * Getters
+ */
+int WaveformStore::get_n_points()
+{
+	return _n_points;
+}
+
+int WaveformStore::get_n_samples()
+{
+	return _n_samples;
+}
+
+double WaveformStore::get_t_min()
+{
+	return _t_min;
+}
+
+double WaveformStore::get_t_max()
+{
+	return _t_max;
+}
+
+/*
+ * New histogram with the waveform of point. It is not attached to any ROOT
+ * directory: the caller owns (and must delete) it.
+ */
+TH1D * WaveformStore::export_histogram(int point, std::string name, std::string title)
+{
+	if (title.empty()) title = name;
+	TH1D *hist = new TH1D(name.c_str(), title.c_str(), _n_samples, _t_min, _t_max);
+	hist->SetDirectory(0);
+	const double *values = get_waveform(point);
+	for (int j = 0; j < _n_samples; j++)
+	{
+		hist->SetBinContent(j+1, values[j]);
+	}
+	return hist;
+}
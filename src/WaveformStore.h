@@ -0,0 +1,50 @@
+#ifndef WAVEFORMSTORE_H
+#define WAVEFORMSTORE_H
+
+#include <string>
+#include <vector>
+#include <valarray>
+
+#include <TH1D.h>
+
+/*
+ ********************************WAVEFORM STORE*********************************
+ *
+ * Currents of a whole scan in one contiguous (point x time) block owned by
+ * the store. Every point (e.g. one (V, y, z) of a scan) has n_samples values
+ * on a fixed time axis [t_min, t_max].
+ *
+ * Nothing is registered in ROOT: histograms are only created by
+ * export_histogram(), on demand, and belong to the caller.
+ *
+ * Different points may be written from different threads at the same time,
+ * resize() and clear() must not run concurrently with anything else.
+ *
+ */
+
+class WaveformStore
+{
+  private:
+    int _n_points;
+    int _n_samples;
+    double _t_min;
+    double _t_max;
+    std::vector<double> _data; // point p is _data[p*_n_samples ... (p+1)*_n_samples-1]
+
+  public:
+    WaveformStore(int n_points = 0, int n_samples = 0, double t_min = 0., double t_max = 1.);
+
+    void resize(int n_points, int n_samples, double t_min, double t_max);
+    void clear();
+
+    double * get_waveform(int point);
+    void set_waveform(int point, const std::valarray<double> &waveform);
+    int get_n_points();
+    int get_n_samples();
+    double get_t_min();
+    double get_t_max();
+
+    TH1D * export_histogram(int point, std::string name, std::string title = "");
+};
+
+#endif // WAVEFORMSTORE_H
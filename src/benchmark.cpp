@@ -0,0 +1,454 @@
+/*
+ ************************** TRACS BENCHMARK **************************
+ *
+ * Times the hot paths of the simulation with the inputs found in the
+ * working directory (Config.TRACS, its carrier file and the transfer
+ * function, i.e. the files in files2move2bin), so it runs offline from bin/:
+ *
+ *  - micro: mobility, field evaluation, one RK4 step, drift of one carrier
+ *  - carrier file parsing (text and binary)
+ *  - every SMSDetector::solve_*
+ *  - CarrierCollection::simulate_drift over the whole carrier file
+ *  - convolution with the transfer function (H1DConvolution and
+ *    TransferFunction::convolve)
+ *  - macro: a small scan (drift in the pool + convolution of every point)
+ *
+ * Every benchmark is repeated until it has run for --min-time seconds and
+ * at least 3 times. Results are printed and written as JSON (--output),
+ * times are per operation (one evaluation, one step, one carrier...).
+ *
+ * --scaling N runs the scaling benchmark instead: the drift of a scan (every
+ * point drifts the whole carrier file in the pool, as TRACS does) with 1, 2,
+ * 4... N threads. Strong scaling keeps --points points for every thread
+ * count, weak scaling simulates --points points per thread. For every run it
+ * reports the speedup and efficiency over 1 thread and the time the threads
+ * were idle (waiting for work while the run was not finished).
+ *
+ * Usage: ./TRACS-benchmark [--filter text] [--min-time seconds] [--output file.json]
+ *        ./TRACS-benchmark --scaling N [--points P] [--output file.json]
+ */
+
+#include "SMSDetector.h"
+#include "utilities.h"
+#include "Carrier.h"
+#include "CarrierCollection.h"
+#include "CarrierFile.h"
+#include "ThreadPool.h"
+#include "TransferFunction.h"
+
+#include <TH1D.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <random>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+
+extern TH1D *H1DConvolution( TH1D *htct, Double_t Cend=0. , int tid=0) ;
+
+struct BenchmarkResult
+{
+	std::string name;
+	std::string unit;     // what one operation is
+	long ops_per_call;
+	int samples;
+	double mean_ns;       // per operation
+	double min_ns;
+	double median_ns;
+};
+
+static volatile double sink = 0.; // keeps the compiler from dropping the work
+
+/*
+ * Times fn (ops_per_call operations per call) and adds the result
+ */
+static void run(std::vector<BenchmarkResult> &results, std::string filter, double min_time, std::string name, std::string unit, long ops_per_call, std::function<void()> fn)
+{
+	if (!filter.empty() && name.find(filter) == std::string::npos) return;
+	fn(); // warm up
+
+	std::vector<double> samples;
+	double total = 0.;
+	while (total < min_time || samples.size() < 3)
+	{
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		fn();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		samples.push_back(seconds*1.e9/ops_per_call);
+		total += seconds;
+	}
+
+	BenchmarkResult result;
+	result.name = name;
+	result.unit = unit;
+	result.ops_per_call = ops_per_call;
+	result.samples = samples.size();
+	result.mean_ns = 0.;
+	for (unsigned int i = 0; i < samples.size(); i++) result.mean_ns += samples[i]/samples.size();
+	std::sort(samples.begin(), samples.end());
+	result.min_ns = samples.front();
+	result.median_ns = samples[samples.size()/2];
+	results.push_back(result);
+
+	std::printf("%-28s %14.1f ns/%-8s (min %.1f, %d samples)\n", name.c_str(), result.median_ns, unit.c_str(), result.min_ns, result.samples);
+	std::fflush(stdout);
+}
+
+struct ScalingResult
+{
+	std::string type;  // strong/weak
+	int threads;
+	int points;
+	double seconds;
+	double speedup;    // over 1 thread (weak: same work per thread)
+	double efficiency;
+	double idle_mean;  // fraction of the run a thread was idle
+	double idle_max;
+};
+
+/*
+ * Drifts n_points points of the carrier file in a pool of n_threads, like the
+ * TRACS scan (collection split in 4 chunks per thread). Returns the wall time and the busy time
+ * of every worker that ran tasks. The caller sleeps until the last task is done instead of
+ * ThreadPool::wait(), that would run tasks on one more thread than measured
+ */
+static double run_scan(CarrierCollection &collection, int n_threads, int n_points, double dt, double max_time, double y_shift, double z_min, double z_step, std::vector<double> &busy)
+{
+	int nChunks = 4*n_threads;
+	int n_tSteps = (int) std::floor(max_time / dt);
+	std::vector< std::valarray<double> > vva_elec(n_points*nChunks, std::valarray<double>((size_t) n_tSteps));
+	std::vector< std::valarray<double> > vva_hole(n_points*nChunks, std::valarray<double>((size_t) n_tSteps));
+	std::mutex mtx;
+	std::condition_variable cv_done;
+	int remaining = n_points*nChunks;
+	std::map<std::thread::id, double> busy_by_thread;
+
+	ThreadPool pool(n_threads);
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < n_points; i++)
+	{
+		double z_shift = z_min + i*z_step;
+		for (int c = 0; c < nChunks; c++)
+		{
+			int task = i*nChunks + c;
+			pool.submit([=, &collection, &vva_elec, &vva_hole, &mtx, &cv_done, &remaining, &busy_by_thread]()
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				collection.simulate_drift(dt, max_time, y_shift, z_shift, vva_elec[task], vva_hole[task], c);
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				std::lock_guard<std::mutex> lock(mtx);
+				busy_by_thread[std::this_thread::get_id()] += seconds;
+				if (--remaining == 0) cv_done.notify_one();
+			});
+		}
+	}
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv_done.wait(lock, [&remaining]{ return remaining == 0; });
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	busy.clear();
+	for (std::map<std::thread::id, double>::iterator it = busy_by_thread.begin(); it != busy_by_thread.end(); ++it) busy.push_back(it->second);
+	return wall;
+}
+
+/*
+ * Strong and weak scaling of the scan drift from 1 to max_threads threads
+ */
+static int run_scaling(SMSDetector &detector, std::string file_carriers, int max_threads, int n_points, double dt, double max_time, double y_shift, std::string output)
+{
+	std::vector<int> thread_counts;
+	for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+	thread_counts.push_back(max_threads);
+
+	std::vector<ScalingResult> results;
+	std::printf("%-6s %8s %8s %10s %9s %11s %10s %10s\n", "type", "threads", "points", "time [s]", "speedup", "efficiency", "idle mean", "idle max");
+	for (int weak = 0; weak < 2; weak++)
+	{
+		double seconds_1 = 0.;
+		for (unsigned int n = 0; n < thread_counts.size(); n++)
+		{
+			int threads = thread_counts[n];
+			int points = weak ? n_points*threads : n_points;
+			double z_step = (detector.get_y_max() - detector.get_y_min())/points;
+			CarrierCollection collection(&detector);
+			collection.add_carriers_from_file(QString::fromUtf8(file_carriers.c_str()), 4*threads);
+			std::vector<double> busy;
+			double seconds = run_scan(collection, threads, points, dt, max_time, y_shift, detector.get_y_min() + 0.5*z_step, z_step, busy);
+			if (threads == 1) seconds_1 = seconds;
+
+			ScalingResult r;
+			r.type = weak ? "weak" : "strong";
+			r.threads = threads;
+			r.points = points;
+			r.seconds = seconds;
+			// Weak: the work grows with the threads, ideal time stays constant
+			r.speedup = (seconds > 0.) ? (weak ? threads*seconds_1/seconds : seconds_1/seconds) : 0.;
+			r.efficiency = r.speedup/threads;
+			// Only the pool workers run tasks
+			double total_busy = 0., min_busy = seconds;
+			for (unsigned int b = 0; b < busy.size(); b++)
+			{
+				total_busy += busy[b];
+				min_busy = std::min(min_busy, busy[b]);
+			}
+			if ((int) busy.size() < threads) min_busy = 0.; // some workers never got a task
+			r.idle_mean = (seconds > 0.) ? std::max(0., 1. - total_busy/(threads*seconds)) : 0.;
+			r.idle_max = (seconds > 0.) ? std::max(0., 1. - min_busy/seconds) : 0.;
+			results.push_back(r);
+			std::printf("%-6s %8d %8d %10.3f %9.2f %10.1f%% %9.1f%% %9.1f%%\n", r.type.c_str(), r.threads, r.points, r.seconds, r.speedup, 100.*r.efficiency, 100.*r.idle_mean, 100.*r.idle_max);
+			std::fflush(stdout);
+		}
+	}
+
+	std::ofstream out(output);
+	out << "{\n";
+	out << "  \"config\": {\"carrier_file\": \"" << file_carriers << "\", \"points\": " << n_points << ", \"max_threads\": " << max_threads
+		<< ", \"hardware_threads\": " << std::thread::hardware_concurrency() << "},\n";
+	out << "  \"scaling\": [\n";
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		const ScalingResult &r = results[i];
+		out << "    {\"type\": \"" << r.type << "\", \"threads\": " << r.threads << ", \"points\": " << r.points << ", \"seconds\": " << r.seconds
+			<< ", \"speedup\": " << r.speedup << ", \"efficiency\": " << r.efficiency << ", \"idle_mean\": " << r.idle_mean << ", \"idle_max\": " << r.idle_max
+			<< "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	std::cout << "Results written to " << output << std::endl;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	std::string filter, output = "benchmark.json";
+	double min_time = 0.5;
+	int scaling = 0, scaling_points = 4;
+	for (int a = 1; a < argc; a++)
+	{
+		std::string arg = argv[a];
+		if (arg == "--filter" && a + 1 < argc) filter = argv[++a];
+		else if (arg == "--min-time" && a + 1 < argc) min_time = std::atof(argv[++a]);
+		else if (arg == "--output" && a + 1 < argc) output = argv[++a];
+		else if (arg == "--scaling" && a + 1 < argc) scaling = std::atoi(argv[++a]);
+		else if (arg == "--points" && a + 1 < argc) scaling_points = std::max(1, std::atoi(argv[++a]));
+		else
+		{
+			std::cout << "Usage: " << argv[0] << " [--filter text] [--min-time seconds] [--output file.json]" << std::endl;
+			std::cout << "       " << argv[0] << " --scaling max_threads [--points P] [--output file.json]" << std::endl;
+			return 1;
+		}
+	}
+
+	// Same inputs as the TRACS executable
+	double pitch = 0, width = 0, depth = 0, temp = 0, trapping = 0, fluence = 0, C = 0, dt = 0, max_time = 0,
+		   vInit = 0, deltaV = 0, vMax = 0, v_depletion = 0, deltaZ = 0, zInit = 0., zMax = 0., yInit = 0., yMax = 0, deltaY = 5.;
+	int nThreads = 0, nns = 0, n_cells_y = 0, n_cells_x = 0, waveLength = 0;
+	char bulk_type = '\0', implant_type = '\0';
+	std::string scanType = "defaultString";
+	std::string neffType = "defaultString";
+	std::vector<double> neff_param(8,0.);
+	std::string file_carriers = "etct.carriers";
+	utilities::parse_config_file("Config.TRACS", file_carriers, depth, width,  pitch, nns, temp, trapping, fluence, nThreads, n_cells_x, n_cells_y, bulk_type, implant_type, waveLength, scanType, C, dt, max_time, vInit, deltaV, vMax, v_depletion, zInit, zMax, deltaZ, yInit, yMax, deltaY, neff_param, neffType);
+	if (fluence <= 0) trapping = std::numeric_limits<double>::max(); // if no fluence -> no trapping
+	if (nThreads < 1) nThreads = 1;
+	int n_tSteps = (int) std::floor(max_time / dt);
+
+	parameters["allow_extrapolation"] = true;
+	SMSDetector detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
+	detector.set_voltages(vInit, v_depletion);
+
+	std::vector<BenchmarkResult> results;
+
+	// Field solvers (also leave the fields ready for the rest)
+	detector.solve_w_u();
+	detector.solve_w_f_grad();
+	detector.solve_d_u();
+	detector.solve_d_f_grad();
+	detector.get_mesh()->bounding_box_tree();
+	if (scaling > 0) return run_scaling(detector, file_carriers, scaling, scaling_points, dt, max_time, yInit, output);
+
+	run(results, filter, min_time, "solve_w_u", "solve", 1, [&]() { detector.solve_w_u(); });
+	run(results, filter, min_time, "solve_w_f_grad", "solve", 1, [&]() { detector.solve_w_f_grad(); });
+	run(results, filter, min_time, "solve_d_u", "solve", 1, [&]() { detector.solve_d_u(); });
+	run(results, filter, min_time, "solve_d_f_grad", "solve", 1, [&]() { detector.solve_d_f_grad(); });
+
+	// Fixed set of points inside the detector
+	const int n_points = 1000;
+	std::mt19937 rng(12345);
+	std::uniform_real_distribution<double> random_x(detector.get_x_min(), detector.get_x_max());
+	std::uniform_real_distribution<double> random_y(detector.get_y_min(), detector.get_y_max());
+	std::vector< std::array<double,2> > points(n_points);
+	for (int i = 0; i < n_points; i++) points[i] = {{random_x(rng), random_y(rng)}};
+
+	JacoboniMobility mobility('e', detector.get_temperature());
+	run(results, filter, min_time, "mobility", "eval", 100000, [&]()
+	{
+		double sum = 0.;
+		for (int i = 0; i < 100000; i++) sum += mobility.obtain_mobility(1.e-2*i);
+		sink = sum;
+	});
+
+	run(results, filter, min_time, "d_field_eval", "eval", n_points, [&]()
+	{
+		std::array<double,2> field;
+		Array<double> wrap_field(2, field.data());
+		for (int i = 0; i < n_points; i++)
+		{
+			Array<double> wrap_x(2, points[i].data());
+			detector.get_d_f_grad()->eval(wrap_field, wrap_x);
+			sink = field[0];
+		}
+	});
+
+	run(results, filter, min_time, "w_field_eval", "eval", n_points, [&]()
+	{
+		std::array<double,2> field;
+		Array<double> wrap_field(2, field.data());
+		for (int i = 0; i < n_points; i++)
+		{
+			Array<double> wrap_x(2, points[i].data());
+			detector.get_w_f_grad()->eval(wrap_field, wrap_x);
+			sink = field[0];
+		}
+	});
+
+	DriftTransport transport('e', detector.get_d_f_grad(), detector.get_temperature());
+	run(results, filter, min_time, "rk4_step", "step", n_points, [&]()
+	{
+		runge_kutta4<std::array< double,2>> stepper;
+		for (int i = 0; i < n_points; i++)
+		{
+			std::array<double,2> x = points[i];
+			stepper.do_step(transport, x, 0., dt);
+			sink = x[0];
+		}
+	});
+
+	// One carrier in the middle of the detector
+	CarrierRecord carrier = {0.5*(detector.get_x_min() + detector.get_x_max()), 0.5*(detector.get_y_min() + detector.get_y_max()), 1., 0.};
+	CarrierSpecies electron('e', &detector), hole('h', &detector);
+	std::valarray<double> current((size_t) n_tSteps);
+	run(results, filter, min_time, "carrier_drift_electron", "carrier", 1, [&]()
+	{
+		current = 0.;
+		electron.simulate_drift(carrier, carrier.x, carrier.y, dt, max_time, current);
+		sink = current[0];
+	});
+	run(results, filter, min_time, "carrier_drift_hole", "carrier", 1, [&]()
+	{
+		current = 0.;
+		hole.simulate_drift(carrier, carrier.x, carrier.y, dt, max_time, current);
+		sink = current[0];
+	});
+
+	// Carrier file, as text and as binary
+	CarrierData carrier_data;
+	CarrierFile::read(file_carriers, carrier_data);
+	long n_carriers = carrier_data.size();
+	run(results, filter, min_time, "carrier_file_text", "carrier", std::max(n_carriers, 1L), [&]()
+	{
+		CarrierData data;
+		CarrierFile::read(file_carriers, data);
+		sink = data.size();
+	});
+	std::string binary_file = "benchmark_tmp.carriers";
+	CarrierFile::write_binary(binary_file, carrier_data);
+	run(results, filter, min_time, "carrier_file_binary", "carrier", std::max(n_carriers, 1L), [&]()
+	{
+		CarrierData data;
+		CarrierFile::read(binary_file, data);
+		sink = data.size();
+	});
+	std::remove(binary_file.c_str());
+
+	// Whole carrier file at the first point of the scan, one list
+	CarrierCollection collection(&detector);
+	collection.add_carriers_from_file(QString::fromUtf8(file_carriers.c_str()), 1);
+	std::valarray<double> curr_elec((size_t) n_tSteps), curr_hole((size_t) n_tSteps);
+	run(results, filter, min_time, "collection_drift", "carrier", std::max(n_carriers, 1L), [&]()
+	{
+		curr_elec = 0.;
+		curr_hole = 0.;
+		collection.simulate_drift(dt, max_time, yInit, zInit, curr_elec, curr_hole, 0);
+		sink = curr_elec[0];
+	});
+
+	// Convolution of that current with the amplifier
+	std::valarray<double> i_total = curr_elec + curr_hole;
+	TH1D *hnoconv = new TH1D("hnoconv", "Ramo current", n_tSteps, 0.0, max_time);
+	for (int j = 0; j < n_tSteps; j++) hnoconv->SetBinContent(j+1, i_total[j]);
+	run(results, filter, min_time, "h1d_convolution", "waveform", 1, [&]()
+	{
+		TH1D *hconv = H1DConvolution(hnoconv, C*1.e12);
+		sink = hconv->GetBinContent(1);
+		delete hconv;
+	});
+	std::vector<double> conv(2*n_tSteps);
+	run(results, filter, min_time, "transfer_function_convolve", "waveform", 1, [&]()
+	{
+		TransferFunction::get_default()->convolve(&i_total[0], n_tSteps, max_time/n_tSteps, conv.data());
+		sink = conv[0];
+	});
+	delete hnoconv;
+
+	// Small scan: a few depths drifted in the pool like TRACS does, then convoluted
+	const int n_scan = 4;
+	int nChunks = 4*nThreads;
+	ThreadPool pool(nThreads);
+	CarrierCollection scan_collection(&detector);
+	scan_collection.add_carriers_from_file(QString::fromUtf8(file_carriers.c_str()), nChunks);
+	std::vector< std::valarray<double> > vva_elec(n_scan*nChunks, std::valarray<double>((size_t) n_tSteps));
+	std::vector< std::valarray<double> > vva_hole(n_scan*nChunks, std::valarray<double>((size_t) n_tSteps));
+	double z_step = (detector.get_y_max() - detector.get_y_min())/n_scan;
+	run(results, filter, min_time, "scan_small", "point", n_scan, [&]()
+	{
+		for (int i = 0; i < n_scan; i++)
+		{
+			for (int c = 0; c < nChunks; c++)
+			{
+				int task = i*nChunks + c;
+				vva_elec[task] = 0.;
+				vva_hole[task] = 0.;
+				double z_shift = zInit + i*z_step;
+				pool.submit([=, &scan_collection, &vva_elec, &vva_hole]()
+				{
+					scan_collection.simulate_drift(dt, max_time, yInit, z_shift, vva_elec[task], vva_hole[task], c);
+				});
+			}
+		}
+		pool.wait();
+		for (int i = 0; i < n_scan; i++)
+		{
+			std::valarray<double> total((size_t) n_tSteps);
+			for (int c = 0; c < nChunks; c++) total += vva_elec[i*nChunks + c] + vva_hole[i*nChunks + c];
+			TransferFunction::get_default()->convolve(&total[0], n_tSteps, max_time/n_tSteps, conv.data());
+			sink = conv[0];
+		}
+	});
+
+	// Machine readable results
+	std::ofstream out(output);
+	out << "{\n";
+	out << "  \"config\": {\"carrier_file\": \"" << file_carriers << "\", \"carriers\": " << n_carriers << ", \"time_steps\": " << n_tSteps
+		<< ", \"cells_x\": " << n_cells_x << ", \"cells_y\": " << n_cells_y << ", \"threads\": " << nThreads
+		<< ", \"hardware_threads\": " << std::thread::hardware_concurrency() << ", \"min_time\": " << min_time << "},\n";
+	out << "  \"results\": [\n";
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult &r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"ops_per_call\": " << r.ops_per_call << ", \"samples\": " << r.samples
+			<< ", \"mean_ns\": " << r.mean_ns << ", \"min_ns\": " << r.min_ns << ", \"median_ns\": " << r.median_ns
+			<< ", \"ops_per_second\": " << (r.median_ns > 0 ? 1.e9/r.median_ns : 0.) << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	std::cout << "Results written to " << output << std::endl;
+	return 0;
+}
@@ -0,0 +1,40 @@
+#include "CarrierFile.h"
+
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+
+/*
+ ************** CONVERTER BETWEEN TEXT AND BINARY CARRIER FILES ***************
+ *
+ * Usage: TRACS-carriers2bin input.carriers output.carriers
+ *
+ * A text carrier file is written in the binary format (see CarrierFile.h),
+ * which TRACS loads directly. A binary file is written back as text.
+ *
+ */
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cout << "Usage: " << argv[0] << " input.carriers output.carriers" << std::endl;
+		return 1;
+	}
+
+	// Format of the input
+	char magic[8] = {0};
+	std::ifstream in(argv[1], std::ios_base::binary);
+	in.read(magic, sizeof(magic));
+	in.close();
+	bool binary = (std::strncmp(magic, "TRACSCAR", sizeof(magic)) == 0);
+
+	CarrierData carriers;
+	if (!CarrierFile::read(argv[1], carriers)) return 1;
+	std::cout << "Read " << carriers.size() << " carriers from " << argv[1] << std::endl;
+
+	bool ok = binary ? CarrierFile::write_text(argv[2], carriers) : CarrierFile::write_binary(argv[2], carriers);
+	if (ok) std::cout << "Written as " << (binary ? "text" : "binary") << " to " << argv[2] << std::endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,625 @@
+/*
+ ************************** TRACS FIT **************************
+ *
+ * Fits the Neff parametrization (y0..y3, z1, z2) and the trapping time of
+ * Config.TRACS to measured waveforms, in a single process. Everything that
+ * does not depend on the fitted parameters is built once and kept between
+ * the evaluations of the minimizer:
+ *
+ *  - mesh, function spaces and forms of the detector, with the assembled and
+ *    factorized operators of the field solvers (SMSDetector operator cache),
+ *    so a new Neff only costs the right hand sides and two back substitutions
+ *  - weighting potential/field (they do not depend on Neff)
+ *  - carriers (read once, shared by the pool) and the signal chain
+ *  - the currents without trapping of every point, grouped by generation
+ *    (TrappingDecomposition), so when only TrappingTime changes nothing is
+ *    solved or drifted again
+ *
+ * The measured file is a .hetct file (rows "Nt T[C] V x y z samples", time
+ * step from its "At:" header line), e.g. a measurement exported by TCT+ or a
+ * TRACS output. Positions are in microns, as TRACS writes them, or in mm
+ * with --mm. Every row is simulated at its voltage
+ * and (y, z) and compared, on the measured time axis, with --signal:
+ *
+ *  - conv:   convolution with the transfer function (TRACS _conv.hetct, default)
+ *  - ramo:   induced current (TRACS _noconv.hetct)
+ *  - shaped: Electronics chain of Config.TRACS (TRACS _shaped.hetct)
+ *
+ * The measured time axis starts at --t0 (seconds), by default the start of
+ * the simulated one, so TRACS outputs can be fitted as they are. Unless
+ * --no-scale is given, the simulation is scaled by the best gain for every
+ * evaluation (unknown amplification/laser intensity). The figure of merit is
+ * sum (gain*sim - meas)^2 / sum meas^2.
+ *
+ * The minimizer is a Nelder-Mead simplex over the chosen parameters (--params,
+ * names as in Config.TRACS), started from the values in Config.TRACS.
+ * A Levenberg-Marquardt fit (minimize_lm) with the derivatives of the
+ * waveforms from the tangent-linear model of the field solve and of the drift
+ * (SMSDetector::solve_d_f_grad_sensitivities, CarrierCollection::
+ * simulate_drift_sensitivity) is implemented, but --method lm is rejected
+ * until those derivatives have been validated against finite differences
+ * (TRACS-golden --check-gradients) and a tolerance set from the measured
+ * errors.
+ * Evaluations with z1 >= z2, z outside the detector or TrappingTime <= 0 are
+ * rejected. The best values are printed and written (--output) as
+ * Config.TRACS lines.
+ *
+ * Usage: ./TRACS-fit measured.hetct [--params y0,y1,y2,y3,z1,z2,TrappingTime]
+ *        [--signal conv|ramo|shaped] [--t0 seconds] [--mm] [--no-scale]
+ *        [--max-evals n] [--tolerance x] [--output fit.txt]
+ */
+
+#include "SMSDetector.h"
+#include "utilities.h"
+#include "CarrierCollection.h"
+#include "ThreadPool.h"
+#include "TransferFunction.h"
+#include "ElectronicsChain.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+
+struct MeasuredWaveform
+{
+	double voltage;
+	double y;       // microns
+	double z;       // microns
+	std::vector<double> samples;
+};
+
+/*
+ * Rows and time step of a .hetct file. Lines that do not hold a whole row
+ * (header) are skipped
+ */
+static bool read_hetct(std::string filename, double position_scale, double &dt, std::vector<MeasuredWaveform> &rows)
+{
+	std::ifstream in(filename);
+	if (!in.is_open())
+	{
+		std::cout << "File " << filename << " could not be opened" << std::endl;
+		return false;
+	}
+	dt = 0.;
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.compare(0, 3, "At:") == 0)
+		{
+			dt = std::atof(line.c_str() + 3);
+			continue;
+		}
+		std::istringstream fields(line);
+		double n = 0, temp = 0, x = 0;
+		MeasuredWaveform row;
+		if (!(fields >> n >> temp >> row.voltage >> x >> row.y >> row.z) || n < 1 || n != std::floor(n)) continue;
+		row.samples.resize((size_t) n);
+		bool complete = true;
+		for (size_t j = 0; j < row.samples.size() && complete; j++) complete = (bool) (fields >> row.samples[j]);
+		if (!complete) continue;
+		row.y *= position_scale;
+		row.z *= position_scale;
+		rows.push_back(row);
+	}
+	if (rows.empty()) std::cout << "No waveforms found in " << filename << std::endl;
+	if (dt <= 0.) std::cout << "No time step (At:) found in " << filename << std::endl;
+	return !rows.empty() && dt > 0.;
+}
+
+/*
+ * Nelder-Mead simplex minimization of f starting at x (modified in place),
+ * with initial steps step. Stops after max_evals evaluations or when the
+ * values at the vertices differ by less than tolerance (relative)
+ */
+static double minimize(std::function<double(const std::vector<double>&)> f, std::vector<double> &x, const std::vector<double> &step, int max_evals, double tolerance)
+{
+	int n = x.size();
+	std::vector< std::vector<double> > simplex(n + 1, x);
+	std::vector<double> values(n + 1);
+	for (int i = 0; i < n; i++) simplex[i+1][i] += step[i];
+	int evals = 0;
+	for (int i = 0; i <= n; i++, evals++) values[i] = f(simplex[i]);
+
+	while (evals < max_evals)
+	{
+		// Order: best first, worst last
+		std::vector<int> order(n + 1);
+		for (int i = 0; i <= n; i++) order[i] = i;
+		std::sort(order.begin(), order.end(), [&values](int a, int b) { return values[a] < values[b]; });
+		std::vector< std::vector<double> > sorted_simplex(n + 1);
+		std::vector<double> sorted_values(n + 1);
+		for (int i = 0; i <= n; i++)
+		{
+			sorted_simplex[i] = simplex[order[i]];
+			sorted_values[i] = values[order[i]];
+		}
+		simplex.swap(sorted_simplex);
+		values.swap(sorted_values);
+
+		if (std::fabs(values[n] - values[0]) <= tolerance*(std::fabs(values[0]) + 1.e-30)) break;
+
+		// Centroid of all but the worst
+		std::vector<double> centroid(n, 0.);
+		for (int i = 0; i < n; i++)
+		{
+			for (int j = 0; j < n; j++) centroid[j] += simplex[i][j]/n;
+		}
+		auto along = [&](double t)
+		{
+			std::vector<double> p(n);
+			for (int j = 0; j < n; j++) p[j] = centroid[j] + t*(simplex[n][j] - centroid[j]);
+			return p;
+		};
+
+		std::vector<double> reflected = along(-1.);
+		double f_reflected = f(reflected);
+		evals++;
+		if (f_reflected < values[0])
+		{
+			std::vector<double> expanded = along(-2.);
+			double f_expanded = f(expanded);
+			evals++;
+			if (f_expanded < f_reflected)
+			{
+				simplex[n] = expanded;
+				values[n] = f_expanded;
+			}
+			else
+			{
+				simplex[n] = reflected;
+				values[n] = f_reflected;
+			}
+			continue;
+		}
+		if (f_reflected < values[n-1])
+		{
+			simplex[n] = reflected;
+			values[n] = f_reflected;
+			continue;
+		}
+		std::vector<double> contracted = (f_reflected < values[n]) ? along(-0.5) : along(0.5);
+		double f_contracted = f(contracted);
+		evals++;
+		if (f_contracted < std::min(f_reflected, values[n]))
+		{
+			simplex[n] = contracted;
+			values[n] = f_contracted;
+			continue;
+		}
+		// Shrink towards the best
+		for (int i = 1; i <= n && evals < max_evals; i++, evals++)
+		{
+			for (int j = 0; j < n; j++) simplex[i][j] = simplex[0][j] + 0.5*(simplex[i][j] - simplex[0][j]);
+			values[i] = f(simplex[i]);
+		}
+	}
+
+	int best = std::min_element(values.begin(), values.end()) - values.begin();
+	x = simplex[best];
+	return values[best];
+}
+
+/*
+ * Solves the small dense system a x = b (Gaussian elimination with partial pivoting)
+ */
+static bool solve_dense(std::vector< std::vector<double> > a, std::vector<double> b, std::vector<double> &x)
+{
+	int n = b.size();
+	for (int i = 0; i < n; i++)
+	{
+		int pivot = i;
+		for (int j = i + 1; j < n; j++) if (std::fabs(a[j][i]) > std::fabs(a[pivot][i])) pivot = j;
+		if (a[pivot][i] == 0.) return false;
+		std::swap(a[i], a[pivot]);
+		std::swap(b[i], b[pivot]);
+		for (int j = i + 1; j < n; j++)
+		{
+			double factor = a[j][i]/a[i][i];
+			for (int k = i; k < n; k++) a[j][k] -= factor*a[i][k];
+			b[j] -= factor*b[i];
+		}
+	}
+	x.assign(n, 0.);
+	for (int i = n - 1; i >= 0; i--)
+	{
+		double sum = b[i];
+		for (int k = i + 1; k < n; k++) sum -= a[i][k]*x[k];
+		x[i] = sum/a[i][i];
+	}
+	return true;
+}
+
+/*
+ * Levenberg-Marquardt minimization of f = |gain*model(x) - data|^2 (normalized as f does),
+ * starting at x (modified in place). model_jacobian gives the model and its derivatives
+ * (one column per parameter); the gain is one more parameter of the steps if fit_scale.
+ * Every trial point is evaluated with f, every accepted one needs a new jacobian. Stops
+ * after max_evals calls of f and model_jacobian, or when an accepted step improves f by
+ * less than tolerance (relative)
+ */
+static double minimize_lm(std::function<double(const std::vector<double>&)> f,
+		std::function<void(const std::vector<double>&, std::vector<double>&, std::vector< std::vector<double> >&)> model_jacobian,
+		const std::vector<double> &data, bool fit_scale, std::vector<double> &x, int max_evals, double tolerance)
+{
+	int n = x.size();
+	int n_steps = n + (fit_scale ? 1 : 0);
+	double best = f(x);
+	int evals = 1;
+	double lambda = 1.e-3;
+	bool converged = false;
+
+	while (evals < max_evals && !converged)
+	{
+		std::vector<double> model;
+		std::vector< std::vector<double> > jacobian;
+		model_jacobian(x, model, jacobian);
+		evals++;
+
+		double sm = 0., ss = 0.;
+		for (unsigned int j = 0; j < data.size(); j++)
+		{
+			sm += model[j]*data[j];
+			ss += model[j]*model[j];
+		}
+		double gain = (fit_scale && ss > 0.) ? sm/ss : 1.;
+		std::vector< std::vector<double> > columns(n_steps);
+		for (int i = 0; i < n; i++)
+		{
+			columns[i] = jacobian[i];
+			for (unsigned int j = 0; j < data.size(); j++) columns[i][j] *= gain;
+		}
+		if (fit_scale) columns[n] = model;
+
+		// Normal equations
+		std::vector< std::vector<double> > jtj(n_steps, std::vector<double>(n_steps, 0.));
+		std::vector<double> jtr(n_steps, 0.);
+		for (int a = 0; a < n_steps; a++)
+		{
+			for (unsigned int j = 0; j < data.size(); j++) jtr[a] -= columns[a][j]*(gain*model[j] - data[j]);
+			for (int b = 0; b <= a; b++)
+			{
+				for (unsigned int j = 0; j < data.size(); j++) jtj[a][b] += columns[a][j]*columns[b][j];
+				jtj[b][a] = jtj[a][b];
+			}
+		}
+
+		bool improved = false;
+		while (evals < max_evals && lambda < 1.e12)
+		{
+			std::vector< std::vector<double> > damped = jtj;
+			for (int a = 0; a < n_steps; a++) damped[a][a] += lambda*((jtj[a][a] > 0.) ? jtj[a][a] : 1.);
+			std::vector<double> delta;
+			std::vector<double> trial = x;
+			if (solve_dense(damped, jtr, delta))
+			{
+				for (int i = 0; i < n; i++) trial[i] += delta[i];
+			}
+			double value = f(trial);
+			evals++;
+			if (value < best)
+			{
+				converged = (best - value) <= tolerance*best;
+				best = value;
+				x = trial;
+				lambda = std::max(lambda/10., 1.e-12);
+				improved = true;
+				break;
+			}
+			lambda *= 10.;
+		}
+		if (!improved) break;
+	}
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	std::string measured_file, signal = "conv", output = "fit.txt", method = "simplex";
+	std::string param_list = "y0,y1,y2,y3,z1,z2,TrappingTime";
+	double t0 = std::numeric_limits<double>::quiet_NaN(), tolerance = 1.e-5, position_scale = 1.;
+	int max_evals = 300;
+	bool fit_scale = true;
+	for (int a = 1; a < argc; a++)
+	{
+		std::string arg = argv[a];
+		if (arg == "--params" && a + 1 < argc) param_list = argv[++a];
+		else if (arg == "--signal" && a + 1 < argc) signal = argv[++a];
+		else if (arg == "--method" && a + 1 < argc) method = argv[++a];
+		else if (arg == "--t0" && a + 1 < argc) t0 = std::atof(argv[++a]);
+		else if (arg == "--mm") position_scale = 1000.;
+		else if (arg == "--no-scale") fit_scale = false;
+		else if (arg == "--max-evals" && a + 1 < argc) max_evals = std::atoi(argv[++a]);
+		else if (arg == "--tolerance" && a + 1 < argc) tolerance = std::atof(argv[++a]);
+		else if (arg == "--output" && a + 1 < argc) output = argv[++a];
+		else if (measured_file.empty() && arg[0] != '-') measured_file = arg;
+		else measured_file.clear(), a = argc;
+	}
+	if (method == "lm")
+	{
+		// The tangent-linear derivatives it relies on are not validated yet
+		std::cout << "--method lm is disabled until TRACS-golden --check-gradients has validated its derivatives" << std::endl;
+		return 1;
+	}
+	if (measured_file.empty() || (signal != "conv" && signal != "ramo" && signal != "shaped") || method != "simplex")
+	{
+		std::cout << "Usage: " << argv[0] << " measured.hetct [--params y0,y1,y2,y3,z1,z2,TrappingTime] [--signal conv|ramo|shaped] [--t0 seconds] [--mm] [--no-scale] [--max-evals n] [--tolerance x] [--output fit.txt]" << std::endl;
+		return 1;
+	}
+
+	double measured_dt = 0.;
+	std::vector<MeasuredWaveform> measured;
+	if (!read_hetct(measured_file, position_scale, measured_dt, measured)) return 1;
+
+	// Model: same inputs as the TRACS executable
+	double pitch = 0, width = 0, depth = 0, temp = 0, trapping = 0, fluence = 0, C = 0, dt = 0, max_time = 0,
+		   vInit = 0, deltaV = 0, vMax = 0, v_depletion = 0, deltaZ = 0, zInit = 0., zMax = 0., yInit = 0., yMax = 0, deltaY = 5.;
+	int nThreads = 0, nns = 0, n_cells_y = 0, n_cells_x = 0, waveLength = 0;
+	char bulk_type = '\0', implant_type = '\0';
+	std::string scanType = "defaultString";
+	std::string neffType = "defaultString";
+	std::vector<double> neff_param(8,0.);
+	std::string file_carriers = "etct.carriers";
+	utilities::parse_config_file("Config.TRACS", file_carriers, depth, width,  pitch, nns, temp, trapping, fluence, nThreads, n_cells_x, n_cells_y, bulk_type, implant_type, waveLength, scanType, C, dt, max_time, vInit, deltaV, vMax, v_depletion, zInit, zMax, deltaZ, yInit, yMax, deltaY, neff_param, neffType);
+	if (nThreads < 1) nThreads = 1;
+	int nChunks = 4*nThreads;
+	int n_tSteps = (int) std::floor(max_time / dt);
+	if (fluence <= 0)
+	{
+		std::cout << "Fluence is 0 in Config.TRACS: TRACS does not use Neff nor trapping, set Fluence > 0 to fit them" << std::endl;
+		return 1;
+	}
+	neff_param[4] = 0.;
+	neff_param[7] = depth;
+
+	// Parameters to fit: index in {y0, y1, y2, y3, z1, z2, TrappingTime}
+	const std::vector<std::string> names = {"y0", "y1", "y2", "y3", "z1", "z2", "TrappingTime"};
+	std::vector<double> values = {neff_param[0], neff_param[1], neff_param[2], neff_param[3], neff_param[5], neff_param[6], trapping};
+	std::vector<int> fitted;
+	std::istringstream params(param_list);
+	std::string name;
+	while (std::getline(params, name, ','))
+	{
+		int p = std::find(names.begin(), names.end(), name) - names.begin();
+		if (p == (int) names.size())
+		{
+			std::cout << "Unknown parameter " << name << " (use y0, y1, y2, y3, z1, z2, TrappingTime)" << std::endl;
+			return 1;
+		}
+		fitted.push_back(p);
+	}
+	if (fitted.empty()) return 1;
+
+	// Things that do not change between evaluations
+	parameters["allow_extrapolation"] = true;
+	SMSDetector detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
+	detector.set_operator_cache(true);
+	detector.set_voltages(measured[0].voltage, v_depletion);
+	std::string ramoCurrent = "Field";
+	utilities::get_config_value("Config.TRACS", "RamoCurrent", ramoCurrent);
+	bool use_w_potential = (ramoCurrent == "Potential");
+	detector.solve_w_u();
+	if (!use_w_potential) detector.solve_w_f_grad();
+	detector.get_mesh()->bounding_box_tree();
+
+	CarrierCollection carrier_collection(&detector);
+	carrier_collection.set_use_w_potential(use_w_potential);
+	carrier_collection.add_carriers_from_file(QString::fromUtf8(file_carriers.c_str()), nChunks);
+	ThreadPool pool(nThreads);
+
+	std::string electronics = "None";
+	utilities::get_config_value("Config.TRACS", "Electronics", electronics);
+	ElectronicsChain chain(electronics);
+	if (signal == "shaped" && chain.is_empty())
+	{
+		std::cout << "--signal shaped needs an Electronics chain in Config.TRACS" << std::endl;
+		return 1;
+	}
+	// Time of the first simulated sample
+	double sim_start = (signal == "conv") ? -max_time : 0.;
+	if (std::isnan(t0)) t0 = sim_start;
+
+	// Rows by voltage, fields are solved once per voltage
+	std::map< double, std::vector<int> > by_voltage;
+	for (unsigned int r = 0; r < measured.size(); r++) by_voltage[measured[r].voltage].push_back(r);
+	double meas_norm = 0.;
+	for (unsigned int r = 0; r < measured.size(); r++)
+	{
+		for (unsigned int j = 0; j < measured[r].samples.size(); j++) meas_norm += measured[r].samples[j]*measured[r].samples[j];
+	}
+	std::cout << measured.size() << " measured waveforms at " << by_voltage.size() << " voltages, fitting " << param_list << std::endl;
+
+	// Currents without trapping of every row, for the Neff they were drifted with
+	std::vector<TrappingDecomposition> untrapped(measured.size());
+	std::vector<double> drifted_neff;
+	int n_evals = 0, n_solves = 0;
+	double best_chi2 = std::numeric_limits<double>::max(), best_gain = 1.;
+	std::vector<double> best_values = values;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Simulated currents -> selected signal (all the steps are linear)
+	auto to_signal = [&](std::vector< std::valarray<double> > &waves)
+	{
+		if (signal == "conv")
+		{
+			for (unsigned int r = 0; r < waves.size(); r++)
+			{
+				std::valarray<double> conv(2*n_tSteps);
+				TransferFunction::get_default()->convolve(&waves[r][0], n_tSteps, max_time/n_tSteps, &conv[0]);
+				waves[r].resize(conv.size());
+				waves[r] = conv;
+			}
+		}
+		else if (signal == "shaped") chain.process(waves, dt);
+	};
+	// Appends a simulated signal interpolated at the n samples of the measured time axis
+	auto resample = [&](const std::valarray<double> &sim, unsigned int n, std::vector<double> &out)
+	{
+		for (unsigned int j = 0; j < n; j++)
+		{
+			double pos = (t0 + j*measured_dt - sim_start)/dt;
+			int k = (int) std::floor(pos);
+			double s = 0.;
+			if (k >= 0 && k + 1 < (int) sim.size()) s = sim[k] + (pos - k)*(sim[k+1] - sim[k]);
+			out.push_back(s);
+		}
+	};
+
+	auto chi2 = [&](const std::vector<double> &x) -> double
+	{
+		std::vector<double> v = values;
+		for (unsigned int i = 0; i < fitted.size(); i++) v[fitted[i]] = x[i];
+		double tau = v[6];
+		if (tau <= 0. || v[4] <= 0. || v[4] >= v[5] || v[5] >= depth) return std::numeric_limits<double>::max();
+		n_evals++;
+
+		// New Neff: fields of every voltage and drift of every row, no trapping
+		std::vector<double> neff = {v[0], v[1], v[2], v[3], 0., v[4], v[5], depth};
+		if (neff != drifted_neff)
+		{
+			detector.set_neff_param(neff);
+			for (std::map< double, std::vector<int> >::iterator it = by_voltage.begin(); it != by_voltage.end(); ++it)
+			{
+				detector.set_voltages(it->first, v_depletion);
+				detector.solve_d_u();
+				detector.solve_d_f_grad();
+				for (unsigned int k = 0; k < it->second.size(); k++)
+				{
+					int r = it->second[k];
+					untrapped[r] = TrappingDecomposition();
+					carrier_collection.simulate_drift(dt, max_time, measured[r].y, measured[r].z, untrapped[r], &pool);
+				}
+			}
+			drifted_neff = neff;
+			n_solves++;
+		}
+
+		// Trapping, signal chain and comparison on the measured time axis
+		std::vector< std::valarray<double> > sim(measured.size());
+		for (unsigned int r = 0; r < measured.size(); r++)
+		{
+			std::valarray<double> i_elec((size_t) n_tSteps), i_hole((size_t) n_tSteps);
+			untrapped[r].get_current(tau, tau, i_elec, i_hole);
+			sim[r] = i_elec + i_hole;
+		}
+		to_signal(sim);
+
+		double sm = 0., ss = 0., mm = 0.;
+		std::vector<double> model;
+		for (unsigned int r = 0; r < measured.size(); r++)
+		{
+			const std::vector<double> &meas = measured[r].samples;
+			resample(sim[r], meas.size(), model);
+			for (unsigned int j = 0; j < meas.size(); j++)
+			{
+				double s = model[model.size() - meas.size() + j];
+				sm += s*meas[j];
+				ss += s*s;
+				mm += meas[j]*meas[j];
+			}
+		}
+		double gain = (fit_scale && ss > 0.) ? sm/ss : 1.;
+		double residual = gain*gain*ss - 2.*gain*sm + mm;
+		double result = (meas_norm > 0.) ? residual/meas_norm : residual;
+
+		if (result < best_chi2)
+		{
+			best_chi2 = result;
+			best_gain = gain;
+			best_values = v;
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::printf("Evaluation %d (%d field solves, %.1f s): chi2 %.6e gain %.4e", n_evals, n_solves, seconds, result, gain);
+			for (unsigned int i = 0; i < fitted.size(); i++) std::printf(" %s=%g", names[fitted[i]].c_str(), v[fitted[i]]);
+			std::printf("\n");
+			std::fflush(stdout);
+		}
+		return result;
+	};
+
+	// Model on the measured time axis and its derivatives with respect to the fitted parameters,
+	// from the tangent-linear fields and drift (one drift per row gives all of them)
+	std::vector<int> sensitivity_params; // of the detector, for every fitted parameter but TrappingTime
+	for (unsigned int i = 0; i < fitted.size(); i++)
+	{
+		if (fitted[i] < 6) sensitivity_params.push_back((fitted[i] < 4) ? fitted[i] : fitted[i] + 1); // z1, z2 -> 5, 6
+	}
+	int n_jacobians = 0;
+	auto model_jacobian = [&](const std::vector<double> &x, std::vector<double> &model, std::vector< std::vector<double> > &jacobian)
+	{
+		std::vector<double> v = values;
+		for (unsigned int i = 0; i < fitted.size(); i++) v[fitted[i]] = x[i];
+		detector.set_neff_param({v[0], v[1], v[2], v[3], 0., v[4], v[5], depth});
+		detector.set_trapping_time(v[6]);
+
+		std::vector< std::vector< std::valarray<double> > > waves(measured.size());
+		for (std::map< double, std::vector<int> >::iterator it = by_voltage.begin(); it != by_voltage.end(); ++it)
+		{
+			detector.set_voltages(it->first, v_depletion);
+			detector.solve_d_u();
+			detector.solve_d_f_grad();
+			detector.solve_d_f_grad_sensitivities(sensitivity_params);
+			for (unsigned int k = 0; k < it->second.size(); k++)
+			{
+				int r = it->second[k];
+				std::valarray<double> curr((size_t) n_tSteps);
+				std::vector< std::valarray<double> > d_curr;
+				carrier_collection.simulate_drift_sensitivity(dt, max_time, measured[r].y, measured[r].z, curr, d_curr, &pool);
+				waves[r].push_back(curr);
+				waves[r].insert(waves[r].end(), d_curr.begin(), d_curr.end());
+				to_signal(waves[r]);
+			}
+		}
+
+		model.clear();
+		jacobian.assign(fitted.size(), std::vector<double>());
+		for (unsigned int r = 0; r < measured.size(); r++)
+		{
+			resample(waves[r][0], measured[r].samples.size(), model);
+			for (unsigned int i = 0, k = 0; i < fitted.size(); i++)
+			{
+				// waves: current, field sensitivities, trapping time
+				int w = (fitted[i] == 6) ? waves[r].size() - 1 : 1 + k++;
+				resample(waves[r][w], measured[r].samples.size(), jacobian[i]);
+			}
+		}
+		n_jacobians++;
+	};
+
+	// Starting point and steps of the initial simplex
+	std::vector<double> x(fitted.size()), step(fitted.size());
+	for (unsigned int i = 0; i < fitted.size(); i++)
+	{
+		int p = fitted[i];
+		x[i] = values[p];
+		if (p == 4 || p == 5) step[i] = 0.05*depth;
+		else step[i] = (values[p] != 0.) ? 0.1*values[p] : 0.1;
+	}
+	double result = 0.;
+	if (method == "lm")
+	{
+		std::vector<double> data;
+		for (unsigned int r = 0; r < measured.size(); r++) data.insert(data.end(), measured[r].samples.begin(), measured[r].samples.end());
+		result = minimize_lm(chi2, model_jacobian, data, fit_scale, x, max_evals, tolerance);
+	}
+	else result = minimize(chi2, x, step, max_evals, tolerance);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Fit finished: " << n_evals << " evaluations, " << n_jacobians << " jacobians, " << n_solves << " field solves, " << seconds << " s, chi2 " << result << ", gain " << best_gain << std::endl;
+	std::ofstream out(output);
+	out << "# TRACS-fit of " << measured_file << " (" << signal << "), chi2 = " << best_chi2 << ", gain = " << best_gain << "\n";
+	for (unsigned int i = 0; i < fitted.size(); i++)
+	{
+		std::ostringstream line;
+		line << names[fitted[i]] << " = " << best_values[fitted[i]];
+		std::cout << line.str() << std::endl;
+		out << line.str() << "\n";
+	}
+	std::cout << "Results written to " << output << std::endl;
+	return 0;
+}
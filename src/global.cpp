@@ -1,6 +1,6 @@
 #include "global.h"
 
-vector<vector <TH1D*> >  i_ramo_array, i_conv_array, i_rc_array;
-//i_ramo_array.clear();
-//i_conv_array.clear();
+WaveformStore i_ramo_store, i_conv_store, i_rc_store;
+Checkpoint checkpoint;
+Progress progress;
 int num_threads;
\ No newline at end of file
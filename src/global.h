@@ -3,10 +3,18 @@
 #include "TRACSInterface.h" 
 #include <TH1D.h> // 1 Dimesional ROOT histogram 
 #include <vector>
+#include "WaveformStore.h"
+#include "Checkpoint.h"
+#include "Progress.h"
 using std::vector;
 
 
-extern vector<vector <TH1D*> >  i_ramo_array, i_conv_array, i_rc_array;
+// Currents of every (voltage, y, z) point of the scan (see resize_array)
+extern WaveformStore i_ramo_store, i_conv_store, i_rc_store;
+// Points already simulated, for resuming the scan (see open_checkpoint)
+extern Checkpoint checkpoint;
+// Points done by all the threads (see start_progress)
+extern Progress progress;
 extern int num_threads;
 
 #endif // GLOBAL_H
@@ -0,0 +1,594 @@
+/*
+ ************************** TRACS GOLDEN WAVEFORMS **************************
+ *
+ * Accuracy harness for the faster ways of computing the currents. A fixed set
+ * of reference configurations (defined below, independent of Config.TRACS) is
+ * simulated with the exact path and stored as golden waveforms:
+ *
+ *  - diode_edge            diode (no neighbouring strips), edge-TCT
+ *  - strips_edge           strips, edge-TCT
+ *  - strips_top            strips, top-TCT on the strip and between strips
+ *  - irrad_linear_edge     irradiated, Linear Neff, trapping, edge-TCT
+ *  - irrad_trilinear_edge  irradiated, Trilinear Neff, trapping, edge-TCT
+ *
+ * Every engine mode (see modes[] below) then simulates the same points and is
+ * compared with the golden waveforms. For every case and mode the worst point
+ * gives:
+ *
+ *  - charge: |Q - Q_golden| / |Q_golden|, Q being the integral of the current
+ *  - peak:   |I_peak - I_peak_golden| / |I_peak_golden| and the shift of the
+ *            time of the peak
+ *  - L2:     |I - I_golden| / |I_golden|
+ *
+ * Modes with a coarser time step are compared with the golden waveforms
+ * rebinned to their step (average of the fine bins, so the charge is kept).
+ * The table also has the time spent solving the fields and drifting, and the
+ * speedup over the exact mode, which is always run. A new fast path only has
+ * to add its entry to modes[] and to simulate_case().
+ *
+ * The exact mode must reproduce the golden waveforms within the tolerances,
+ * otherwise the program returns 1 (regression). Other modes only report.
+ *
+ * Usage (from bin/, needs etct.carriers and red_top_100_tct.carriers):
+ *   ./TRACS-golden --record [--golden file]      stores the golden waveforms
+ *   ./TRACS-golden [--golden file] [--modes a,b] [--threads n] [--output file.json]
+ *                  [--tol-charge x] [--tol-peak x] [--tol-l2 x]
+ *   ./TRACS-golden --check-gradients [--threads n] [--tol-gradient x]
+ *                                                 checks the tangent-linear derivatives
+ *                                                 of TRACS-fit --method lm (disabled until
+ *                                                 they pass; the 0.05 default tolerance is
+ *                                                 provisional, to be set from measured errors)
+ */
+
+#include "SMSDetector.h"
+#include "CarrierCollection.h"
+#include "CarrierFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+/*
+ * Reference configuration: detector, carriers and the points simulated
+ */
+struct GoldenCase
+{
+	std::string name;
+	int nns;
+	double fluence;         // 0: not irradiated (no trapping)
+	std::string neff_type;
+	std::string carrier_file;
+	bool top;               // top-TCT: positions are x of the beam, else depths of an edge-TCT beam
+	std::vector<double> positions;
+};
+
+/*
+ * Way of computing the currents to be compared with the exact path
+ */
+struct EngineMode
+{
+	std::string name;
+	bool use_w_potential;   // RamoCurrent = Potential
+	int dt_factor;          // time step = dt_factor * reference time step
+	double cells_factor;    // mesh cells = cells_factor * reference cells
+};
+
+// Common to all the cases (default values of Config.TRACS)
+static const double ref_depth = 300., ref_width = 25., ref_pitch = 80., ref_temp = 300.;
+static const int ref_cells = 150;
+static const double ref_dt = 5.e-11, ref_max_time = 1.5e-8;
+static const double ref_voltage = 300., ref_v_depletion = 250., ref_trapping = 3.e-9;
+static const double ref_edge_x = 10.; // horizontal shift of the edge-TCT beam
+static const int n_chunks = 16;        // fixed, so the summation order does not depend on the threads
+
+static const EngineMode modes[] = {
+	{"exact",         false, 1, 1. },
+	{"potential",     true,  1, 1. },
+	{"potential_dt2", true,  2, 1. },
+	{"potential_dt4", true,  4, 1. },
+	{"field_dt2",     false, 2, 1. },
+	{"coarse_mesh",   false, 1, 0.5},
+};
+static const int n_modes = sizeof(modes)/sizeof(modes[0]);
+
+static std::vector<GoldenCase> get_cases()
+{
+	std::vector<double> depths = {50., 150., 250.};
+	double strip = 2.5*ref_pitch; // centre of the read-out strip with 2 neighbours
+	std::vector<GoldenCase> cases = {
+		{"diode_edge",           0, 0.,     "Linear",    "etct.carriers",            false, depths},
+		{"strips_edge",          2, 0.,     "Linear",    "etct.carriers",            false, depths},
+		{"strips_top",           2, 0.,     "Linear",    "red_top_100_tct.carriers", true,  {strip, strip + 0.5*ref_pitch}},
+		{"irrad_linear_edge",    2, 1.e15,  "Linear",    "etct.carriers",            false, depths},
+		{"irrad_trilinear_edge", 2, 1.e15,  "Trilinear", "etct.carriers",            false, depths},
+	};
+	return cases;
+}
+
+/*
+ * Simulates every point of a case. Returns one waveform per position, the
+ * time of the field solves and of the drift
+ */
+static bool simulate_case(const GoldenCase &gc, const EngineMode &mode, ThreadPool &pool, std::vector< std::vector<double> > &waveforms, double &solve_seconds, double &drift_seconds)
+{
+	double dt = ref_dt*mode.dt_factor;
+	int n_tSteps = (int) std::floor(ref_max_time / dt);
+	int n_cells = (int) std::lround(ref_cells*mode.cells_factor);
+	double trapping = (gc.fluence <= 0) ? std::numeric_limits<double>::max() : ref_trapping;
+	std::vector<double> neff_param = {-25., 0.02, 0.22, 33., 0., 120., 220., ref_depth};
+
+	// Top-TCT: the beam is moved from the centre of the carrier file
+	double x_centre = 0.;
+	if (gc.top)
+	{
+		CarrierData data;
+		if (!CarrierFile::read(gc.carrier_file, data) || data.size() == 0)
+		{
+			std::cout << "File " << gc.carrier_file << " could not be read" << std::endl;
+			return false;
+		}
+		for (unsigned int c = 0; c < data.size(); c++) x_centre += data.x[c]/data.size();
+	}
+
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	SMSDetector detector(ref_pitch, ref_width, ref_depth, gc.nns, 'p', 'n', n_cells, n_cells, ref_temp, trapping, gc.fluence, neff_param, gc.neff_type);
+	detector.set_voltages(ref_voltage, ref_v_depletion);
+	detector.solve_w_u();
+	if (!mode.use_w_potential) detector.solve_w_f_grad();
+	detector.solve_d_u();
+	detector.solve_d_f_grad();
+	detector.get_mesh()->bounding_box_tree();
+	solve_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	CarrierCollection collection(&detector);
+	collection.add_carriers_from_file(QString::fromUtf8(gc.carrier_file.c_str()), n_chunks);
+	collection.set_use_w_potential(mode.use_w_potential);
+
+	int n_points = gc.positions.size();
+	std::vector< std::valarray<double> > vva_elec(n_points*n_chunks, std::valarray<double>((size_t) n_tSteps));
+	std::vector< std::valarray<double> > vva_hole(n_points*n_chunks, std::valarray<double>((size_t) n_tSteps));
+	t0 = std::chrono::steady_clock::now();
+	for (int p = 0; p < n_points; p++)
+	{
+		double shift_x = gc.top ? gc.positions[p] - x_centre : ref_edge_x;
+		double shift_y = gc.top ? 0. : gc.positions[p];
+		for (int c = 0; c < n_chunks; c++)
+		{
+			int task = p*n_chunks + c;
+			pool.submit([=, &collection, &vva_elec, &vva_hole]()
+			{
+				collection.simulate_drift(dt, ref_max_time, shift_x, shift_y, vva_elec[task], vva_hole[task], c);
+			});
+		}
+	}
+	pool.wait();
+	drift_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	// Fixed summation order, as in TRACS
+	waveforms.assign(n_points, std::vector<double>(n_tSteps, 0.));
+	for (int p = 0; p < n_points; p++)
+	{
+		for (int c = 0; c < n_chunks; c++)
+		{
+			int task = p*n_chunks + c;
+			for (int j = 0; j < n_tSteps; j++) waveforms[p][j] += vva_elec[task][j] + vva_hole[task][j];
+		}
+	}
+	return true;
+}
+
+/*
+ ******************** GOLDEN FILE **************************
+ *
+ * Native byte order:
+ *   char     magic[8]      "TRACSGLD"
+ *   uint32_t version       1
+ *   uint32_t n             number of waveforms
+ * and n times:
+ *   char     name[32]      case, padded with zeros
+ *   uint32_t point         index in the positions of the case
+ *   uint32_t n_samples
+ *   double   dt
+ *   double   current[n_samples]
+ */
+
+struct GoldenWaveform
+{
+	std::string name;
+	uint32_t point;
+	double dt;
+	std::vector<double> current;
+};
+
+static bool write_golden(std::string filename, const std::vector<GoldenWaveform> &golden)
+{
+	std::ofstream out(filename, std::ios_base::binary | std::ios_base::trunc);
+	if (!out.is_open())
+	{
+		std::cout << "File " << filename << " could not be created" << std::endl;
+		return false;
+	}
+	uint32_t header[2] = {1, (uint32_t) golden.size()};
+	out.write("TRACSGLD", 8);
+	out.write((const char *) header, sizeof(header));
+	for (unsigned int w = 0; w < golden.size(); w++)
+	{
+		char name[32] = {0};
+		std::strncpy(name, golden[w].name.c_str(), sizeof(name) - 1);
+		uint32_t sizes[2] = {golden[w].point, (uint32_t) golden[w].current.size()};
+		out.write(name, sizeof(name));
+		out.write((const char *) sizes, sizeof(sizes));
+		out.write((const char *) &golden[w].dt, sizeof(double));
+		out.write((const char *) golden[w].current.data(), golden[w].current.size()*sizeof(double));
+	}
+	return out.good();
+}
+
+static bool read_golden(std::string filename, std::vector<GoldenWaveform> &golden)
+{
+	std::ifstream in(filename, std::ios_base::binary);
+	if (!in.is_open())
+	{
+		std::cout << "File " << filename << " could not be opened (create it with --record)" << std::endl;
+		return false;
+	}
+	char magic[8];
+	uint32_t header[2];
+	in.read(magic, 8);
+	in.read((char *) header, sizeof(header));
+	if (!in || std::memcmp(magic, "TRACSGLD", 8) != 0 || header[0] != 1)
+	{
+		std::cout << "File " << filename << " is not a golden waveform file" << std::endl;
+		return false;
+	}
+	golden.resize(header[1]);
+	for (unsigned int w = 0; w < golden.size(); w++)
+	{
+		char name[32];
+		uint32_t sizes[2];
+		in.read(name, sizeof(name));
+		in.read((char *) sizes, sizeof(sizes));
+		in.read((char *) &golden[w].dt, sizeof(double));
+		name[sizeof(name) - 1] = '\0';
+		golden[w].name = name;
+		golden[w].point = sizes[0];
+		golden[w].current.resize(sizes[1]);
+		in.read((char *) golden[w].current.data(), sizes[1]*sizeof(double));
+	}
+	if (!in)
+	{
+		std::cout << "File " << filename << " is truncated" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/*
+ ******************** COMPARISON **************************
+ */
+
+struct Errors
+{
+	double charge;      // relative
+	double peak;        // relative
+	double peak_shift;  // seconds
+	double l2;          // relative
+};
+
+/*
+ * Errors of a waveform with time step dt against the golden one (time step
+ * golden_dt, dt a multiple of it)
+ */
+static Errors compare(const std::vector<double> &current, double dt, const std::vector<double> &golden, double golden_dt)
+{
+	// Golden rebinned to the time step of the waveform
+	int factor = std::max(1, (int) std::lround(dt/golden_dt));
+	std::vector<double> reference(golden.size()/factor, 0.);
+	for (unsigned int j = 0; j < reference.size(); j++)
+	{
+		for (int f = 0; f < factor; f++) reference[j] += golden[j*factor + f]/factor;
+	}
+	unsigned int n = std::min(reference.size(), current.size());
+
+	double q = 0., q_ref = 0., diff2 = 0., norm2 = 0.;
+	unsigned int peak = 0, peak_ref = 0;
+	for (unsigned int j = 0; j < n; j++)
+	{
+		q += current[j]*dt;
+		q_ref += reference[j]*dt;
+		diff2 += (current[j] - reference[j])*(current[j] - reference[j]);
+		norm2 += reference[j]*reference[j];
+		if (std::fabs(current[j]) > std::fabs(current[peak])) peak = j;
+		if (std::fabs(reference[j]) > std::fabs(reference[peak_ref])) peak_ref = j;
+	}
+
+	Errors errors = {0., 0., 0., 0.};
+	if (n == 0) return errors;
+	double i_peak = std::fabs(current[peak]), i_peak_ref = std::fabs(reference[peak_ref]);
+	errors.charge = (q_ref != 0.) ? std::fabs(q - q_ref)/std::fabs(q_ref) : std::fabs(q);
+	errors.peak = (i_peak_ref != 0.) ? std::fabs(i_peak - i_peak_ref)/i_peak_ref : i_peak;
+	errors.peak_shift = std::fabs((double) peak - (double) peak_ref)*dt;
+	errors.l2 = (norm2 != 0.) ? std::sqrt(diff2/norm2) : std::sqrt(diff2);
+	return errors;
+}
+
+struct GoldenResult
+{
+	std::string name;
+	std::string mode;
+	double solve_seconds;
+	double drift_seconds;
+	double speedup;
+	Errors errors;     // worst point of the case
+	bool pass;
+};
+
+/*
+ * Checks the tangent-linear derivatives of the currents (SMSDetector::
+ * solve_d_f_grad_sensitivities, CarrierCollection::simulate_drift_sensitivity)
+ * against central finite differences of the drift, for y0, z1, the bias and
+ * the trapping time, on the irradiated Trilinear edge-TCT case with a coarse
+ * mesh. The error of every parameter is |d - d_fd| / |d_fd| (L2 over the
+ * waveform), worst point. Returns false if any is above tolerance
+ */
+static bool check_gradients(ThreadPool &pool, double tolerance)
+{
+	const int n_cells = ref_cells/2;
+	const int n_tSteps = (int) std::floor(ref_max_time / ref_dt);
+	const std::vector<double> depths = {50., 150., 250.};
+	std::vector<double> neff_param = {-25., 0.02, 0.22, 33., 0., 120., 220., ref_depth};
+	SMSDetector detector(ref_pitch, ref_width, ref_depth, 2, 'p', 'n', n_cells, n_cells, ref_temp, ref_trapping, 1.e15, neff_param, "Trilinear");
+	detector.set_operator_cache(true);
+	detector.set_voltages(ref_voltage, ref_v_depletion);
+	detector.solve_w_u();
+	detector.solve_w_f_grad();
+	detector.solve_d_u();
+	detector.solve_d_f_grad();
+	detector.get_mesh()->bounding_box_tree();
+
+	CarrierCollection collection(&detector);
+	collection.add_carriers_from_file(QString::fromUtf8("etct.carriers"), n_chunks);
+
+	// Tangent-linear: [y0, z1, bias] from the fields, then the trapping time
+	std::vector<int> params = {0, 5, SMSDetector::SENSITIVITY_BIAS};
+	std::vector<std::string> names = {"y0", "z1", "bias", "TrappingTime"};
+	detector.solve_d_f_grad_sensitivities(params);
+	std::vector< std::vector< std::valarray<double> > > tangent(depths.size());
+	for (unsigned int p = 0; p < depths.size(); p++)
+	{
+		std::valarray<double> curr((size_t) n_tSteps);
+		collection.simulate_drift_sensitivity(ref_dt, ref_max_time, ref_edge_x, depths[p], curr, tangent[p], &pool);
+	}
+
+	// Current of a point for the fields solved last, with one trapping time for both types
+	auto current = [&](double depth, double trapping, std::valarray<double> &curr)
+	{
+		TrappingDecomposition decomposition;
+		collection.simulate_drift(ref_dt, ref_max_time, ref_edge_x, depth, decomposition, &pool);
+		std::valarray<double> i_elec((size_t) n_tSteps), i_hole((size_t) n_tSteps);
+		decomposition.get_current(trapping, trapping, i_elec, i_hole);
+		curr.resize(n_tSteps);
+		curr = i_elec + i_hole;
+	};
+	// Fields for the parameters moved by delta (0 restores them)
+	auto solve = [&](int param, double delta)
+	{
+		std::vector<double> neff = neff_param;
+		double voltage = ref_voltage;
+		if (param == SMSDetector::SENSITIVITY_BIAS) voltage += delta;
+		else neff[param] += delta;
+		detector.set_neff_param(neff);
+		detector.set_voltages(voltage, ref_v_depletion);
+		detector.solve_d_u();
+		detector.solve_d_f_grad();
+	};
+	auto rel_error = [](const std::valarray<double> &d, const std::valarray<double> &d_fd)
+	{
+		double diff = 0., norm = 0.;
+		for (unsigned int j = 0; j < d.size(); j++)
+		{
+			diff += (d[j] - d_fd[j])*(d[j] - d_fd[j]);
+			norm += d_fd[j]*d_fd[j];
+		}
+		return (norm > 0.) ? std::sqrt(diff/norm) : std::sqrt(diff);
+	};
+
+	// Steps: the fields are linear in y0 and the bias, z1 moves one cell
+	std::vector<double> steps = {1., detector.get_cell_size(), 1., 1.e-3*ref_trapping};
+	std::vector<double> worst(names.size(), 0.);
+	for (unsigned int k = 0; k < names.size(); k++)
+	{
+		for (unsigned int p = 0; p < depths.size(); p++)
+		{
+			std::valarray<double> plus, minus;
+			if (k < params.size())
+			{
+				solve(params[k], steps[k]);
+				current(depths[p], ref_trapping, plus);
+				solve(params[k], -steps[k]);
+				current(depths[p], ref_trapping, minus);
+				solve(params[k], 0.);
+			}
+			else
+			{
+				current(depths[p], ref_trapping + steps[k], plus);
+				current(depths[p], ref_trapping - steps[k], minus);
+			}
+			std::valarray<double> d_fd = (plus - minus)/(2.*steps[k]);
+			worst[k] = std::max(worst[k], rel_error(tangent[p][k], d_fd));
+		}
+	}
+
+	bool pass = true;
+	std::printf("%-14s %10s %12s %5s\n", "parameter", "step", "rel. error", "");
+	for (unsigned int k = 0; k < names.size(); k++)
+	{
+		std::printf("%-14s %10.3g %12.3e %5s\n", names[k].c_str(), steps[k], worst[k], (worst[k] <= tolerance) ? "ok" : "FAIL");
+		pass = pass && worst[k] <= tolerance;
+	}
+	std::printf("Tolerance: %.2e (worst of the depths", tolerance);
+	for (unsigned int p = 0; p < depths.size(); p++) std::printf(" %g", depths[p]);
+	std::printf(" um)\n");
+	return pass;
+}
+
+int main(int argc, char *argv[])
+{
+	std::string golden_file = "golden.wfm", output = "golden_report.json", mode_list;
+	bool record = false, gradients = false;
+	int nThreads = std::max(1u, std::thread::hardware_concurrency());
+	double tol_charge = 0.02, tol_peak = 0.05, tol_l2 = 0.05, tol_gradient = 0.05;
+	for (int a = 1; a < argc; a++)
+	{
+		std::string arg = argv[a];
+		if (arg == "--record") record = true;
+		else if (arg == "--golden" && a + 1 < argc) golden_file = argv[++a];
+		else if (arg == "--output" && a + 1 < argc) output = argv[++a];
+		else if (arg == "--modes" && a + 1 < argc) mode_list = argv[++a];
+		else if (arg == "--threads" && a + 1 < argc) nThreads = std::atoi(argv[++a]);
+		else if (arg == "--tol-charge" && a + 1 < argc) tol_charge = std::atof(argv[++a]);
+		else if (arg == "--tol-peak" && a + 1 < argc) tol_peak = std::atof(argv[++a]);
+		else if (arg == "--tol-l2" && a + 1 < argc) tol_l2 = std::atof(argv[++a]);
+		else if (arg == "--check-gradients") gradients = true;
+		else if (arg == "--tol-gradient" && a + 1 < argc) tol_gradient = std::atof(argv[++a]);
+		else
+		{
+			std::cout << "Usage: " << argv[0] << " [--record] [--golden file] [--modes a,b] [--threads n] [--output file.json] [--tol-charge x] [--tol-peak x] [--tol-l2 x]" << std::endl;
+			std::cout << "       " << argv[0] << " --check-gradients [--threads n] [--tol-gradient x]" << std::endl;
+			std::cout << "Modes:";
+			for (int m = 0; m < n_modes; m++) std::cout << " " << modes[m].name;
+			std::cout << std::endl;
+			return 1;
+		}
+	}
+
+	// Modes to run, the exact one always (reference of the speedup)
+	std::vector<int> selected = {0};
+	if (!record)
+	{
+		for (int m = 1; m < n_modes; m++)
+		{
+			if (mode_list.empty() || ("," + mode_list + ",").find("," + modes[m].name + ",") != std::string::npos) selected.push_back(m);
+		}
+	}
+
+	parameters["allow_extrapolation"] = true;
+	ThreadPool pool(nThreads);
+	std::vector<GoldenCase> cases = get_cases();
+
+	if (gradients)
+	{
+		if (check_gradients(pool, tol_gradient)) return 0;
+		std::cout << "Error: the tangent-linear derivatives do not match the finite differences" << std::endl;
+		return 1;
+	}
+
+	if (record)
+	{
+		std::vector<GoldenWaveform> golden;
+		for (unsigned int k = 0; k < cases.size(); k++)
+		{
+			std::vector< std::vector<double> > waveforms;
+			double solve_seconds = 0., drift_seconds = 0.;
+			std::cout << "Recording " << cases[k].name << std::endl;
+			if (!simulate_case(cases[k], modes[0], pool, waveforms, solve_seconds, drift_seconds)) return 1;
+			for (unsigned int p = 0; p < waveforms.size(); p++)
+			{
+				GoldenWaveform wf = {cases[k].name, p, ref_dt, waveforms[p]};
+				golden.push_back(wf);
+			}
+		}
+		if (!write_golden(golden_file, golden)) return 1;
+		std::cout << golden.size() << " golden waveforms written to " << golden_file << std::endl;
+		return 0;
+	}
+
+	std::vector<GoldenWaveform> golden;
+	if (!read_golden(golden_file, golden)) return 1;
+
+	std::vector<GoldenResult> results;
+	bool regression = false;
+	for (unsigned int k = 0; k < cases.size(); k++)
+	{
+		const GoldenCase &gc = cases[k];
+		// Golden waveforms of this case, by point
+		std::vector<const GoldenWaveform *> reference(gc.positions.size(), (const GoldenWaveform *) NULL);
+		for (unsigned int w = 0; w < golden.size(); w++)
+		{
+			if (golden[w].name == gc.name && golden[w].point < reference.size()) reference[golden[w].point] = &golden[w];
+		}
+		if (std::find(reference.begin(), reference.end(), (const GoldenWaveform *) NULL) != reference.end())
+		{
+			std::cout << "Case " << gc.name << " is missing from " << golden_file << " (record it again)" << std::endl;
+			regression = true;
+			continue;
+		}
+
+		double exact_seconds = 0.;
+		for (unsigned int s = 0; s < selected.size(); s++)
+		{
+			const EngineMode &mode = modes[selected[s]];
+			std::vector< std::vector<double> > waveforms;
+			GoldenResult result;
+			result.name = gc.name;
+			result.mode = mode.name;
+			if (!simulate_case(gc, mode, pool, waveforms, result.solve_seconds, result.drift_seconds)) return 1;
+			double seconds = result.solve_seconds + result.drift_seconds;
+			if (s == 0) exact_seconds = seconds;
+			result.speedup = (seconds > 0.) ? exact_seconds/seconds : 0.;
+
+			result.errors = {0., 0., 0., 0.};
+			for (unsigned int p = 0; p < waveforms.size(); p++)
+			{
+				Errors errors = compare(waveforms[p], ref_dt*mode.dt_factor, reference[p]->current, reference[p]->dt);
+				result.errors.charge = std::max(result.errors.charge, errors.charge);
+				result.errors.peak = std::max(result.errors.peak, errors.peak);
+				result.errors.peak_shift = std::max(result.errors.peak_shift, errors.peak_shift);
+				result.errors.l2 = std::max(result.errors.l2, errors.l2);
+			}
+			result.pass = result.errors.charge <= tol_charge && result.errors.peak <= tol_peak && result.errors.l2 <= tol_l2;
+			if (s == 0 && !result.pass) regression = true;
+			results.push_back(result);
+			std::printf("%-22s %-14s done in %.2f s\n", gc.name.c_str(), mode.name.c_str(), seconds);
+			std::fflush(stdout);
+		}
+	}
+
+	// Speed versus error
+	std::printf("\n%-22s %-14s %9s %9s %8s %10s %10s %10s %10s %5s\n", "case", "mode", "solve [s]", "drift [s]", "speedup", "charge", "peak", "shift [ps]", "L2", "");
+	for (unsigned int r = 0; r < results.size(); r++)
+	{
+		const GoldenResult &g = results[r];
+		std::printf("%-22s %-14s %9.3f %9.3f %8.2f %10.2e %10.2e %10.1f %10.2e %5s\n", g.name.c_str(), g.mode.c_str(), g.solve_seconds, g.drift_seconds, g.speedup,
+				g.errors.charge, g.errors.peak, 1.e12*g.errors.peak_shift, g.errors.l2, g.pass ? "ok" : "FAIL");
+	}
+	std::printf("Tolerances: charge %.2e, peak %.2e, L2 %.2e\n", tol_charge, tol_peak, tol_l2);
+
+	std::ofstream out(output);
+	out << "{\n";
+	out << "  \"golden\": \"" << golden_file << "\", \"threads\": " << nThreads << ",\n";
+	out << "  \"tolerances\": {\"charge\": " << tol_charge << ", \"peak\": " << tol_peak << ", \"l2\": " << tol_l2 << "},\n";
+	out << "  \"results\": [\n";
+	for (unsigned int r = 0; r < results.size(); r++)
+	{
+		const GoldenResult &g = results[r];
+		out << "    {\"case\": \"" << g.name << "\", \"mode\": \"" << g.mode << "\", \"solve_seconds\": " << g.solve_seconds << ", \"drift_seconds\": " << g.drift_seconds
+			<< ", \"speedup\": " << g.speedup << ", \"charge_error\": " << g.errors.charge << ", \"peak_error\": " << g.errors.peak
+			<< ", \"peak_shift_seconds\": " << g.errors.peak_shift << ", \"l2_error\": " << g.errors.l2 << ", \"pass\": " << (g.pass ? "true" : "false") << "}"
+			<< (r + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	std::cout << "Results written to " << output << std::endl;
+
+	if (regression) std::cout << "Error: the exact path does not reproduce the golden waveforms" << std::endl;
+	return regression ? 1 : 0;
+}
@@ -11,34 +11,39 @@
 
 #include <fstream> 
 #include <iterator>
-#include <thread>
 #include <limits>  // std::numeric_limits
 #include <functional>
 
-// Declaring external convolution function and threaded function
-extern TH1D *H1DConvolution( TH1D *htct , Double_t Cend=0. , int tid=0) ; 
-void call_from_thread(CarrierCollection & cCollection, double dt, double max_time, double shift_x, double y_shifts, std::vector<double> curr_elec, std::vector<double> curr_hole, int thr_id);
+#include <thread>
+
+#include "ThreadPool.h"
+#include "ResultWriter.h"
+#include "ElectronicsChain.h"
+#include "TransferFunction.h"
+#include "ScanFile.h"
+#include "ScanTree.h"
+#include "Checkpoint.h"
+#include "ResultCache.h"
+#include "Profiler.h"
+#include "Progress.h"
 
-//------------
 
-// Threaded function to call carrier_collection
-void call_from_thread(CarrierCollection & cCollection, double dt, double max_time, double shift_x, double y_shifts, std::vector<double> curr_elec, std::vector<double> curr_hole, int id)
-{
-	int nTimeSteps = curr_elec.size();
-	std::valarray<double> i_elec((size_t) nTimeSteps);	
-	std::valarray<double> i_hole((size_t) nTimeSteps);
-	cCollection.simulate_drift( dt, max_time, shift_x, y_shifts, i_elec, i_hole, id);
-	curr_elec.assign(std::begin(i_elec), std::end(i_elec));
-	curr_hole.assign(std::begin(i_hole), std::end(i_hole));
-}
 /*
  ************** MAIN FUNCTION OF TRACS ***************
  *****************************************************
  ********** AKA: where the magic happens *************
  */
 
-int main()
+int main(int argc, char *argv[])
 {
+	// ./TRACS --resume continues a scan from its checkpoint, --quiet prints no progress
+	bool resume = false, quiet = false;
+	for (int a = 1; a < argc; a++)
+	{
+		if (std::string(argv[a]) == "--resume") resume = true;
+		if (std::string(argv[a]) == "--quiet") quiet = true;
+	}
+
 	// Declare variables with default values
 	double pitch = 0,
 		   width = 0,
@@ -79,8 +84,12 @@ int main()
 	std::string file_carriers = "etct.carriers";
 	utilities::parse_config_file("Config.TRACS", file_carriers, depth, width,  pitch, nns, temp, trapping, fluence, nThreads, n_cells_x, n_cells_y, bulk_type, implant_type, waveLength, scanType, C, dt, max_time, vInit, deltaV, vMax, v_depletion, zInit, zMax, deltaZ, yInit, yMax, deltaY, neff_param, neffType);
 	
-	// Create vector of (n-1) threads as the nth thread is the main thread
-	std::thread t[nThreads-1];
+	// Persistent pool of workers reused for the whole scan
+	if (nThreads < 1) nThreads = 1;
+	ThreadPool pool(nThreads);
+	// Carriers are split in more chunks than threads so idle workers can steal 
+	// work when the carriers of some chunk leave the detector early
+	int nChunks = 4*nThreads;
 
 	// Decide if there is trapping and make corresponding string
 	std::string trap, start;
@@ -115,6 +124,9 @@ int main()
 	parameters["allow_extrapolation"] = true;
 
 	SMSDetector detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
+	double trapping_e = trapping, trapping_h = trapping; // electrons and holes may have their own
+	utilities::get_trapping_times("Config.TRACS", trapping, trapping_e, trapping_h);
+	detector.set_trapping_time(trapping_e, trapping_h);
 
 	detector.set_voltages(vInit, v_depletion);
 
@@ -129,14 +141,35 @@ int main()
 	QString filename = QString::fromUtf8(file_carriers.c_str());
 	CarrierCollection * carrier_collection = new CarrierCollection(dec_pointer);
 
-	// carrier_collection is now a #thr-dimensional vector
-	carrier_collection->add_carriers_from_file(filename, nThreads); // input #threads
+	// carrier_collection is now a #chunks-dimensional vector
+	{
+		Profiler::Scope scope(Profiler::CARRIER_READ);
+		carrier_collection->add_carriers_from_file(filename, nChunks); // input #chunks
+	}
+
+	// Optional: induced current from weighting potential differences (no weighting field needed)
+	std::string ramoCurrent = "Field";
+	utilities::get_config_value("Config.TRACS", "RamoCurrent", ramoCurrent);
+	bool use_w_potential = (ramoCurrent == "Potential");
+	carrier_collection->set_use_w_potential(use_w_potential);
 
 	// init arrays
-	// These should are now #thr-dimensioal vectors
 	std::valarray<double> i_total((size_t) n_tSteps);
-	std::vector< std::vector<double> > vva_elec(nThreads, std::vector<double>(n_tSteps)); // vector of size N-threads where every element is a vector
-	std::vector< std::vector<double> > vva_hole(nThreads, std::vector<double>(n_tSteps)); // same as above for holes current
+	// Total current of every (y, z) point. Two sets (double buffer): one is
+	// filled while the other is written out
+	int nPoints = (n_ySteps+1)*(n_zSteps+1);
+	std::vector< std::valarray<double> > point_total(2*nPoints, std::valarray<double>((size_t) n_tSteps));
+	// Electron/hole currents of the (y, z, chunk) tasks in flight. The task that
+	// finishes the last chunk of a point sums them in chunk order, so the result
+	// does not depend on the task scheduling, and gives the buffers back.
+	// Submission waits for free buffers: their number does not grow with the scan
+	int nBuffers = 2*nChunks;
+	std::vector< std::valarray<double> > vva_elec(nBuffers, std::valarray<double>((size_t) n_tSteps));
+	std::vector< std::valarray<double> > vva_hole(nBuffers, std::valarray<double>((size_t) n_tSteps));
+	std::vector<int> free_buffers;
+	for (int b = nBuffers - 1; b >= 0; b--) free_buffers.push_back(b);
+	std::mutex mtx_buffers;
+	std::condition_variable cv_buffers;
 	
 	// Shifting  of Charge Carriers
 	// the laser gets shifted in x and/or z direction depending on the arrays 
@@ -160,12 +193,9 @@ int main()
 	{
 		y_shifts[i] = (i*deltaY)+yInit;
 	}
-//	TString hist_name = "i_ramo";
-//	TString hist_title = "i_ramo";
-	TH2D i_ramo = TH2D("i_ramo", "i_ramo", n_tSteps, 0.0, max_time, n_zSteps + 1, zInit, zMax);
-
 	hnoconv = new TH1D("hnoconv","Ramo current",n_tSteps, 0.0, max_time);
-	hconv   = new TH1D("hconv","Amplifier convoluted",n_tSteps, 0.0, max_time);
+	// Same binning as the output of H1DConvolution, reused for every point
+	hconv   = new TH1D("hconv","Amplifier convoluted",2*n_tSteps, -max_time, max_time);
 
 	// Convert Z to milimeters
 	std::vector<double> z_chifs(n_zSteps+1);
@@ -181,100 +211,257 @@ int main()
 	std::string hetct_conv_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+"_conv.hetct";
 	std::string hetct_noconv_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+"_noconv.hetct";
 	
-	// write header for data analysis
-	utilities::write_to_hetct_header(hetct_conv_filename, detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
-	utilities::write_to_hetct_header(hetct_noconv_filename, detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+	// Output as .hetct text, binary .tscan files (see ScanFile.h) or both
+	std::string outputFormat = "hetct";
+	utilities::get_config_value("Config.TRACS", "OutputFormat", outputFormat);
+	bool write_hetct = (outputFormat != "binary");
+	bool write_binary = (outputFormat == "binary" || outputFormat == "both");
+
+	// Optional extra front-end shaping, written to its own file
+	std::string electronics = "None";
+	utilities::get_config_value("Config.TRACS", "Electronics", electronics);
+	ElectronicsChain chain(electronics);
+	std::string hetct_shaped_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+"_shaped.hetct";
 
-	//Loop on voltages
-	
-	for (int k = 0; k < n_vSteps + 1; k++) 
+	// write header for data analysis
+	if (write_hetct)
 	{
-		detector.solve_w_u();
-		detector.set_voltages(voltages[k], v_depletion);
-		detector.solve_d_u();
-		detector.solve_w_f_grad();
-		detector.solve_d_f_grad();
-		detector.get_mesh()->bounding_box_tree();
+		utilities::write_to_hetct_header(hetct_conv_filename, &detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+		utilities::write_to_hetct_header(hetct_noconv_filename, &detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+		if (!chain.is_empty()) utilities::write_to_hetct_header(hetct_shaped_filename, &detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+	}
+	std::string text = utilities::hetct_header(&detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+	std::string base = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType;
+	ScanFileWriter scan_conv, scan_noconv, scan_shaped;
+	if (write_binary)
+	{
+		scan_conv.open(base+"_conv.tscan", text, voltages, y_shifts, z_shifts, {"conv"}, 2*n_tSteps, max_time/n_tSteps, -max_time, detector.get_temperature());
+		scan_noconv.open(base+"_noconv.tscan", text, voltages, y_shifts, z_shifts, {"noconv"}, n_tSteps, max_time/n_tSteps, 0.0, detector.get_temperature());
+		if (!chain.is_empty()) scan_shaped.open(base+"_shaped.tscan", text, voltages, y_shifts, z_shifts, {"shaped"}, n_tSteps, max_time/n_tSteps, 0.0, detector.get_temperature());
+	}
 
-		Function * d_f_grad = detector.get_d_f_grad();
-		  // Plot solution
-		//plot((*d_f_grad)[1],"Drifting Field (Y)","auto");
-//		interactive();
-		
+	// Rows are formatted and written to disk by a background thread
+	ResultWriter results;
+
+	// Single ROOT file of the run, one tree entry per point
+	std::string rootCompression = "101";
+	utilities::get_config_value("Config.TRACS", "RootCompression", rootCompression);
+	ScanTree tree;
+	tree.add_stage("i_ramo", n_tSteps, 0.0);
+	tree.add_stage("i_conv", 2*n_tSteps, -max_time);
+	if (!chain.is_empty()) tree.add_stage("i_shaped", n_tSteps, 0.0);
+	tree.open(base+".root", max_time/n_tSteps, text, std::atoi(rootCompression.c_str()));
+
+	// Every finished point goes to the checkpoint, written to disk every
+	// CheckpointInterval seconds (0 disables it). Outputs are rebuilt from it on resume
+	std::string checkpointInterval = "60";
+	utilities::get_config_value("Config.TRACS", "CheckpointInterval", checkpointInterval);
+	double ckp_interval = std::atof(checkpointInterval.c_str());
+	Checkpoint checkpoint;
+	if (ckp_interval > 0)
+	{
+		uint64_t key = Checkpoint::inputs_key("Config.TRACS", file_carriers);
+		checkpoint.open(base+".ckp", (n_vSteps+1)*(n_ySteps+1)*(n_zSteps+1), n_tSteps, key, resume, ckp_interval);
+	}
+	else if (resume) std::cout << "CheckpointInterval is 0, nothing to resume" << std::endl;
+
+	// Ramo currents of previous runs with the same inputs are reused from the 
+	// result cache (ResultCache, None disables it)
+	std::string resultCache = "None";
+	utilities::get_config_value("Config.TRACS", "ResultCache", resultCache);
+	ResultCache cache;
+	if (resultCache != "None") cache.open(resultCache);
+	uint64_t inputs = ResultCache::inputs_key("Config.TRACS", file_carriers);
+	auto point_key = [&](int k, int l, int i) { return ResultCache::point_key(inputs, voltages[k], y_shifts[l], z_shifts[i]); };
+
+	// Completed points, printed every ProgressInterval seconds (0 or --quiet: nothing)
+	std::string progressInterval = "10";
+	utilities::get_config_value("Config.TRACS", "ProgressInterval", progressInterval);
+	Progress progress;
+	progress.start((n_vSteps+1)*(n_ySteps+1)*(n_zSteps+1), quiet ? 0. : std::atof(progressInterval.c_str()));
+
+	// Output stage for voltage k (convolution and files), uses buffer set buf
+	auto write_voltage = [&](int k, int buf)
+	{
+		Profiler::set_thread_name("writer");
 		// Loop on Y-axis
 		for (int l = 0; l < n_ySteps + 1; l++) 
 		{
-			std::string ircName = "i_rc_"+std::to_string(std::floor(y_shifts[l]))+"_y";
-			TH2D *i_rc = new TH2D(ircName.c_str(), ircName.c_str(), hconv->GetNbinsX(), hconv->GetXaxis()->GetXmin(),hconv->GetXaxis()->GetXmax() , n_zSteps + 1, zInit, zMax);
+			std::vector< std::valarray<double> > i_ramo(n_zSteps + 1);
+			std::vector< std::valarray<double> > i_shaped(chain.is_empty() ? 0 : n_zSteps + 1);
+			std::vector< std::vector<double> > i_conv(n_zSteps + 1, std::vector<double>(2*n_tSteps));
 			// Loop on depth
 			for (int i = 0; i < n_zSteps + 1; i++) 
 			{
-				std::cout << "Height " << z_shifts[i] << " of " << z_shifts.back()  <<  " || Y Position " << y_shifts[l] << " of " << y_shifts.back() << " || Voltage " << voltages[k] << " of " << voltages.back() << std::endl;
-
-				i_total= 0;
-
-				// Launch all threads but one
-				for (int thrID = 0; thrID < nThreads-1; thrID++) 
+				// calculate total current (or take it from the checkpoint or the cache)
+				int point = (k*(n_ySteps+1) + l)*(n_zSteps+1) + i;
+				const double *restored = checkpoint.get_waveform(point);
+				if (restored)
 				{
-					vva_hole[thrID] = std::vector<double>(n_tSteps, 0);
-					vva_elec[thrID] = std::vector<double>(n_tSteps, 0);
-
-					// Simulate the drift of both electrons and holes
-					// for loop over threads, each thread simulates the corresponding carrier_list (thr_id)
-					t[thrID]= std::thread(call_from_thread, std::ref(*carrier_collection), dt, max_time, y_shifts[l], z_shifts[i], vva_elec[thrID], vva_hole[thrID], thrID); 
-
-					// input should now include thr_id and only a 1-D member of i_whatevercarrier
+					i_total = std::valarray<double>(restored, n_tSteps);
 				}
-				vva_hole[nThreads-1] = std::vector<double>(n_tSteps, 0);
-				vva_elec[nThreads-1] = std::vector<double>(n_tSteps, 0);
-
-				//Launch the last thread AKA main thread
-				std::valarray<double> i_elec((size_t) n_tSteps);	
-				std::valarray<double> i_hole((size_t) n_tSteps);
-				carrier_collection->simulate_drift( dt, max_time, y_shifts[l], z_shifts[i], i_elec, i_hole, nThreads-1);
-				vva_elec[nThreads-1].assign(std::begin(i_elec), std::end(i_elec));
-				vva_hole[nThreads-1].assign(std::begin(i_hole), std::end(i_hole));
-
-				// Join all threads
-				for (int id = 0; id < nThreads-1; id++)
+				else if (cache.get(point_key(k, l, i), &i_total[0], n_tSteps)) {}
+				else
 				{
-					t[id].join();	//join all threads
-				}
-				// calculate totalcurrent
-				for (int id = 0; id < nThreads; id++)
-				{
-					for (int tPos = 0; tPos < n_tSteps; tPos++) 
-					{
-						i_total[tPos] = i_total[tPos] + (vva_hole[id][tPos] + vva_elec[id][tPos]);
-					}
+					i_total = point_total[buf*nPoints + l*(n_zSteps+1) + i];
+					checkpoint.save(point, &i_total[0]);
+					cache.put(point_key(k, l, i), &i_total[0], n_tSteps);
 				}
 				// Compute time + format vectors for writting to file
+				i_ramo[i] = i_total;
+				std::vector<double> &conv = i_conv[i];
 				for (int j=0; j < n_tSteps; j++)
 				{
-					i_ramo.SetBinContent(j+1,i+1, i_total[j] );
 					hnoconv->SetBinContent( j+1 , i_total[j] );
 				}
-				int t=0;
-				hconv = H1DConvolution( hnoconv , C*1.e12);
-				for (int j = 1; j <=hconv->GetNbinsX(); j++)
 				{
-					i_rc->SetBinContent(j, i+1 , hconv->GetBinContent(j) );
+					Profiler::Scope scope(Profiler::CONVOLUTION);
+					TransferFunction::get_default()->convolve(&i_total[0], n_tSteps, max_time/n_tSteps, conv.data());
+				}
+				for (int j = 0; j < 2*n_tSteps; j++)
+				{
+					hconv->SetBinContent( j+1 , conv[j] );
 				}
 				// Write file from TH1D
-				utilities::write_to_file_row(hetct_conv_filename, hconv, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
-				utilities::write_to_file_row(hetct_noconv_filename, hnoconv, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
+				Profiler::Scope scope(Profiler::WRITE);
+				if (write_hetct)
+				{
+					results.write_row(hetct_conv_filename, hconv, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
+					results.write_row(hetct_noconv_filename, hnoconv, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
+				}
+				scan_conv.write_waveform(conv.data());
+				scan_noconv.write_waveform(&i_total[0]);
+				if (!chain.is_empty()) i_shaped[i] = i_total;
 			} // End of Z Loop
-			 std::string root_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_"+voltage+"V_"+neigh+"nns_"+scanType+".root";
-			 // std::string hetct_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+".hetct";
-
-			// Open a ROOT file to save result
-			TFile *tfile = new TFile(root_filename.c_str(), "RECREATE" );
-			i_ramo.Write();
-			i_rc->Write();
-			tfile->Close();
-			delete i_rc;
+			// All depths shaped in one pass
+			if (!chain.is_empty())
+			{
+				{
+					Profiler::Scope scope(Profiler::SHAPING);
+					chain.process(i_shaped, dt);
+				}
+				Profiler::Scope scope(Profiler::WRITE);
+				for (int i = 0; i < n_zSteps + 1; i++)
+				{
+					if (write_hetct) results.write_row(hetct_shaped_filename, &i_shaped[i][0], n_tSteps, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
+					scan_shaped.write_waveform(&i_shaped[i][0]);
+				}
+			}
+			// One tree entry per depth
+			Profiler::Scope scope(Profiler::WRITE);
+			for (int i = 0; i < n_zSteps + 1; i++)
+			{
+				std::vector<const double *> waveforms = {&i_ramo[i][0], i_conv[i].data()};
+				if (!chain.is_empty()) waveforms.push_back(&i_shaped[i][0]);
+				tree.fill(voltages[k], y_shifts[l], z_shifts[i], detector.get_temperature(), waveforms);
+			}
 		} // End of Y loop
+	};
+
+	// Weighting potential/field do not depend on the bias: solve them once
+	{
+		Profiler::Scope scope(Profiler::FIELD_SOLVE);
+		detector.solve_w_u();
+		if (!use_w_potential) detector.solve_w_f_grad();
+		detector.set_voltages(voltages[0], v_depletion);
+		detector.solve_d_u();
+		detector.solve_d_f_grad();
+		detector.get_mesh()->bounding_box_tree();
+	}
+
+	// Chunks still drifting of every (y, z) of the current voltage and their
+	// buffers: the task of the last one sums them and counts the point as done
+	std::vector< std::atomic<int> > chunks_left(nPoints);
+	std::vector< std::vector<int> > chunk_buffers(nPoints, std::vector<int>(nChunks));
+
+	//Loop on voltages
+	// Pipelined: the output of voltage k is written while the fields of 
+	// voltage k+1 are solved and the carriers drift in them. The solve itself 
+	// never overlaps the drift (DOLFIN/PETSc are not thread safe, see 
+	// SMSDetector.h); the writer does not touch the detector fields
+	std::thread writer;
+	for (int k = 0; k < n_vSteps + 1; k++) 
+	{
+		// Drift every (y, z, chunk) in the pool
+		int buf = k%2;
+		for (int l = 0; l < n_ySteps + 1; l++) 
+		{
+			for (int i = 0; i < n_zSteps + 1; i++) 
+			{
+				// Already in the checkpoint or the cache
+				if (checkpoint.is_done((k*(n_ySteps+1) + l)*(n_zSteps+1) + i) || cache.contains(point_key(k, l, i), n_tSteps))
+				{
+					progress.skip();
+					continue;
+				}
+				int point = l*(n_zSteps+1) + i;
+				std::atomic<int> *left = &chunks_left[point];
+				left->store(nChunks);
+				for (int c = 0; c < nChunks; c++)
+				{
+					int b = 0;
+					{
+						std::unique_lock<std::mutex> lock(mtx_buffers);
+						cv_buffers.wait(lock, [&free_buffers]{ return !free_buffers.empty(); });
+						b = free_buffers.back();
+						free_buffers.pop_back();
+					}
+					chunk_buffers[point][c] = b;
+					vva_elec[b] = 0.;
+					vva_hole[b] = 0.;
+					double y_shift = y_shifts[l], z_shift = z_shifts[i];
+					pool.submit([=, &vva_elec, &vva_hole, &point_total, &chunk_buffers, &free_buffers, &mtx_buffers, &cv_buffers, &progress]()
+					{
+						{
+							Profiler::Scope scope(Profiler::DRIFT);
+							carrier_collection->simulate_drift( dt, max_time, y_shift, z_shift, vva_elec[b], vva_hole[b], c);
+						}
+						if (--(*left) > 0) return;
+						// Last chunk of the point: fixed order sum
+						std::valarray<double> &total = point_total[buf*nPoints + point];
+						total = 0.;
+						for (int cc = 0; cc < nChunks; cc++)
+						{
+							int bb = chunk_buffers[point][cc];
+							total += vva_elec[bb] + vva_hole[bb];
+						}
+						{
+							std::lock_guard<std::mutex> lock(mtx_buffers);
+							free_buffers.insert(free_buffers.end(), chunk_buffers[point].begin(), chunk_buffers[point].end());
+						}
+						cv_buffers.notify_all();
+						progress.add();
+					});
+				}
+			}
+		}
+		pool.wait();
+
+		// Output of k-1 must be done before its buffer is reused by k+1
+		if (writer.joinable()) writer.join();
+		writer = std::thread(write_voltage, k, buf);
+
+		// Fields of the next voltage, no carrier is drifting now
+		if (k < n_vSteps)
+		{
+			Profiler::Scope scope(Profiler::FIELD_SOLVE);
+			detector.set_voltages(voltages[k+1], v_depletion);
+			detector.solve_d_u();
+			detector.solve_d_f_grad();
+		}
 	} // End of V loop
+	if (writer.joinable()) writer.join();
+	progress.finish();
+	results.close();
+	scan_conv.close();
+	scan_noconv.close();
+	scan_shaped.close();
+	tree.close();
+	cache.close();
+	// Run completed: the checkpoint is not needed anymore
+	checkpoint.finish();
 	delete carrier_collection;
+	Profiler::print_summary();
+	Profiler::write_json(base + "_profile.json");
 	return 0;
 }
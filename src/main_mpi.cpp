@@ -0,0 +1,512 @@
+#include "SMSDetector.h"
+#include "Source.h"
+#include "utilities.h"
+#include "Carrier.h"
+#include "CarrierCollection.h"
+#include "ThreadPool.h"
+#include "ResultWriter.h"
+#include "ElectronicsChain.h"
+#include "TransferFunction.h"
+#include "ScanFile.h"
+#include "ScanTree.h"
+#include "Checkpoint.h"
+#include "ResultCache.h"
+#include "Profiler.h"
+#include "Progress.h"
+
+#include <mpi.h>
+
+#include <TFile.h>
+#include <TH2D.h> // 2 Dimensional ROOT histogram
+#include <TH1D.h> // 1 Dimesional ROOT histogram
+
+#include <map>
+#include <algorithm>
+#include <limits>  // std::numeric_limits
+#include <functional>
+
+
+/*
+ ************** DISTRIBUTED (MPI) SCAN OF TRACS ***************
+ *
+ * Same scan as the TRACS executable, split over MPI ranks:
+ *
+ *  - Rank 0 (master) hands out work units and writes the results. A unit is
+ *    one (voltage, y) pair, i.e. a full depth (z) scan.
+ *  - Every other rank (worker) drifts the carriers of the units it is given
+ *    with its own pool of NumberOfThreads threads and sends back the
+ *    (not convoluted) total current for every z.
+ *
+ * Scheduling is dynamic: a worker asks for a new unit whenever it finishes
+ * one. Workers keep the units of the voltage whose fields they hold; a new
+ * voltage is only started (and its fields solved) when there are no units
+ * left of the current one, so every rank solves fields only for the voltages
+ * it works on. When no voltage is left untouched, idle workers help with
+ * the voltage with most units left.
+ *
+ * Results may arrive in any order, the master keeps them until all the
+ * previous units are in and then writes them in (voltage, y, z) order, so the
+ * output files are identical to the ones of a single process run.
+ *
+ * The master also keeps the checkpoint of the run and the result cache. With
+ * --resume, the units found complete in the checkpoint (or in the cache) are
+ * written from it and not handed out again.
+ *
+ * Usage: mpirun -np N ./TRACS-MPI [--resume] [--quiet]  (N-1 workers, N=1 runs
+ * everything in rank 0)
+ */
+
+// Message tags
+enum { TAG_READY = 1, TAG_WORK, TAG_RESULT };
+
+int main(int argc, char *argv[])
+{
+	// Only the main thread of every rank makes MPI calls
+	int provided = 0;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	int rank = 0, size = 1;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	// Declare variables with default values
+	double pitch = 0,
+		   width = 0,
+		   depth = 0,
+		   temp = 0,
+		   trapping = 0,
+		   fluence = 0,
+		   C = 0,
+		   dt = 0,
+		   max_time = 0,
+		   vInit = 0,
+		   deltaV = 0,
+		   vMax = 0,
+		   v_depletion = 0,
+		   deltaZ = 0,
+		   zInit = 0.,
+		   zMax = depth,
+		   yInit = 0.,
+		   yMax = 0,
+		   deltaY = 5.;
+
+	int nThreads = 0,
+		nns = 0,
+		n_cells_y = 0,
+		n_cells_x = 0,
+		waveLength = 0,
+		n_vSteps = 0,
+		n_zSteps = 0,
+		n_ySteps = 0;
+
+	char bulk_type = '\0',
+		 implant_type = '\0';
+
+	std::string scanType = "defaultString";
+	std::string neffType = "defaultString";
+	std::vector<double> neff_param(8,0.);
+
+	std::string file_carriers = "etct.carriers";
+	utilities::parse_config_file("Config.TRACS", file_carriers, depth, width,  pitch, nns, temp, trapping, fluence, nThreads, n_cells_x, n_cells_y, bulk_type, implant_type, waveLength, scanType, C, dt, max_time, vInit, deltaV, vMax, v_depletion, zInit, zMax, deltaZ, yInit, yMax, deltaY, neff_param, neffType);
+	if (nThreads < 1) nThreads = 1;
+	int nChunks = 4*nThreads;
+
+	// Decide if there is trapping and make corresponding string
+	std::string trap, start;
+	if (fluence <= 0) // if no fluence -> no trapping
+	{
+		trapping = std::numeric_limits<double>::max();
+		trap = "NOtrapping";
+		start = "NOirrad";
+	}
+	else
+	{
+		trap = std::to_string((int) std::floor(1.e9*trapping));
+		start = "irrad";
+	}
+
+	n_zSteps = (int) std::floor((zMax-zInit)/deltaZ); // Simulation Steps
+	n_vSteps = (int) std::floor((vMax-vInit)/deltaV);
+	n_ySteps = (int) std::floor((yMax-yInit)/deltaY);
+	int n_tSteps = (int) std::floor(max_time / dt);
+	int nV = n_vSteps + 1, nY = n_ySteps + 1, nZ = n_zSteps + 1;
+	int nUnits = nV*nY;
+
+	std::vector<double>  z_shifts(nZ);
+	std::vector<double>  y_shifts(nY);
+	std::vector<double>  voltages(nV);
+	for (int i = 0; i < nV; i++) voltages[i] = (i*deltaV)+vInit;
+	for (int i = 0; i < nZ; i++) z_shifts[i] = (i*deltaZ)+zInit;
+	for (int i = 0; i < nY; i++) y_shifts[i] = (i*deltaY)+yInit;
+
+	parameters["allow_extrapolation"] = true;
+
+	// Every rank builds its own (serial) detector
+	SMSDetector detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
+	double trapping_e = trapping, trapping_h = trapping; // electrons and holes may have their own
+	utilities::get_trapping_times("Config.TRACS", trapping, trapping_e, trapping_h);
+	detector.set_trapping_time(trapping_e, trapping_h);
+	detector.set_voltages(vInit, v_depletion);
+
+	std::string ramoCurrent = "Field";
+	utilities::get_config_value("Config.TRACS", "RamoCurrent", ramoCurrent);
+	bool use_w_potential = (ramoCurrent == "Potential");
+
+	// Drift machinery, only built by the ranks that compute
+	ThreadPool * pool = NULL;
+	CarrierCollection * carrier_collection = NULL;
+	int held_voltage = -1; // voltage whose fields are loaded in this rank
+	std::vector< std::valarray<double> > vva_elec, vva_hole;
+
+	// Computes one unit: total current for every z of (voltage k, position l)
+	auto compute_unit = [&](int k, int l, std::vector<double> &result)
+	{
+		if (!carrier_collection)
+		{
+			pool = new ThreadPool(nThreads);
+			carrier_collection = new CarrierCollection(&detector);
+			{
+				Profiler::Scope scope(Profiler::CARRIER_READ);
+				carrier_collection->add_carriers_from_file(QString::fromUtf8(file_carriers.c_str()), nChunks);
+			}
+			carrier_collection->set_use_w_potential(use_w_potential);
+			vva_elec.assign(nChunks, std::valarray<double>((size_t) n_tSteps));
+			vva_hole.assign(nChunks, std::valarray<double>((size_t) n_tSteps));
+			Profiler::Scope scope(Profiler::FIELD_SOLVE);
+			detector.solve_w_u();
+			if (!use_w_potential) detector.solve_w_f_grad();
+		}
+		if (k != held_voltage)
+		{
+			Profiler::Scope scope(Profiler::FIELD_SOLVE);
+			detector.set_voltages(voltages[k], v_depletion);
+			detector.solve_d_u();
+			detector.solve_d_f_grad();
+			detector.get_mesh()->bounding_box_tree();
+			held_voltage = k;
+		}
+
+		result.assign(nZ*n_tSteps, 0.);
+		for (int i = 0; i < nZ; i++)
+		{
+			for (int c = 0; c < nChunks; c++)
+			{
+				vva_elec[c] = 0.;
+				vva_hole[c] = 0.;
+				double y_shift = y_shifts[l], z_shift = z_shifts[i];
+				pool->submit([=, &vva_elec, &vva_hole]()
+				{
+					Profiler::Scope scope(Profiler::DRIFT);
+					carrier_collection->simulate_drift( dt, max_time, y_shift, z_shift, vva_elec[c], vva_hole[c], c);
+				});
+			}
+			pool->wait();
+			// Fixed summation order, independent of the scheduling
+			for (int c = 0; c < nChunks; c++)
+			{
+				for (int j = 0; j < n_tSteps; j++)
+				{
+					result[i*n_tSteps + j] += vva_elec[c][j] + vva_hole[c][j];
+				}
+			}
+		}
+	};
+
+	if (rank != 0)
+	{
+		// Worker: ask for work, compute it, send it back, repeat
+		std::vector<double> result;
+		int unit[2];
+		MPI_Send(&held_voltage, 1, MPI_INT, 0, TAG_READY, MPI_COMM_WORLD);
+		while (true)
+		{
+			MPI_Recv(unit, 2, MPI_INT, 0, TAG_WORK, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			if (unit[0] < 0) break;
+			compute_unit(unit[0], unit[1], result);
+			MPI_Send(result.data(), nZ*n_tSteps, MPI_DOUBLE, 0, TAG_RESULT, MPI_COMM_WORLD);
+		}
+	}
+	else
+	{
+		// Master
+		std::string dtime = std::to_string((int) std::floor(dt*1.e12));
+		std::string neigh = std::to_string(nns);
+		std::string stepV = std::to_string((int) std::floor(deltaV));
+		std::string stepZ = std::to_string((int) std::floor(deltaZ));
+		std::string stepY = std::to_string((int) std::floor(deltaY));
+		std::string cap = std::to_string((int) std::floor(C*1.e12));
+		std::string voltage = std::to_string((int) std::floor(vInit));
+
+		std::vector<double> z_chifs(nZ), y_chifs(nY);
+		for (int i = 0; i < nZ; i++) z_chifs[i] = z_shifts[i]/1000.;
+		for (int i = 0; i < nY; i++) y_chifs[i] = y_shifts[i]/1000.;
+
+		std::string hetct_conv_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+"_conv.hetct";
+		std::string hetct_noconv_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+"_noconv.hetct";
+		std::string outputFormat = "hetct";
+		utilities::get_config_value("Config.TRACS", "OutputFormat", outputFormat);
+		bool write_hetct = (outputFormat != "binary");
+		bool write_binary = (outputFormat == "binary" || outputFormat == "both");
+		std::string electronics = "None";
+		utilities::get_config_value("Config.TRACS", "Electronics", electronics);
+		ElectronicsChain chain(electronics);
+		std::string hetct_shaped_filename = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType+"_shaped.hetct";
+		if (write_hetct)
+		{
+			utilities::write_to_hetct_header(hetct_conv_filename, &detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+			utilities::write_to_hetct_header(hetct_noconv_filename, &detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+			if (!chain.is_empty()) utilities::write_to_hetct_header(hetct_shaped_filename, &detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+		}
+		std::string text = utilities::hetct_header(&detector, C, dt, y_chifs, z_chifs, waveLength, scanType, file_carriers, voltages);
+		std::string base = start+"_dt"+dtime+"ps_"+cap+"pF_t"+trap+"ns_dz"+stepZ+"um_dy"+stepY+"dV"+stepV+"V_"+neigh+"nns_"+scanType;
+		ScanFileWriter scan_conv, scan_noconv, scan_shaped;
+		if (write_binary)
+		{
+			scan_conv.open(base+"_conv.tscan", text, voltages, y_shifts, z_shifts, {"conv"}, 2*n_tSteps, max_time/n_tSteps, -max_time, detector.get_temperature());
+			scan_noconv.open(base+"_noconv.tscan", text, voltages, y_shifts, z_shifts, {"noconv"}, n_tSteps, max_time/n_tSteps, 0.0, detector.get_temperature());
+			if (!chain.is_empty()) scan_shaped.open(base+"_shaped.tscan", text, voltages, y_shifts, z_shifts, {"shaped"}, n_tSteps, max_time/n_tSteps, 0.0, detector.get_temperature());
+		}
+
+		ResultWriter results;
+
+		std::string rootCompression = "101";
+		utilities::get_config_value("Config.TRACS", "RootCompression", rootCompression);
+		ScanTree tree;
+		tree.add_stage("i_ramo", n_tSteps, 0.0);
+		tree.add_stage("i_conv", 2*n_tSteps, -max_time);
+		if (!chain.is_empty()) tree.add_stage("i_shaped", n_tSteps, 0.0);
+		tree.open(base+".root", max_time/n_tSteps, text, std::atoi(rootCompression.c_str()));
+
+		TH1D *hnoconv = new TH1D("hnoconv","Ramo current",n_tSteps, 0.0, max_time);
+		TH1D *hconv = new TH1D("hconv","Amplifier convoluted",2*n_tSteps, -max_time, max_time);
+
+		// Checkpoint of the finished points, same file as the TRACS executable
+		bool resume = false, quiet = false;
+		for (int a = 1; a < argc; a++)
+		{
+			if (std::string(argv[a]) == "--resume") resume = true;
+			if (std::string(argv[a]) == "--quiet") quiet = true;
+		}
+		std::string checkpointInterval = "60";
+		utilities::get_config_value("Config.TRACS", "CheckpointInterval", checkpointInterval);
+		double ckp_interval = std::atof(checkpointInterval.c_str());
+		Checkpoint checkpoint;
+		if (ckp_interval > 0)
+		{
+			uint64_t key = Checkpoint::inputs_key("Config.TRACS", file_carriers);
+			checkpoint.open(base+".ckp", nUnits*nZ, n_tSteps, key, resume, ckp_interval);
+		}
+		else if (resume) std::cout << "CheckpointInterval is 0, nothing to resume" << std::endl;
+
+		// Result cache of previous runs, only used by the master
+		std::string resultCache = "None";
+		utilities::get_config_value("Config.TRACS", "ResultCache", resultCache);
+		ResultCache cache;
+		if (resultCache != "None") cache.open(resultCache);
+		uint64_t inputs = ResultCache::inputs_key("Config.TRACS", file_carriers);
+		auto point_key = [&](int unit, int i) { return ResultCache::point_key(inputs, voltages[unit/nY], y_shifts[unit%nY], z_shifts[i]); };
+
+		// Writes unit (k, l), same output as the TRACS executable
+		auto write_unit = [&](int k, int l, const std::vector<double> &result)
+		{
+			std::vector< std::vector<double> > i_conv(nZ, std::vector<double>(2*n_tSteps));
+			for (int i = 0; i < nZ; i++)
+			{
+				std::vector<double> &conv = i_conv[i];
+				for (int j=0; j < n_tSteps; j++)
+				{
+					hnoconv->SetBinContent( j+1 , result[i*n_tSteps + j] );
+				}
+				{
+					Profiler::Scope scope(Profiler::CONVOLUTION);
+					TransferFunction::get_default()->convolve(&result[i*n_tSteps], n_tSteps, max_time/n_tSteps, conv.data());
+				}
+				for (int j = 0; j < 2*n_tSteps; j++)
+				{
+					hconv->SetBinContent( j+1 , conv[j] );
+				}
+				Profiler::Scope scope(Profiler::WRITE);
+				if (write_hetct)
+				{
+					results.write_row(hetct_conv_filename, hconv, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
+					results.write_row(hetct_noconv_filename, hnoconv, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
+				}
+				scan_conv.write_waveform(conv.data());
+				scan_noconv.write_waveform(&result[i*n_tSteps]);
+			}
+			std::vector< std::valarray<double> > i_shaped(chain.is_empty() ? 0 : nZ, std::valarray<double>((size_t) n_tSteps));
+			if (!chain.is_empty())
+			{
+				// All depths shaped in one pass
+				for (int i = 0; i < nZ; i++)
+				{
+					for (int j = 0; j < n_tSteps; j++) i_shaped[i][j] = result[i*n_tSteps + j];
+				}
+				{
+					Profiler::Scope scope(Profiler::SHAPING);
+					chain.process(i_shaped, dt);
+				}
+				Profiler::Scope scope(Profiler::WRITE);
+				for (int i = 0; i < nZ; i++)
+				{
+					if (write_hetct) results.write_row(hetct_shaped_filename, &i_shaped[i][0], n_tSteps, detector.get_temperature(), y_shifts[l], z_shifts[i], voltages[k]);
+					scan_shaped.write_waveform(&i_shaped[i][0]);
+				}
+			}
+			Profiler::Scope scope(Profiler::WRITE);
+			for (int i = 0; i < nZ; i++)
+			{
+				std::vector<const double *> waveforms = {&result[i*n_tSteps], i_conv[i].data()};
+				if (!chain.is_empty()) waveforms.push_back(&i_shaped[i][0]);
+				tree.fill(voltages[k], y_shifts[l], z_shifts[i], detector.get_temperature(), waveforms);
+			}
+		};
+
+		// Units are numbered k*nY + l (output order). Results that arrive
+		// before some previous unit are kept until they can be written
+		std::map< int, std::vector<double> > done;
+		int next_write = 0;
+		// Units with every depth in the checkpoint or the cache are not 
+		// computed again
+		std::vector<char> restored(nUnits, 0);
+		for (int u = 0; u < nUnits; u++)
+		{
+			bool complete = true;
+			for (int i = 0; i < nZ && complete; i++) complete = checkpoint.is_done(u*nZ + i) || cache.contains(point_key(u, i), n_tSteps);
+			if (!complete) continue;
+			restored[u] = 1;
+			std::vector<double> &result = done[u];
+			result.resize(nZ*n_tSteps);
+			for (int i = 0; i < nZ; i++)
+			{
+				const double *waveform = checkpoint.get_waveform(u*nZ + i);
+				if (waveform) std::copy(waveform, waveform + n_tSteps, &result[i*n_tSteps]);
+				else cache.get(point_key(u, i), &result[i*n_tSteps], n_tSteps);
+			}
+		}
+		// Progress of the scan (ProgressInterval seconds, 0 or --quiet: nothing), in points
+		std::string progressInterval = "10";
+		utilities::get_config_value("Config.TRACS", "ProgressInterval", progressInterval);
+		Progress progress;
+		progress.start(nUnits*nZ, quiet ? 0. : std::atof(progressInterval.c_str()));
+		progress.skip(nZ*std::count(restored.begin(), restored.end(), 1));
+
+		auto save_unit = [&](int unit, const std::vector<double> &result)
+		{
+			for (int i = 0; i < nZ; i++)
+			{
+				checkpoint.save(unit*nZ + i, &result[i*n_tSteps]);
+				cache.put(point_key(unit, i), &result[i*n_tSteps], n_tSteps);
+			}
+			progress.add(nZ);
+		};
+		auto flush = [&]()
+		{
+			while (done.count(next_write))
+			{
+				write_unit(next_write/nY, next_write%nY, done[next_write]);
+				done.erase(next_write);
+				next_write++;
+			}
+		};
+
+		// Scheduling state: next y of every voltage to be handed out
+		std::vector<int> next_y(nV, 0);
+		std::vector<bool> started(nV, false);
+		auto next_unit = [&](int held, int &k, int &l)
+		{
+			k = -1;
+			for (int v = 0; v < nV; v++)
+			{
+				while (next_y[v] < nY && restored[v*nY + next_y[v]]) next_y[v]++;
+			}
+			if (held >= 0 && next_y[held] < nY) k = held;
+			for (int v = 0; k < 0 && v < nV; v++)
+			{
+				if (!started[v] && next_y[v] < nY) k = v;
+			}
+			int most = 0;
+			for (int v = 0; k < 0 && v < nV; v++)
+			{
+				if (nY - next_y[v] > most) most = nY - next_y[v];
+			}
+			for (int v = 0; k < 0 && most > 0 && v < nV; v++)
+			{
+				if (nY - next_y[v] == most) k = v;
+			}
+			if (k < 0) return false;
+			started[k] = true;
+			l = next_y[k]++;
+			return true;
+		};
+
+		// Restored units at the start of the scan can be written right away
+		flush();
+
+		if (size == 1)
+		{
+			std::vector<double> result;
+			int k, l;
+			while (next_unit(held_voltage, k, l))
+			{
+				compute_unit(k, l, result);
+				save_unit(k*nY + l, result);
+				done[k*nY + l] = result;
+				flush();
+			}
+		}
+		else
+		{
+			std::vector<int> held(size, -1);     // voltage loaded by every rank
+			std::vector<int> assigned(size, -1); // unit being computed by every rank
+			int active = size - 1;
+			while (active > 0)
+			{
+				MPI_Status status;
+				MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+				int r = status.MPI_SOURCE;
+				if (status.MPI_TAG == TAG_READY)
+				{
+					MPI_Recv(&held[r], 1, MPI_INT, r, TAG_READY, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				}
+				else
+				{
+					std::vector<double> result(nZ*n_tSteps);
+					MPI_Recv(result.data(), nZ*n_tSteps, MPI_DOUBLE, r, TAG_RESULT, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+					save_unit(assigned[r], result);
+					done[assigned[r]].swap(result);
+					flush();
+				}
+				int unit[2] = {-1, -1};
+				if (next_unit(held[r], unit[0], unit[1]))
+				{
+					held[r] = unit[0];
+					assigned[r] = unit[0]*nY + unit[1];
+				}
+				else
+				{
+					active--;
+				}
+				MPI_Send(unit, 2, MPI_INT, r, TAG_WORK, MPI_COMM_WORLD);
+			}
+		}
+		progress.finish();
+		if (next_write != nUnits) std::cout << "Error: only " << next_write << " of " << nUnits << " scan points were written" << std::endl;
+		results.close();
+		scan_conv.close();
+		scan_noconv.close();
+		scan_shaped.close();
+		tree.close();
+		cache.close();
+		if (next_write == nUnits) checkpoint.finish();
+		delete hnoconv;
+		delete hconv;
+	}
+
+	delete carrier_collection;
+	delete pool;
+	// One profile per rank, the summary of the master only
+	if (rank == 0) Profiler::print_summary();
+	Profiler::write_json("TRACS_profile_rank" + std::to_string(rank) + ".json");
+	MPI_Finalize();
+	return 0;
+}
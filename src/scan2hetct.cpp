@@ -0,0 +1,50 @@
+#include "ScanFile.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/*
+ ************** CONVERTER FROM BINARY SCAN FILES TO .hetct ***************
+ *
+ * Usage: TRACS-scan2hetct file.tscan [output.hetct] [channel]
+ *
+ * Writes one channel (name or index, first one by default) of a scan file
+ * in the text format of the .hetct files. The output name defaults to the
+ * input one with the .hetct extension.
+ *
+ */
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: " << argv[0] << " file.tscan [output.hetct] [channel]" << std::endl;
+		return 1;
+	}
+
+	std::string in_filename = argv[1];
+	std::string out_filename = in_filename;
+	std::size_t dot = out_filename.rfind(".tscan");
+	if (dot != std::string::npos) out_filename.erase(dot);
+	out_filename += ".hetct";
+	if (argc > 2) out_filename = argv[2];
+
+	ScanFileReader scan;
+	if (!scan.open(in_filename)) return 1;
+
+	int channel = 0;
+	if (argc > 3)
+	{
+		channel = scan.find_channel(argv[3]);
+		if (channel < 0) channel = std::atoi(argv[3]);
+	}
+	if (channel < 0 || channel >= scan.get_n_channels())
+	{
+		std::cout << "Channel " << argv[3] << " not in " << in_filename << std::endl;
+		return 1;
+	}
+
+	std::cout << "Converting channel " << scan.get_channel_name(channel) << " of " << in_filename << " (" << scan.get_n_voltages() << " voltages, " << scan.get_n_y() << " y, " << scan.get_n_z() << " z) to " << out_filename << std::endl;
+	return scan.write_hetct(out_filename, channel) ? 0 : 1;
+}
@@ -0,0 +1,525 @@
+/*
+ ************************** TRACS SERVER **************************
+ *
+ * Long-running TRACS for GUI front ends and external optimizers: the
+ * detector of Config.TRACS (mesh, function spaces, factorized operators of
+ * the field solvers, weighting field), the carrier files, the thread pool,
+ * the transfer function and the Electronics chain are built once, and every
+ * request only pays for what it changes:
+ *
+ *  - fields are solved again only when the voltage or Neff change (two back
+ *    substitutions, SMSDetector operator cache)
+ *  - carrier files are read the first time they are used and kept
+ *  - the last drift (currents without trapping, grouped by generation) is
+ *    kept, so a request that only changes the trapping time does not drift
+ *
+ * Requests are read one per line from stdin, or from the clients of a local
+ * (UNIX domain) socket with --socket, one client at a time. A request is
+ * either a command followed by key=value tokens
+ *
+ *   simulate voltage=200 y=40 z=150 signal=conv trapping=3e-9
+ *
+ * or a flat JSON object with the command in "cmd":
+ *
+ *   {"cmd": "simulate", "voltage": 200, "y": 40, "z": 150, "neff": [1, 0, 0, 2, 10, 290]}
+ *
+ * Commands:
+ *
+ *  - simulate  keys: voltage (V, default VInit), y, z (microns, default YInit,
+ *              ZInit), signal (conv|ramo|shaped, default conv), carriers (file,
+ *              default CarrierFile), trapping or trapping_e/trapping_h
+ *              (seconds), neff (y0,y1,y2,y3,z1,z2 as in Config.TRACS).
+ *              Trapping and Neff are only used with Fluence > 0, as in TRACS
+ *  - load      keys: carriers. Reads a carrier file ahead of its first use
+ *  - info      detector and time axis
+ *  - ping
+ *  - quit      stops the server
+ *
+ * Every reply starts with one JSON line, {"status": "ok", ...} or
+ * {"status": "error", "message": "..."}. The reply of simulate also has
+ * "samples", "dt" and "t0" (first sample, seconds) and the time spent, and
+ * the line is followed by the waveform: samples doubles in the byte order
+ * of the machine (binary, 8*samples bytes).
+ *
+ * In stdin mode the replies go to stdout and everything TRACS prints goes
+ * to stderr, so stdout only carries the protocol.
+ *
+ * Usage (from bin/): ./TRACS-server [--socket path]
+ */
+
+#include "SMSDetector.h"
+#include "utilities.h"
+#include "CarrierCollection.h"
+#include "ThreadPool.h"
+#include "TransferFunction.h"
+#include "ElectronicsChain.h"
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Line based input and raw output on a pair of file descriptors (stdin/stdout
+ * or a socket)
+ */
+class Channel
+{
+	private:
+		int _in_fd;
+		int _out_fd;
+		std::string _buffer;
+
+	public:
+		Channel(int in_fd, int out_fd) : _in_fd(in_fd), _out_fd(out_fd) {}
+
+		bool read_line(std::string &line)
+		{
+			while (true)
+			{
+				size_t end = _buffer.find('\n');
+				if (end != std::string::npos)
+				{
+					line = _buffer.substr(0, end);
+					_buffer.erase(0, end + 1);
+					if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size() - 1);
+					return true;
+				}
+				char chunk[4096];
+				ssize_t n = ::read(_in_fd, chunk, sizeof(chunk));
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0)
+				{
+					// Last line without newline
+					line.swap(_buffer);
+					_buffer.clear();
+					return !line.empty();
+				}
+				_buffer.append(chunk, n);
+			}
+		}
+
+		bool write(const void *data, size_t size)
+		{
+			const char *p = (const char *) data;
+			while (size > 0)
+			{
+				ssize_t n = ::write(_out_fd, p, size);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) return false;
+				p += n;
+				size -= n;
+			}
+			return true;
+		}
+
+		bool write_line(const std::string &line)
+		{
+			return write((line + "\n").c_str(), line.size() + 1);
+		}
+};
+
+static std::string json_escape(const std::string &s)
+{
+	std::string out;
+	for (unsigned int i = 0; i < s.size(); i++)
+	{
+		if (s[i] == '"' || s[i] == '\\') out += '\\';
+		if (s[i] == '\n') out += "\\n";
+		else out += s[i];
+	}
+	return out;
+}
+
+static std::string error_reply(const std::string &message)
+{
+	return "{\"status\": \"error\", \"message\": \"" + json_escape(message) + "\"}";
+}
+
+/*
+ * Command and key/value pairs of a request line, key=value tokens or a flat
+ * JSON object (numbers, strings and arrays of numbers). Arrays are returned
+ * as comma separated lists. Returns false on a malformed line
+ */
+static bool parse_request(const std::string &line, std::string &command, std::map<std::string, std::string> &args)
+{
+	command.clear();
+	args.clear();
+	size_t start = line.find_first_not_of(" \t");
+	if (start == std::string::npos) return true;
+
+	if (line[start] != '{')
+	{
+		std::istringstream tokens(line);
+		std::string token;
+		tokens >> command;
+		while (tokens >> token)
+		{
+			size_t eq = token.find('=');
+			if (eq == std::string::npos || eq == 0) return false;
+			args[token.substr(0, eq)] = token.substr(eq + 1);
+		}
+		return true;
+	}
+
+	size_t i = start + 1;
+	auto skip = [&]() { while (i < line.size() && std::isspace((unsigned char) line[i])) i++; };
+	auto string_at = [&](std::string &s) -> bool
+	{
+		if (i >= line.size() || line[i] != '"') return false;
+		size_t end = line.find('"', ++i);
+		if (end == std::string::npos) return false;
+		s = line.substr(i, end - i);
+		i = end + 1;
+		return true;
+	};
+	skip();
+	if (i < line.size() && line[i] == '}') return true;
+	while (i < line.size())
+	{
+		std::string key, value;
+		skip();
+		if (!string_at(key)) return false;
+		skip();
+		if (i >= line.size() || line[i++] != ':') return false;
+		skip();
+		if (i < line.size() && line[i] == '"')
+		{
+			if (!string_at(value)) return false;
+		}
+		else if (i < line.size() && line[i] == '[')
+		{
+			size_t end = line.find(']', i);
+			if (end == std::string::npos) return false;
+			for (size_t k = i + 1; k < end; k++)
+			{
+				if (!std::isspace((unsigned char) line[k])) value += line[k];
+			}
+			i = end + 1;
+		}
+		else
+		{
+			size_t end = line.find_first_of(",}", i);
+			if (end == std::string::npos) return false;
+			value = line.substr(i, end - i);
+			value.erase(value.find_last_not_of(" \t") + 1);
+			i = end;
+		}
+		if (key == "cmd") command = value;
+		else args[key] = value;
+		skip();
+		if (i < line.size() && line[i] == ',') { i++; continue; }
+		if (i < line.size() && line[i] == '}') return true;
+		return false;
+	}
+	return false;
+}
+
+static bool to_double(const std::string &s, double &value)
+{
+	char *end = NULL;
+	value = std::strtod(s.c_str(), &end);
+	return !s.empty() && *end == '\0' && std::isfinite(value);
+}
+
+int main(int argc, char *argv[])
+{
+	std::string socket_path;
+	for (int a = 1; a < argc; a++)
+	{
+		std::string arg = argv[a];
+		if (arg == "--socket" && a + 1 < argc) socket_path = argv[++a];
+		else
+		{
+			std::cout << "Usage: " << argv[0] << " [--socket path]" << std::endl;
+			return 1;
+		}
+	}
+
+	// In stdin mode stdout only carries replies: TRACS messages go to stderr
+	int reply_fd = STDOUT_FILENO;
+	if (socket_path.empty())
+	{
+		std::fflush(stdout);
+		reply_fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+	// A client that goes away must not stop the server
+	std::signal(SIGPIPE, SIG_IGN);
+
+	// Detector, time axis and defaults: same inputs as the TRACS executable
+	double pitch = 0, width = 0, depth = 0, temp = 0, trapping = 0, fluence = 0, C = 0, dt = 0, max_time = 0,
+		   vInit = 0, deltaV = 0, vMax = 0, v_depletion = 0, deltaZ = 0, zInit = 0., zMax = 0., yInit = 0., yMax = 0, deltaY = 5.;
+	int nThreads = 0, nns = 0, n_cells_y = 0, n_cells_x = 0, waveLength = 0;
+	char bulk_type = '\0', implant_type = '\0';
+	std::string scanType = "defaultString";
+	std::string neffType = "defaultString";
+	std::vector<double> neff_param(8,0.);
+	std::string file_carriers = "etct.carriers";
+	utilities::parse_config_file("Config.TRACS", file_carriers, depth, width,  pitch, nns, temp, trapping, fluence, nThreads, n_cells_x, n_cells_y, bulk_type, implant_type, waveLength, scanType, C, dt, max_time, vInit, deltaV, vMax, v_depletion, zInit, zMax, deltaZ, yInit, yMax, deltaY, neff_param, neffType);
+	if (nThreads < 1) nThreads = 1;
+	int nChunks = 4*nThreads;
+	int n_tSteps = (int) std::floor(max_time / dt);
+	double trapping_e = trapping, trapping_h = trapping;
+	utilities::get_trapping_times("Config.TRACS", trapping, trapping_e, trapping_h);
+
+	parameters["allow_extrapolation"] = true;
+	SMSDetector detector(pitch, width, depth, nns, bulk_type, implant_type, n_cells_x, n_cells_y, temp, trapping, fluence, neff_param, neffType);
+	detector.set_operator_cache(true);
+	detector.set_trapping_time(trapping_e, trapping_h);
+	std::string ramoCurrent = "Field";
+	utilities::get_config_value("Config.TRACS", "RamoCurrent", ramoCurrent);
+	bool use_w_potential = (ramoCurrent == "Potential");
+	detector.set_voltages(vInit, v_depletion);
+	detector.solve_w_u();
+	if (!use_w_potential) detector.solve_w_f_grad();
+	detector.solve_d_u();
+	detector.solve_d_f_grad();
+	detector.get_mesh()->bounding_box_tree();
+	double solved_voltage = vInit;
+	std::vector<double> solved_neff = neff_param;
+
+	ThreadPool pool(nThreads);
+	std::string electronics = "None";
+	utilities::get_config_value("Config.TRACS", "Electronics", electronics);
+	ElectronicsChain chain(electronics);
+	TransferFunction::get_default();
+
+	// Carrier files read so far
+	std::map< std::string, std::shared_ptr<CarrierCollection> > collections;
+	auto get_collection = [&](const std::string &name) -> CarrierCollection *
+	{
+		std::map< std::string, std::shared_ptr<CarrierCollection> >::iterator it = collections.find(name);
+		if (it != collections.end()) return it->second.get();
+		if (access(name.c_str(), R_OK) != 0) return NULL;
+		std::shared_ptr<CarrierCollection> collection(new CarrierCollection(&detector));
+		collection->set_use_w_potential(use_w_potential);
+		collection->add_carriers_from_file(QString::fromUtf8(name.c_str()), nChunks);
+		collections[name] = collection;
+		return collection.get();
+	};
+	if (!get_collection(file_carriers)) std::cout << "Carrier file " << file_carriers << " not found, requests must give carriers=" << std::endl;
+
+	// Last drift, reused while only the trapping time changes
+	TrappingDecomposition last_drift;
+	std::string last_drift_key;
+
+	// Answers one request, false when the server has to stop
+	auto handle = [&](Channel &channel, const std::string &line) -> bool
+	{
+		std::string command;
+		std::map<std::string, std::string> args;
+		if (!parse_request(line, command, args))
+		{
+			channel.write_line(error_reply("malformed request"));
+			return true;
+		}
+		if (command.empty()) return true;
+		if (command == "quit")
+		{
+			channel.write_line("{\"status\": \"ok\"}");
+			return false;
+		}
+		if (command == "ping")
+		{
+			channel.write_line("{\"status\": \"ok\"}");
+			return true;
+		}
+		if (command == "info")
+		{
+			char reply[512];
+			std::snprintf(reply, sizeof(reply), "{\"status\": \"ok\", \"pitch\": %.17g, \"width\": %.17g, \"depth\": %.17g, \"nns\": %d, \"fluence\": %.17g, \"dt\": %.17g, \"max_time\": %.17g, \"steps\": %d, \"threads\": %d, \"carrier_files\": %d}",
+					pitch, width, depth, nns, fluence, dt, max_time, n_tSteps, nThreads, (int) collections.size());
+			channel.write_line(reply);
+			return true;
+		}
+		if (command == "load")
+		{
+			std::string name = args.count("carriers") ? args["carriers"] : file_carriers;
+			channel.write_line(get_collection(name) ? "{\"status\": \"ok\"}" : error_reply("carrier file " + name + " not found"));
+			return true;
+		}
+		if (command != "simulate")
+		{
+			channel.write_line(error_reply("unknown command " + command));
+			return true;
+		}
+
+		// simulate
+		double voltage = vInit, y = yInit, z = zInit, tau_e = trapping_e, tau_h = trapping_h;
+		std::string signal = "conv", carriers = file_carriers;
+		std::vector<double> neff = solved_neff;
+		for (std::map<std::string, std::string>::iterator it = args.begin(); it != args.end(); ++it)
+		{
+			const std::string &key = it->first;
+			bool valid = true;
+			if (key == "voltage") valid = to_double(it->second, voltage);
+			else if (key == "y") valid = to_double(it->second, y);
+			else if (key == "z") valid = to_double(it->second, z);
+			else if (key == "trapping") valid = to_double(it->second, tau_e) && to_double(it->second, tau_h);
+			else if (key == "trapping_e") valid = to_double(it->second, tau_e);
+			else if (key == "trapping_h") valid = to_double(it->second, tau_h);
+			else if (key == "signal") signal = it->second;
+			else if (key == "carriers") carriers = it->second;
+			else if (key == "neff")
+			{
+				// y0,y1,y2,y3,z1,z2 -> y0..y3, z0 = 0, z1, z2, z3 = depth
+				std::vector<double> v;
+				std::istringstream list(it->second);
+				std::string item;
+				double d = 0.;
+				while (valid && std::getline(list, item, ','))
+				{
+					valid = to_double(item, d);
+					v.push_back(d);
+				}
+				valid = valid && v.size() == 6 && v[4] > 0. && v[4] < v[5] && v[5] < depth;
+				if (valid) neff = {v[0], v[1], v[2], v[3], 0., v[4], v[5], depth};
+			}
+			else
+			{
+				channel.write_line(error_reply("unknown key " + key));
+				return true;
+			}
+			if (!valid)
+			{
+				channel.write_line(error_reply("invalid value of " + key));
+				return true;
+			}
+		}
+		if (signal != "conv" && signal != "ramo" && signal != "shaped")
+		{
+			channel.write_line(error_reply("signal must be conv, ramo or shaped"));
+			return true;
+		}
+		if (signal == "shaped" && chain.is_empty())
+		{
+			channel.write_line(error_reply("signal shaped needs an Electronics chain in Config.TRACS"));
+			return true;
+		}
+		if (tau_e <= 0. || tau_h <= 0.)
+		{
+			channel.write_line(error_reply("trapping times must be > 0"));
+			return true;
+		}
+		if (fluence <= 0) tau_e = tau_h = std::numeric_limits<double>::max();
+		CarrierCollection *collection = get_collection(carriers);
+		if (!collection)
+		{
+			channel.write_line(error_reply("carrier file " + carriers + " not found"));
+			return true;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (voltage != solved_voltage || neff != solved_neff)
+		{
+			detector.set_neff_param(neff);
+			detector.set_voltages(voltage, v_depletion);
+			detector.solve_d_u();
+			detector.solve_d_f_grad();
+			solved_voltage = voltage;
+			solved_neff = neff;
+			last_drift_key.clear();
+		}
+		std::chrono::steady_clock::time_point solved = std::chrono::steady_clock::now();
+
+		std::ostringstream key;
+		key.precision(17);
+		key << carriers << ' ' << y << ' ' << z;
+		if (key.str() != last_drift_key)
+		{
+			last_drift = TrappingDecomposition();
+			collection->simulate_drift(dt, max_time, y, z, last_drift, &pool);
+			last_drift_key = key.str();
+		}
+		std::valarray<double> i_elec((size_t) n_tSteps), i_hole((size_t) n_tSteps);
+		last_drift.get_current(tau_e, tau_h, i_elec, i_hole);
+		std::chrono::steady_clock::time_point drifted = std::chrono::steady_clock::now();
+
+		std::vector< std::valarray<double> > waves(1, i_elec + i_hole);
+		double t0 = 0.;
+		if (signal == "conv")
+		{
+			std::valarray<double> conv(2*n_tSteps);
+			TransferFunction::get_default()->convolve(&waves[0][0], n_tSteps, max_time/n_tSteps, &conv[0]);
+			waves[0].resize(conv.size());
+			waves[0] = conv;
+			t0 = -max_time;
+		}
+		else if (signal == "shaped") chain.process(waves, dt);
+		std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+
+		char reply[512];
+		std::snprintf(reply, sizeof(reply), "{\"status\": \"ok\", \"samples\": %d, \"dt\": %.17g, \"t0\": %.17g, \"solve_ms\": %.3f, \"drift_ms\": %.3f, \"signal_ms\": %.3f}",
+				(int) waves[0].size(), (signal == "conv") ? max_time/n_tSteps : dt, t0,
+				std::chrono::duration<double, std::milli>(solved - start).count(),
+				std::chrono::duration<double, std::milli>(drifted - solved).count(),
+				std::chrono::duration<double, std::milli>(done - drifted).count());
+		if (channel.write_line(reply)) channel.write(&waves[0][0], waves[0].size()*sizeof(double));
+		return true;
+	};
+
+	std::cout << "TRACS server ready (" << (socket_path.empty() ? std::string("stdin") : socket_path) << ")" << std::endl;
+	if (socket_path.empty())
+	{
+		Channel channel(STDIN_FILENO, reply_fd);
+		std::string line;
+		while (channel.read_line(line) && handle(channel, line)) {}
+		return 0;
+	}
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Socket path " << socket_path << " is too long" << std::endl;
+		return 1;
+	}
+	std::strcpy(address.sun_path, socket_path.c_str());
+	int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socket_path.c_str());
+	if (server_fd < 0 || bind(server_fd, (sockaddr *) &address, sizeof(address)) != 0 || listen(server_fd, 4) != 0)
+	{
+		std::cout << "Socket " << socket_path << " could not be created: " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+	bool running = true;
+	while (running)
+	{
+		int client_fd = accept(server_fd, NULL, NULL);
+		if (client_fd < 0)
+		{
+			if (errno == EINTR) continue;
+			std::cout << "accept failed: " << std::strerror(errno) << std::endl;
+			break;
+		}
+		Channel channel(client_fd, client_fd);
+		std::string line;
+		while (channel.read_line(line))
+		{
+			if (!handle(channel, line))
+			{
+				running = false;
+				break;
+			}
+		}
+		close(client_fd);
+	}
+	close(server_fd);
+	unlink(socket_path.c_str());
+	return 0;
+}
@@ -248,12 +248,11 @@ void utilities::write_to_hetct_header(std::string filename, SMSDetector detector
 }
 
 //SLIGHTLY MODIFIED TO WORK WITH SMSDetector *detector
-// function to write results to file (in rows)
-// overloaded (now from TH1D)
-void utilities::write_to_hetct_header(std::string filename, SMSDetector * detector, double C, double dt,std::vector<double> y_shifts, std::vector<double> z_shifts, double landa, std::string type, std::string carriers_file, std::vector<double> voltages)
+// Text of the header of the .hetct files (also stored in the binary scan files)
+std::string utilities::hetct_header(SMSDetector * detector, double C, double dt,std::vector<double> y_shifts, std::vector<double> z_shifts, double landa, std::string type, std::string carriers_file, std::vector<double> voltages)
 {
-	// Initialize stream for outputting to file
-	std::ofstream header;  
+	// Header is built in memory
+	std::ostringstream header;
 
 	// Derived quantities
 	int nX = 0;
@@ -276,74 +275,80 @@ void utilities::write_to_hetct_header(std::string filename, SMSDetector * detect
 	std::string s_vVector = utilities::vector_to_string(voltages);
 	std::string s_yVector = utilities::vector_to_string(y_shifts);
 	
+	header << "================\n";
+	header << "SSD simulation file\n";
+	header << "version: 1.0\n";
+	header << "================\n";
+	header << "scanType: " << "TRACS\n";
+	header << "startTime: " << s_date << "\n" ;
+	header << "landaLaser: " << landa << "\n";
+	header << "illumDirect: " << type << "\n";
+	header << "ampGain: 0\n";
+	header << "fluence: " << detector->get_fluence() << "\n";
+	header << "annealing: 0\n";
+	header << "numOfScans: " << nScans << "\n";
+	header << "temperatureMin: " << temp  << "\n";
+	header << "temperatureMax: " << temp  << "\n";
+	header << "deltaTemperature: " << 0. << "\n";
+	header << "nTemperature: 1\n";
+	header << "temperatureVector: " << temp  << "\n";
+	header << "voltageMin: " << voltages.front() << "\n";
+	header << "voltageMax: " << voltages.back() << "\n";
+	header << "deltaVoltage: " << deltaV << "\n";
+	header << "nVoltage: " << nV << "\n";
+	header << "voltageVector: " << s_vVector << "\n";
+	header << "pulsePowerIntensityMin: 60.000\n";
+	header << "pulsePowerIntensityMax: 60.000\n";
+	header << "deltaPulsePowerIntensity: 0\n";
+	header << "nPulsePowerIntensity: 1\n";
+	header << "pulsePowerIntensityVector: 60.000 \n";
+	header << "pulseWidthMin: 0.000\n";
+	header << "pulseWidthMax: 0.000\n";
+	header << "deltaPulseWidth: 0\n";
+	header << "nPulseWidth: 1\n";
+	header << "pulseWidthVector: 0.000 \n";
+	header << "xMin: 0.000\n";
+	header << "xMax: 0.000\n";
+	header << "deltaX: 0\n";
+	header << "nX: 1\n";
+	// X o Y tengo que aclararme porque no lo entiendo!!!
+	header << "yMin: " << y_shifts.front() << "\n";
+	header << "yMax: " << y_shifts.back() << "\n";
+	header << "deltaY: " << deltaY << "\n";
+	header << "nY: " << nY << "\n";
+	header << "yVector: " << s_yVector << "\n";
+	header << "zMin: " << z_shifts.front() << "\n";
+	header << "zMax: " << z_shifts.back() << "\n";
+	header << "deltaZ: " << deltaZ << "\n";
+	header << "nZ: " << nZ << "\n";
+	header << "zVector: " << s_zVector << "\n";
+	header << "At: " << std::fixed << std::setprecision(15) << dt << "\n";
+	header << "Capacitance[F]: " <<  std::fixed << std::setprecision(15) << C << "\n";
+	header << "Bulk: " << detector->get_bulk_type() << "\n";
+	header << "Implant: " << detector->get_implant_type() << "\n";
+	header << "NStrips: " << detector->get_nns() << "\n";
+	header << "Pitch: " << std::setprecision(0) << detector->get_pitch() << "\n";
+	header << "Width: " << std::setprecision(0) << detector->get_width() << "\n";
+	header << "Depth: " << std::setprecision(0) << detector->get_depth() << "\n";
+	header << "Vdep: " << detector->get_vdep() << "\n";
+	header << "Carriers File: " << carriers_file << "\n";
+	header << "================\n";
+	header <<	 "Nt T[C] Vset[V] x[mm] y[mm] z[mm] I(t)[A]\n";
+	header <<	 "================\n";
+
+	return header.str();
+}
+
+// function to write the header of the .hetct files
+void utilities::write_to_hetct_header(std::string filename, SMSDetector * detector, double C, double dt,std::vector<double> y_shifts, std::vector<double> z_shifts, double landa, std::string type, std::string carriers_file, std::vector<double> voltages)
+{
 	// Open file
-	header.open (filename);  
+	std::ofstream header(filename);
 
 	// Check the file was open
 	if (header.is_open())
 	{ 
-		// Store header string 
-		header << "================\n";
-		header << "SSD simulation file\n";
-		header << "version: 1.0\n";
-		header << "================\n";
-		header << "scanType: " << "TRACS\n";
-		header << "startTime: " << s_date << "\n" ;
-		header << "landaLaser: " << landa << "\n";
-		header << "illumDirect: " << type << "\n";
-		header << "ampGain: 0\n";
-		header << "fluence: " << detector->get_fluence() << "\n";
-		header << "annealing: 0\n";
-		header << "numOfScans: " << nScans << "\n";
-		header << "temperatureMin: " << temp  << "\n";
-		header << "temperatureMax: " << temp  << "\n";
-		header << "deltaTemperature: " << 0. << "\n";
-		header << "nTemperature: 1\n";
-		header << "temperatureVector: " << temp  << "\n";
-		header << "voltageMin: " << voltages.front() << "\n";
-		header << "voltageMax: " << voltages.back() << "\n";
-		header << "deltaVoltage: " << deltaV << "\n";
-		header << "nVoltage: " << nV << "\n";
-		header << "voltageVector: " << s_vVector << "\n";
-		header << "pulsePowerIntensityMin: 60.000\n";
-		header << "pulsePowerIntensityMax: 60.000\n";
-		header << "deltaPulsePowerIntensity: 0\n";
-		header << "nPulsePowerIntensity: 1\n";
-		header << "pulsePowerIntensityVector: 60.000 \n";
-		header << "pulseWidthMin: 0.000\n";
-		header << "pulseWidthMax: 0.000\n";
-		header << "deltaPulseWidth: 0\n";
-		header << "nPulseWidth: 1\n";
-		header << "pulseWidthVector: 0.000 \n";
-		header << "xMin: 0.000\n";
-		header << "xMax: 0.000\n";
-		header << "deltaX: 0\n";
-		header << "nX: 1\n";
-		// X o Y tengo que aclararme porque no lo entiendo!!!
-		header << "yMin: " << y_shifts.front() << "\n";
-		header << "yMax: " << y_shifts.back() << "\n";
-		header << "deltaY: " << deltaY << "\n";
-		header << "nY: " << nY << "\n";
-		header << "yVector: " << s_yVector << "\n";
-		header << "zMin: " << z_shifts.front() << "\n";
-		header << "zMax: " << z_shifts.back() << "\n";
-		header << "deltaZ: " << deltaZ << "\n";
-		header << "nZ: " << nZ << "\n";
-		header << "zVector: " << s_zVector << "\n";
-		header << "At: " << std::fixed << std::setprecision(15) << dt << "\n";
-		header << "Capacitance[F]: " <<  std::fixed << std::setprecision(15) << C << "\n";
-		header << "Bulk: " << detector->get_bulk_type() << "\n";
-		header << "Implant: " << detector->get_implant_type() << "\n";
-		header << "NStrips: " << detector->get_nns() << "\n";
-		header << "Pitch: " << std::setprecision(0) << detector->get_pitch() << "\n";
-		header << "Width: " << std::setprecision(0) << detector->get_width() << "\n";
-		header << "Depth: " << std::setprecision(0) << detector->get_depth() << "\n";
-		header << "Vdep: " << detector->get_vdep() << "\n";
-		header << "Carriers File: " << carriers_file << "\n";
-		header << "================\n";
-		header <<	 "Nt T[C] Vset[V] x[mm] y[mm] z[mm] I(t)[A]\n";
-		header <<	 "================\n";
-
+		header << hetct_header(detector, C, dt, y_shifts, z_shifts, landa, type, carriers_file, voltages);
 		header.close();
 	}
 	else // Error output
@@ -933,6 +938,53 @@ void utilities::parse_config_file(std::string fileName, std::string &carrierFile
 */
 
 
+// Utility to read a single (optional) value from the configuration file. Used for 
+// settings that have a sensible default so older Config.TRACS files keep working.
+// Returns false and leaves value untouched if the key is not present.
+bool utilities::get_config_value(std::string fileName, std::string key, std::string &value)
+{
+	std::ifstream configFile(fileName, std::ios_base::in);
+	if (!configFile.is_open())
+	{
+		std::cout << "Error opening the file. Does the file " << fileName << " exist?" << std::endl;
+		return false;
+	}
+
+	std::string line, id, eq, val;
+	while(std::getline(configFile, line))
+	{
+		char start = line[0];
+		if (start == '#' || start == '\0' || start == '\t') continue;  // skip comments
+		std::istringstream isstream(line);
+		if (!(isstream >> id >> eq >> val)) continue;
+		if (id == key && eq == "=")
+		{
+			value = val;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Trapping times of electrons and holes: the optional TrappingTimeElectrons and 
+// TrappingTimeHoles keys, trapping (TrappingTime) for the one that is not given
+// or is not a positive number.
+void utilities::get_trapping_times(std::string fileName, double trapping, double &trapping_electrons, double &trapping_holes)
+{
+	const char *keys[2] = {"TrappingTimeElectrons", "TrappingTimeHoles"};
+	double *times[2] = {&trapping_electrons, &trapping_holes};
+	for (int k = 0; k < 2; k++)
+	{
+		std::string value;
+		*times[k] = trapping;
+		if (!get_config_value(fileName, keys[k], value)) continue;
+		double tau = std::atof(value.c_str());
+		if (tau > 0) *times[k] = tau;
+		else std::cout << "Invalid " << keys[k] << " = " << value << ", using TrappingTime" << std::endl;
+	}
+}
+
 void utilities::valarray2Hist(TH1D *hist, std::valarray<double> &valar)
 {
 	if (valar.size() == hist->GetSize()-2) {
@@ -8,6 +8,7 @@
 #include <TH1D.h>
 #include <TString.h>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <utility>
 #include "SMSDetector.h"
@@ -27,11 +28,14 @@ namespace utilities
 	void write_to_file_row(std::string filename, QVector<QVector<double>> results, double dt);
 	void write_to_file_row(std::string filename, TH1D *hconv, double temp, double yShift, double height, double voltage);
 	void write_to_hetct_header(std::string filename, SMSDetector detector, double C, double dt, std::vector<double> y_shifts, std::vector<double> z_shifts, double landa, std::string type, std::string carriers_file, std::vector<double> voltages);
+	std::string hetct_header(SMSDetector * detector, double C, double dt, std::vector<double> y_shifts, std::vector<double> z_shifts, double landa, std::string type, std::string carriers_file, std::vector<double> voltages);
 	void write_to_hetct_header(std::string filename, SMSDetector * detector, double C, double dt, std::vector<double> y_shifts, std::vector<double> z_shifts, double landa, std::string type, std::string carriers_file, std::vector<double> voltages);
 	std::string vector_to_string(std::vector<double> input_list);
 	void parse_config_file(std::string fileName, std::string &carrierFile, double &depth, double &width, double &pitch, int &nns, double &temp, double &trapping, double &fluence, int &nThreads, int &n_cells_x, int &n_cells_y, char &bulk_type, char &implant_type, int &waveLength, std::string &scanType, double &C, double &dt, double &max_time, double &v_init, double &deltaV, double &v_max, double &v_depletion, double &zInit, double &zMax, double &deltaZ, double &yInit, double &yMax, double &deltaY, std::vector<double> &neff_param, std::string &neffType);
 	void parse_config_file(std::string fileName, std::string &carrierFile, double &depth, double &width, double &pitch, int &nns, double &temp, double &trapping, double &fluence, int &n_cells_x, int &n_cells_y, char &bulk_type, char &implant_type, double &C, double &dt, double &max_time, double &vBias,double &vDepletion, double &zPos, double &yPos, std::vector<double> &neff_param, std::string &neffType);
 	//int get_nthreads(std::string fileName, int &nThreads);
+	bool get_config_value(std::string fileName, std::string key, std::string &value);
+	void get_trapping_times(std::string fileName, double trapping, double &trapping_electrons, double &trapping_holes);
 	void valarray2Hist(TH1D *hist, std::valarray<double> &valar);
 	void hist2Qvec(QVector<double> &qVec, TH1D *hist);
 	void hist2Qvec(QVector<double> &qVec, TH1D *hist, TH1D *histOverL);